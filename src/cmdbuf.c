@@ -0,0 +1,1141 @@
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+
+#include "psr_cmdbuf.h"
+
+__thread struct psr_cmdbuf *psr_cmdbuf_target = NULL;
+
+static void cmdbuf_flush(void);
+
+static const char *cmd_names[PSR_CMD_COUNT] = {
+    [PSR_CMD_SIZE] = "size",
+    [PSR_CMD_NO_LOOP] = "no_loop",
+    [PSR_CMD_LOOP] = "loop",
+    [PSR_CMD_REDRAW] = "redraw",
+    [PSR_CMD_FRAME_RATE] = "frame_rate",
+    [PSR_CMD_CURSOR] = "cursor",
+    [PSR_CMD_STROKE] = "stroke",
+    [PSR_CMD_NO_STROKE] = "no_stroke",
+    [PSR_CMD_BACKGROUND] = "background",
+    [PSR_CMD_PUSH_MATRIX] = "push_matrix",
+    [PSR_CMD_POP_MATRIX] = "pop_matrix",
+    [PSR_CMD_APPLY_MATRIX] = "apply_matrix",
+    [PSR_CMD_RESET_MATRIX] = "reset_matrix",
+    [PSR_CMD_PRINT_MATRIX] = "print_matrix",
+    [PSR_CMD_TRANSLATE] = "translate",
+    [PSR_CMD_ROTATE] = "rotate",
+    [PSR_CMD_SCALE] = "scale",
+    [PSR_CMD_BEGIN_SHAPE] = "begin_shape",
+    [PSR_CMD_VERTEX] = "vertex",
+    [PSR_CMD_END_SHAPE] = "end_shape",
+    [PSR_CMD_ARC] = "arc",
+    [PSR_CMD_BEZIER_DETAIL] = "bezier_detail",
+    [PSR_CMD_BEZIER_VERTEX] = "bezier_vertex",
+    [PSR_CMD_BOX] = "box",
+    [PSR_CMD_SPHERE] = "sphere",
+    [PSR_CMD_SPHERE_DETAIL] = "sphere_detail",
+    [PSR_CMD_STROKE_WEIGHT] = "stroke_weight",
+    [PSR_CMD_SMOOTH] = "smooth",
+    [PSR_CMD_NO_SMOOTH] = "no_smooth",
+    [PSR_CMD_FILL] = "fill",
+    [PSR_CMD_NO_FILL] = "no_fill",
+    [PSR_CMD_SAVE] = "save",
+    [PSR_CMD_IMAGE] = "image",
+    [PSR_CMD_CAMERA_DEFAULT] = "camera_default",
+    [PSR_CMD_CAMERA] = "camera",
+    [PSR_CMD_BEGIN_CAMERA] = "begin_camera",
+    [PSR_CMD_END_CAMERA] = "end_camera",
+    [PSR_CMD_ORTHO] = "ortho",
+    [PSR_CMD_CREATE_SHAPE] = "create_shape",
+    [PSR_CMD_END_SHAPE_RECORD] = "end_shape_record",
+    [PSR_CMD_SHAPE] = "shape",
+    [PSR_CMD_FREE_SHAPE] = "free_shape",
+    [PSR_CMD_FRAME] = "frame",
+    [PSR_CMD_TEXT_FONT] = "text_font",
+    [PSR_CMD_TEXT_SIZE] = "text_size",
+    [PSR_CMD_TEXT] = "text",
+    [PSR_CMD_STROKE_JOIN] = "stroke_join",
+    [PSR_CMD_STROKE_CAP] = "stroke_cap",
+    [PSR_CMD_CURVE_DETAIL] = "curve_detail",
+    [PSR_CMD_CURVE_TIGHTNESS] = "curve_tightness",
+    [PSR_CMD_CURVE_VERTEX] = "curve_vertex",
+    [PSR_CMD_HINT] = "hint",
+    [PSR_CMD_PICK_ID] = "pick_id",
+    [PSR_CMD_AUTO_DETAIL] = "auto_detail",
+    [PSR_CMD_DIRTY_RECT] = "dirty_rect",
+    [PSR_CMD_CREATE_GRAPHICS] = "create_graphics",
+    [PSR_CMD_FREE_GRAPHICS] = "free_graphics",
+    [PSR_CMD_BEGIN_DRAW] = "begin_draw",
+    [PSR_CMD_END_DRAW] = "end_draw",
+    [PSR_CMD_IMAGE_GRAPHICS] = "image_graphics",
+    [PSR_CMD_COMPOSITE] = "composite",
+};
+
+const char *psr_cmd_name(int op)
+{
+    if (op <= 0 || op >= PSR_CMD_COUNT || !cmd_names[op]) {
+	return "unknown";
+    }
+    return cmd_names[op];
+}
+
+void psr_cmdbuf_free(struct psr_cmdbuf *buf)
+{
+    free(buf->data);
+    buf->data = NULL;
+    buf->len = buf->size = 0;
+}
+
+/** append a command with 'words' argument words to buf and return its
+ * arguments.  NULL and nothing appended if the header can't hold words. */
+union psr_cmd_arg *psr_cmdbuf_alloc(struct psr_cmdbuf *buf, int op,
+				    size_t words)
+{
+    union psr_cmd_arg *cmd;
+
+    if (words > PSR_CMD_WORDS_MAX) {
+	psr_error("command %s too large: %zu words.",
+		  op < PSR_CMD_COUNT ? cmd_names[op] : "?", words);
+	return NULL;
+    }
+    if (buf->len + 1 + words > buf->size) {
+	size_t size = buf->size ? buf->size * 2 : 4096;
+	while (size < buf->len + 1 + words) {
+	    size *= 2;
+	}
+	cmd = realloc(buf->data, size * sizeof(*cmd));
+	if (!cmd) {
+	    psr_system_error(errno, "No memory for command buffer.");
+	}
+	buf->data = cmd;
+	buf->size = size;
+    }
+    cmd = buf->data + buf->len;
+    cmd->u = op | words << 8;
+    buf->len += 1 + words;
+    return cmd + 1;
+}
+
+static inline union psr_cmd_arg *cmd_alloc(int op, size_t words)
+{
+    return psr_cmdbuf_alloc(psr_cmdbuf_target, op, words);
+}
+
+/* pointers are only meaningful within the process, they are stored as
+ * two words */
+static void put_ptr(union psr_cmd_arg *a, const void *p)
+{
+    uint64_t v = (uintptr_t) p;
+    a[0].u = v;
+    a[1].u = v >> 32;
+}
+
+static void *get_ptr(const union psr_cmd_arg *a)
+{
+    return (void *) (uintptr_t) (a[0].u | (uint64_t) a[1].u << 32);
+}
+
+/* strings are copied, with a length word first.  NULL has length -1.
+ * the padding after the NUL is zeroed, a trace is the same every run. */
+static inline size_t str_words(const char *s)
+{
+    return 1 + (s ? (strlen(s) + 4) / 4 : 0);
+}
+
+static void put_str(union psr_cmd_arg *a, const char *s)
+{
+    if (!s) {
+	a[0].i = -1;
+	return;
+    }
+    a[0].i = strlen(s);
+    a[(a[0].i + 4) / 4].u = 0;
+    memcpy(a + 1, s, a[0].i + 1);
+}
+
+static const char *get_str(const union psr_cmd_arg *a)
+{
+    return a[0].i < 0 ? NULL : (const char *) (a + 1);
+}
+
+
+/********************************************************************
+ * Recorder
+ ********************************************************************/
+
+static int rec_size(int width, int height)
+{
+    union psr_cmd_arg *a = cmd_alloc(PSR_CMD_SIZE, 2);
+    a[0].i = width;
+    a[1].i = height;
+    return 0;
+}
+
+static int rec_no_loop(void)
+{
+    cmd_alloc(PSR_CMD_NO_LOOP, 0);
+    return 0;
+}
+
+static int rec_loop(void)
+{
+    cmd_alloc(PSR_CMD_LOOP, 0);
+    return 0;
+}
+
+static int rec_redraw(void)
+{
+    cmd_alloc(PSR_CMD_REDRAW, 0);
+    return 0;
+}
+
+static int rec_frame_rate(float framerate)
+{
+    cmd_alloc(PSR_CMD_FRAME_RATE, 1)->f = framerate;
+    return 0;
+}
+
+static int rec_cursor(int type)
+{
+    cmd_alloc(PSR_CMD_CURSOR, 1)->i = type;
+    return 0;
+}
+
+static int rec_stroke(float r, float g, float b, float a)
+{
+    union psr_cmd_arg *arg = cmd_alloc(PSR_CMD_STROKE, 4);
+    arg[0].f = r;
+    arg[1].f = g;
+    arg[2].f = b;
+    arg[3].f = a;
+    return 0;
+}
+
+static int rec_no_stroke(void)
+{
+    cmd_alloc(PSR_CMD_NO_STROKE, 0);
+    return 0;
+}
+
+static int rec_background(float r, float g, float b, float a)
+{
+    union psr_cmd_arg *arg = cmd_alloc(PSR_CMD_BACKGROUND, 4);
+    arg[0].f = r;
+    arg[1].f = g;
+    arg[2].f = b;
+    arg[3].f = a;
+    return 0;
+}
+
+static int rec_push_matrix(void)
+{
+    cmd_alloc(PSR_CMD_PUSH_MATRIX, 0);
+    return 0;
+}
+
+static int rec_pop_matrix(void)
+{
+    cmd_alloc(PSR_CMD_POP_MATRIX, 0);
+    return 0;
+}
+
+static int rec_apply_matrix(float n11, float n12, float n13, float n14,
+			    float n21, float n22, float n23, float n24,
+			    float n31, float n32, float n33, float n34,
+			    float n41, float n42, float n43, float n44)
+{
+    const float n[16] = {n11, n12, n13, n14, n21, n22, n23, n24,
+			 n31, n32, n33, n34, n41, n42, n43, n44};
+    union psr_cmd_arg *a = cmd_alloc(PSR_CMD_APPLY_MATRIX, 16);
+    int i;
+
+    for (i = 0; i < 16; ++i) {
+	a[i].f = n[i];
+    }
+    return 0;
+}
+
+static int rec_reset_matrix(void)
+{
+    cmd_alloc(PSR_CMD_RESET_MATRIX, 0);
+    return 0;
+}
+
+static int rec_print_matrix(void)
+{
+    cmd_alloc(PSR_CMD_PRINT_MATRIX, 0);
+    return 0;
+}
+
+static int rec_translate(float x, float y, float z)
+{
+    union psr_cmd_arg *a = cmd_alloc(PSR_CMD_TRANSLATE, 3);
+    a[0].f = x;
+    a[1].f = y;
+    a[2].f = z;
+    return 0;
+}
+
+static int rec_rotate(float angle, float x, float y, float z)
+{
+    union psr_cmd_arg *a = cmd_alloc(PSR_CMD_ROTATE, 4);
+    a[0].f = angle;
+    a[1].f = x;
+    a[2].f = y;
+    a[3].f = z;
+    return 0;
+}
+
+static int rec_scale(float x, float y, float z)
+{
+    union psr_cmd_arg *a = cmd_alloc(PSR_CMD_SCALE, 3);
+    a[0].f = x;
+    a[1].f = y;
+    a[2].f = z;
+    return 0;
+}
+
+static int rec_begin_shape(int mode)
+{
+    cmd_alloc(PSR_CMD_BEGIN_SHAPE, 1)->i = mode;
+    return 0;
+}
+
+static int rec_vertex(float x, float y, float z, float u, float v)
+{
+    union psr_cmd_arg *a = cmd_alloc(PSR_CMD_VERTEX, 5);
+    a[0].f = x;
+    a[1].f = y;
+    a[2].f = z;
+    a[3].f = u;
+    a[4].f = v;
+    return 0;
+}
+
+static int rec_end_shape(int end_mode)
+{
+    cmd_alloc(PSR_CMD_END_SHAPE, 1)->i = end_mode;
+    return 0;
+}
+
+static int rec_arc(float x, float y, float width, float height,
+		   float start, float stop)
+{
+    union psr_cmd_arg *a = cmd_alloc(PSR_CMD_ARC, 6);
+    a[0].f = x;
+    a[1].f = y;
+    a[2].f = width;
+    a[3].f = height;
+    a[4].f = start;
+    a[5].f = stop;
+    return 0;
+}
+
+static int rec_bezier_detail(int level)
+{
+    cmd_alloc(PSR_CMD_BEZIER_DETAIL, 1)->i = level;
+    return 0;
+}
+
+static int rec_bezier_vertex(float cx1, float cy1, float cz1,
+			     float cx2, float cy2, float cz2,
+			     float x, float y, float z)
+{
+    union psr_cmd_arg *a = cmd_alloc(PSR_CMD_BEZIER_VERTEX, 9);
+    a[0].f = cx1;
+    a[1].f = cy1;
+    a[2].f = cz1;
+    a[3].f = cx2;
+    a[4].f = cy2;
+    a[5].f = cz2;
+    a[6].f = x;
+    a[7].f = y;
+    a[8].f = z;
+    return 0;
+}
+
+static int rec_box(float width, float height, float depth)
+{
+    union psr_cmd_arg *a = cmd_alloc(PSR_CMD_BOX, 3);
+    a[0].f = width;
+    a[1].f = height;
+    a[2].f = depth;
+    return 0;
+}
+
+static int rec_sphere(float radius)
+{
+    cmd_alloc(PSR_CMD_SPHERE, 1)->f = radius;
+    return 0;
+}
+
+static int rec_sphere_detail(int n)
+{
+    cmd_alloc(PSR_CMD_SPHERE_DETAIL, 1)->i = n;
+    return 0;
+}
+
+static int rec_stroke_weight(float width)
+{
+    cmd_alloc(PSR_CMD_STROKE_WEIGHT, 1)->f = width;
+    return 0;
+}
+
+static int rec_smooth(void)
+{
+    cmd_alloc(PSR_CMD_SMOOTH, 0);
+    return 0;
+}
+
+static int rec_no_smooth(void)
+{
+    cmd_alloc(PSR_CMD_NO_SMOOTH, 0);
+    return 0;
+}
+
+static int rec_fill(float r, float g, float b, float a)
+{
+    union psr_cmd_arg *arg = cmd_alloc(PSR_CMD_FILL, 4);
+    arg[0].f = r;
+    arg[1].f = g;
+    arg[2].f = b;
+    arg[3].f = a;
+    return 0;
+}
+
+static int rec_no_fill(void)
+{
+    cmd_alloc(PSR_CMD_NO_FILL, 0);
+    return 0;
+}
+
+/** save() needs the pixels drawn so far, so it waits for the replay. */
+static int rec_save(struct psr_image *img)
+{
+    volatile int r = -1;
+    union psr_cmd_arg *a = cmd_alloc(PSR_CMD_SAVE, 4);
+    put_ptr(a, img);
+    put_ptr(a + 2, (const void *) &r);
+    cmdbuf_flush();
+    return r;
+}
+
+/** the pixels are copied, the caller may free img right away */
+static int rec_image(struct psr_image *img, float x, float y,
+		     float width, float height)
+{
+    const size_t bytes = img->width * img->height * 3;
+    union psr_cmd_arg *a;
+
+    a = cmd_alloc(PSR_CMD_IMAGE, 6 + (bytes + 3) / 4);
+    if (!a) {
+	return -1;
+    }
+    a[0].f = x;
+    a[1].f = y;
+    a[2].f = width;
+    a[3].f = height;
+    a[4].i = img->width;
+    a[5].i = img->height;
+    if (bytes % 4) {
+	a[6 + bytes / 4].u = 0;
+    }
+    memcpy(a + 6, img->data, bytes);
+    return 0;
+}
+
+static int rec_camera_default(void)
+{
+    cmd_alloc(PSR_CMD_CAMERA_DEFAULT, 0);
+    return 0;
+}
+
+static int rec_camera(float eye_x, float eye_y, float eye_z,
+		      float center_x, float center_y, float center_z,
+		      float up_x, float up_y, float up_z)
+{
+    union psr_cmd_arg *a = cmd_alloc(PSR_CMD_CAMERA, 9);
+    a[0].f = eye_x;
+    a[1].f = eye_y;
+    a[2].f = eye_z;
+    a[3].f = center_x;
+    a[4].f = center_y;
+    a[5].f = center_z;
+    a[6].f = up_x;
+    a[7].f = up_y;
+    a[8].f = up_z;
+    return 0;
+}
+
+static int rec_begin_camera(void)
+{
+    cmd_alloc(PSR_CMD_BEGIN_CAMERA, 0);
+    return 0;
+}
+
+static int rec_end_camera(void)
+{
+    cmd_alloc(PSR_CMD_END_CAMERA, 0);
+    return 0;
+}
+
+static int rec_ortho(float left, float right, float bottom, float top,
+		     float near, float far)
+{
+    union psr_cmd_arg *a = cmd_alloc(PSR_CMD_ORTHO, 6);
+    a[0].f = left;
+    a[1].f = right;
+    a[2].f = bottom;
+    a[3].f = top;
+    a[4].f = near;
+    a[5].f = far;
+    return 0;
+}
+
+static int rec_create_shape(int handle)
+{
+    cmd_alloc(PSR_CMD_CREATE_SHAPE, 1)->i = handle;
+    return 0;
+}
+
+static int rec_end_shape_record(void)
+{
+    cmd_alloc(PSR_CMD_END_SHAPE_RECORD, 0);
+    return 0;
+}
+
+static int rec_shape(int handle)
+{
+    cmd_alloc(PSR_CMD_SHAPE, 1)->i = handle;
+    return 0;
+}
+
+static int rec_free_shape(int handle)
+{
+    cmd_alloc(PSR_CMD_FREE_SHAPE, 1)->i = handle;
+    return 0;
+}
+
+/** the font is loaded on the renderer's side, a missing file is only
+ * reported there. */
+static int rec_text_font(const char *path)
+{
+    union psr_cmd_arg *a = cmd_alloc(PSR_CMD_TEXT_FONT, str_words(path));
+
+    if (!a) {
+	return -1;
+    }
+    put_str(a, path);
+    return 0;
+}
+
+static int rec_text_size(float size)
+{
+    cmd_alloc(PSR_CMD_TEXT_SIZE, 1)->f = size;
+    return 0;
+}
+
+static int rec_text(const char *str, float x, float y)
+{
+    union psr_cmd_arg *a = cmd_alloc(PSR_CMD_TEXT, 2 + str_words(str));
+
+    if (!a) {
+	return -1;
+    }
+    a[0].f = x;
+    a[1].f = y;
+    put_str(a + 2, str);
+    return 0;
+}
+
+static int rec_stroke_join(int join)
+{
+    cmd_alloc(PSR_CMD_STROKE_JOIN, 1)->i = join;
+    return 0;
+}
+
+static int rec_stroke_cap(int cap)
+{
+    cmd_alloc(PSR_CMD_STROKE_CAP, 1)->i = cap;
+    return 0;
+}
+
+static int rec_curve_detail(int level)
+{
+    cmd_alloc(PSR_CMD_CURVE_DETAIL, 1)->i = level;
+    return 0;
+}
+
+static int rec_curve_tightness(float tightness)
+{
+    cmd_alloc(PSR_CMD_CURVE_TIGHTNESS, 1)->f = tightness;
+    return 0;
+}
+
+static int rec_curve_vertex(float x, float y, float z)
+{
+    union psr_cmd_arg *a = cmd_alloc(PSR_CMD_CURVE_VERTEX, 3);
+    a[0].f = x;
+    a[1].f = y;
+    a[2].f = z;
+    return 0;
+}
+
+static int rec_hint(int which)
+{
+    cmd_alloc(PSR_CMD_HINT, 1)->i = which;
+    return 0;
+}
+
+static int rec_pick_id(int id)
+{
+    cmd_alloc(PSR_CMD_PICK_ID, 1)->i = id;
+    return 0;
+}
+
+static int rec_auto_detail(float max_error)
+{
+    cmd_alloc(PSR_CMD_AUTO_DETAIL, 1)->f = max_error;
+    return 0;
+}
+
+static int rec_dirty_rect(float x, float y, float width, float height)
+{
+    union psr_cmd_arg *a = cmd_alloc(PSR_CMD_DIRTY_RECT, 4);
+
+    a[0].f = x;
+    a[1].f = y;
+    a[2].f = width;
+    a[3].f = height;
+    return 0;
+}
+
+static int rec_create_graphics(int handle, int width, int height)
+{
+    union psr_cmd_arg *a = cmd_alloc(PSR_CMD_CREATE_GRAPHICS, 3);
+
+    a[0].i = handle;
+    a[1].i = width;
+    a[2].i = height;
+    return 0;
+}
+
+static int rec_free_graphics(int handle)
+{
+    cmd_alloc(PSR_CMD_FREE_GRAPHICS, 1)->i = handle;
+    return 0;
+}
+
+static int rec_begin_draw(int handle)
+{
+    cmd_alloc(PSR_CMD_BEGIN_DRAW, 1)->i = handle;
+    return 0;
+}
+
+static int rec_end_draw(void)
+{
+    cmd_alloc(PSR_CMD_END_DRAW, 0);
+    return 0;
+}
+
+/** the target stays on the renderer's side */
+static int rec_image_graphics(int handle, float x, float y, float width,
+			      float height)
+{
+    union psr_cmd_arg *a = cmd_alloc(PSR_CMD_IMAGE_GRAPHICS, 5);
+
+    a[0].i = handle;
+    a[1].f = x;
+    a[2].f = y;
+    a[3].f = width;
+    a[4].f = height;
+    return 0;
+}
+
+static int rec_composite(int handle, int mode, float opacity)
+{
+    union psr_cmd_arg *a = cmd_alloc(PSR_CMD_COMPOSITE, 3);
+
+    a[0].i = handle;
+    a[1].i = mode;
+    a[2].f = opacity;
+    return 0;
+}
+
+struct psr_renderer_context psr_cmdbuf_recorder = {
+    .size = rec_size,
+    .no_loop = rec_no_loop,
+    .loop = rec_loop,
+    .redraw = rec_redraw,
+    .frame_rate = rec_frame_rate,
+    .cursor = rec_cursor,
+    .stroke = rec_stroke,
+    .no_stroke = rec_no_stroke,
+    .background = rec_background,
+    .push_matrix = rec_push_matrix,
+    .pop_matrix = rec_pop_matrix,
+    .apply_matrix = rec_apply_matrix,
+    .reset_matrix = rec_reset_matrix,
+    .print_matrix = rec_print_matrix,
+    .translate = rec_translate,
+    .rotate = rec_rotate,
+    .scale = rec_scale,
+    .begin_shape = rec_begin_shape,
+    .vertex = rec_vertex,
+    .end_shape = rec_end_shape,
+    .arc = rec_arc,
+    .bezier_detail = rec_bezier_detail,
+    .bezier_vertex = rec_bezier_vertex,
+    .box = rec_box,
+    .sphere = rec_sphere,
+    .sphere_detail = rec_sphere_detail,
+    .stroke_weight = rec_stroke_weight,
+    .smooth = rec_smooth,
+    .no_smooth = rec_no_smooth,
+    .fill = rec_fill,
+    .no_fill = rec_no_fill,
+    .save = rec_save,
+    .image = rec_image,
+    .camera_default = rec_camera_default,
+    .camera = rec_camera,
+    .begin_camera = rec_begin_camera,
+    .end_camera = rec_end_camera,
+    .ortho = rec_ortho,
+    .create_shape = rec_create_shape,
+    .end_shape_record = rec_end_shape_record,
+    .shape = rec_shape,
+    .free_shape = rec_free_shape,
+    .text_font = rec_text_font,
+    .text_size = rec_text_size,
+    .text = rec_text,
+    .stroke_join = rec_stroke_join,
+    .stroke_cap = rec_stroke_cap,
+    .curve_detail = rec_curve_detail,
+    .curve_tightness = rec_curve_tightness,
+    .curve_vertex = rec_curve_vertex,
+    .hint = rec_hint,
+    .pick_id = rec_pick_id,
+    .auto_detail = rec_auto_detail,
+    .dirty_rect = rec_dirty_rect,
+    .create_graphics = rec_create_graphics,
+    .free_graphics = rec_free_graphics,
+    .begin_draw = rec_begin_draw,
+    .end_draw = rec_end_draw,
+    .image_graphics = rec_image_graphics,
+    .composite = rec_composite,
+};
+
+
+/********************************************************************
+ * Replay
+ ********************************************************************/
+
+/** replay a single command, returns the renderer's return value. */
+int psr_cmd_replay(const union psr_cmd_arg *cmd,
+		   struct psr_renderer_context *rc)
+{
+    const union psr_cmd_arg *a = cmd + 1;
+    struct psr_image img;
+    int r;
+
+    switch (PSR_CMD_OP(cmd->u)) {
+    case PSR_CMD_SIZE:
+	return rc->size(a[0].i, a[1].i);
+    case PSR_CMD_NO_LOOP:
+	return rc->no_loop();
+    case PSR_CMD_LOOP:
+	return rc->loop();
+    case PSR_CMD_REDRAW:
+	return rc->redraw();
+    case PSR_CMD_FRAME_RATE:
+	return rc->frame_rate(a[0].f);
+    case PSR_CMD_CURSOR:
+	return rc->cursor(a[0].i);
+    case PSR_CMD_STROKE:
+	return rc->stroke(a[0].f, a[1].f, a[2].f, a[3].f);
+    case PSR_CMD_NO_STROKE:
+	return rc->no_stroke();
+    case PSR_CMD_BACKGROUND:
+	return rc->background(a[0].f, a[1].f, a[2].f, a[3].f);
+    case PSR_CMD_PUSH_MATRIX:
+	return rc->push_matrix();
+    case PSR_CMD_POP_MATRIX:
+	return rc->pop_matrix();
+    case PSR_CMD_APPLY_MATRIX:
+	return rc->apply_matrix(a[0].f, a[1].f, a[2].f, a[3].f,
+				a[4].f, a[5].f, a[6].f, a[7].f,
+				a[8].f, a[9].f, a[10].f, a[11].f,
+				a[12].f, a[13].f, a[14].f, a[15].f);
+    case PSR_CMD_RESET_MATRIX:
+	return rc->reset_matrix();
+    case PSR_CMD_PRINT_MATRIX:
+	return rc->print_matrix();
+    case PSR_CMD_TRANSLATE:
+	return rc->translate(a[0].f, a[1].f, a[2].f);
+    case PSR_CMD_ROTATE:
+	return rc->rotate(a[0].f, a[1].f, a[2].f, a[3].f);
+    case PSR_CMD_SCALE:
+	return rc->scale(a[0].f, a[1].f, a[2].f);
+    case PSR_CMD_BEGIN_SHAPE:
+	return rc->begin_shape(a[0].i);
+    case PSR_CMD_VERTEX:
+	return rc->vertex(a[0].f, a[1].f, a[2].f, a[3].f, a[4].f);
+    case PSR_CMD_END_SHAPE:
+	return rc->end_shape(a[0].i);
+    case PSR_CMD_ARC:
+	return rc->arc(a[0].f, a[1].f, a[2].f, a[3].f, a[4].f, a[5].f);
+    case PSR_CMD_BEZIER_DETAIL:
+	return rc->bezier_detail(a[0].i);
+    case PSR_CMD_BEZIER_VERTEX:
+	return rc->bezier_vertex(a[0].f, a[1].f, a[2].f,
+				 a[3].f, a[4].f, a[5].f,
+				 a[6].f, a[7].f, a[8].f);
+    case PSR_CMD_BOX:
+	return rc->box(a[0].f, a[1].f, a[2].f);
+    case PSR_CMD_SPHERE:
+	return rc->sphere(a[0].f);
+    case PSR_CMD_SPHERE_DETAIL:
+	return rc->sphere_detail(a[0].i);
+    case PSR_CMD_STROKE_WEIGHT:
+	return rc->stroke_weight(a[0].f);
+    case PSR_CMD_SMOOTH:
+	return rc->smooth();
+    case PSR_CMD_NO_SMOOTH:
+	return rc->no_smooth();
+    case PSR_CMD_FILL:
+	return rc->fill(a[0].f, a[1].f, a[2].f, a[3].f);
+    case PSR_CMD_NO_FILL:
+	return rc->no_fill();
+    case PSR_CMD_SAVE:
+	if (PSR_CMD_WORDS(cmd->u) == 0) {
+	    /* from a trace, the image is not ours to keep */
+	    r = rc->save(&img);
+	    if (!r) {
+		free(img.data);
+	    }
+	    return r;
+	}
+	r = rc->save(get_ptr(a));
+	*(volatile int *) get_ptr(a + 2) = r;
+	return r;
+    case PSR_CMD_IMAGE:
+	img.width = a[4].i;
+	img.height = a[5].i;
+	img.data = (void *) (a + 6);
+	return rc->image(&img, a[0].f, a[1].f, a[2].f, a[3].f);
+    case PSR_CMD_CAMERA_DEFAULT:
+	return rc->camera_default();
+    case PSR_CMD_CAMERA:
+	return rc->camera(a[0].f, a[1].f, a[2].f,
+			  a[3].f, a[4].f, a[5].f,
+			  a[6].f, a[7].f, a[8].f);
+    case PSR_CMD_BEGIN_CAMERA:
+	return rc->begin_camera();
+    case PSR_CMD_END_CAMERA:
+	return rc->end_camera();
+    case PSR_CMD_ORTHO:
+	return rc->ortho(a[0].f, a[1].f, a[2].f, a[3].f, a[4].f, a[5].f);
+    case PSR_CMD_CREATE_SHAPE:
+	return rc->create_shape(a[0].i);
+    case PSR_CMD_END_SHAPE_RECORD:
+	return rc->end_shape_record();
+    case PSR_CMD_SHAPE:
+	return rc->shape(a[0].i);
+    case PSR_CMD_FREE_SHAPE:
+	return rc->free_shape(a[0].i);
+    case PSR_CMD_FRAME:
+	return 0;
+    case PSR_CMD_TEXT_FONT:
+	return rc->text_font(get_str(a));
+    case PSR_CMD_TEXT_SIZE:
+	return rc->text_size(a[0].f);
+    case PSR_CMD_TEXT:
+	return rc->text(get_str(a + 2), a[0].f, a[1].f);
+    case PSR_CMD_STROKE_JOIN:
+	return rc->stroke_join(a[0].i);
+    case PSR_CMD_STROKE_CAP:
+	return rc->stroke_cap(a[0].i);
+    case PSR_CMD_CURVE_DETAIL:
+	return rc->curve_detail(a[0].i);
+    case PSR_CMD_CURVE_TIGHTNESS:
+	return rc->curve_tightness(a[0].f);
+    case PSR_CMD_CURVE_VERTEX:
+	return rc->curve_vertex(a[0].f, a[1].f, a[2].f);
+    case PSR_CMD_HINT:
+	return rc->hint(a[0].i);
+    case PSR_CMD_PICK_ID:
+	return rc->pick_id(a[0].i);
+    case PSR_CMD_AUTO_DETAIL:
+	return rc->auto_detail(a[0].f);
+    case PSR_CMD_DIRTY_RECT:
+	return rc->dirty_rect(a[0].f, a[1].f, a[2].f, a[3].f);
+    case PSR_CMD_CREATE_GRAPHICS:
+	return rc->create_graphics(a[0].i, a[1].i, a[2].i);
+    case PSR_CMD_FREE_GRAPHICS:
+	return rc->free_graphics(a[0].i);
+    case PSR_CMD_BEGIN_DRAW:
+	return rc->begin_draw(a[0].i);
+    case PSR_CMD_END_DRAW:
+	return rc->end_draw();
+    case PSR_CMD_IMAGE_GRAPHICS:
+	return rc->image_graphics(a[0].i, a[1].f, a[2].f, a[3].f, a[4].f);
+    case PSR_CMD_COMPOSITE:
+	return rc->composite(a[0].i, a[1].i, a[2].f);
+    default:
+	psr_error("invalid command %d", PSR_CMD_OP(cmd->u));
+	return -1;
+    }
+}
+
+/** replay all commands of buf into renderer.  returns -1 if any of
+ * them failed. */
+int psr_cmdbuf_replay(const struct psr_cmdbuf *buf,
+		      struct psr_renderer_context *renderer)
+{
+    const union psr_cmd_arg *cmd = buf->data;
+    const union psr_cmd_arg *end = buf->data + buf->len;
+    int r = 0;
+
+    while (cmd < end) {
+	if (psr_cmd_replay(cmd, renderer)) {
+	    r = -1;
+	}
+	cmd += 1 + PSR_CMD_WORDS(cmd->u);
+    }
+    return r;
+}
+
+/** whether op only puts pixels on the screen, and leaves no state */
+static inline int cmd_draws(int op)
+{
+    switch (op) {
+    case PSR_CMD_BACKGROUND:
+    case PSR_CMD_PRINT_MATRIX:
+    case PSR_CMD_BEGIN_SHAPE:
+    case PSR_CMD_VERTEX:
+    case PSR_CMD_END_SHAPE:
+    case PSR_CMD_ARC:
+    case PSR_CMD_BEZIER_VERTEX:
+    case PSR_CMD_CURVE_VERTEX:
+    case PSR_CMD_BOX:
+    case PSR_CMD_SPHERE:
+    case PSR_CMD_SAVE:
+    case PSR_CMD_IMAGE:
+    case PSR_CMD_SHAPE:
+    case PSR_CMD_TEXT:
+    case PSR_CMD_DIRTY_RECT:
+    case PSR_CMD_IMAGE_GRAPHICS:
+    case PSR_CMD_COMPOSITE:
+	return 1;
+    default:
+	return 0;
+    }
+}
+
+/** replay the commands of buf that change state and drop those that only
+ * draw, to catch up with a frame that isn't shown.  shapes recorded with
+ * create_shape() and what goes into a graphics target are replayed
+ * whole; *recording counts how deep inside those it is, from one buffer
+ * to the next. */
+int psr_cmdbuf_replay_state(const struct psr_cmdbuf *buf,
+			    struct psr_renderer_context *renderer,
+			    int *recording)
+{
+    const union psr_cmd_arg *cmd = buf->data;
+    const union psr_cmd_arg *end = buf->data + buf->len;
+    int op, r = 0;
+
+    for (; cmd < end; cmd += 1 + PSR_CMD_WORDS(cmd->u)) {
+	op = PSR_CMD_OP(cmd->u);
+	if (op == PSR_CMD_CREATE_SHAPE || op == PSR_CMD_BEGIN_DRAW) {
+	    ++*recording;
+	} else if (op == PSR_CMD_END_SHAPE_RECORD || op == PSR_CMD_END_DRAW) {
+	    *recording -= *recording > 0;
+	} else if (!*recording && cmd_draws(op)) {
+	    continue;
+	}
+	if (psr_cmd_replay(cmd, renderer)) {
+	    r = -1;
+	}
+    }
+    return r;
+}
+
+
+/********************************************************************
+ * Threaded draw
+ *
+ * draw() runs on a thread of its own and records each frame into one
+ * of two chunks while the renderer's thread replays the other one, so
+ * frame N + 1 is built while frame N is drawn.  save() cuts a frame
+ * into several chunks, it has to wait for the replay.
+ ********************************************************************/
+
+struct psr_threaded {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    struct psr_cmdbuf chunks[2];
+    int chunk_ready[2];
+    int fill_idx, consume_idx;
+    unsigned long frames_requested, frames_started;
+    int frame_pending;
+    int thread_started;
+    int quit;
+    pthread_t draw_thread;
+    void (*usr_draw) (void);
+};
+
+/** hand the chunk being recorded to the renderer's thread and continue
+ * in the other one.  called on the draw thread. */
+static void cmdbuf_submit(struct psr_threaded *t, int flags)
+{
+    pthread_mutex_lock(&t->lock);
+    t->chunks[t->fill_idx].flags = flags;
+    t->chunk_ready[t->fill_idx] = 1;
+    t->fill_idx ^= 1;
+    pthread_cond_broadcast(&t->cond);
+    while (t->chunk_ready[t->fill_idx] && !t->quit) {
+	pthread_cond_wait(&t->cond, &t->lock);
+    }
+    pthread_mutex_unlock(&t->lock);
+    t->chunks[t->fill_idx].len = 0;
+    psr_cmdbuf_target = &t->chunks[t->fill_idx];
+}
+
+/** submit and wait until everything recorded so far is replayed. */
+static void cmdbuf_flush(void)
+{
+    struct psr_threaded *t = psr_current->threaded;
+
+    if (!t || psr_cmdbuf_target != &t->chunks[t->fill_idx]) {
+	psr_error("save() can't be recorded outside of the draw thread.");
+	return;
+    }
+    cmdbuf_submit(t, 0);
+    pthread_mutex_lock(&t->lock);
+    while (t->chunk_ready[t->fill_idx ^ 1] && !t->quit) {
+	pthread_cond_wait(&t->cond, &t->lock);
+    }
+    pthread_mutex_unlock(&t->lock);
+}
+
+static void *draw_thread_main(void *arg)
+{
+    struct psr_ctx *ctx = arg;
+    struct psr_threaded *t = ctx->threaded;
+
+    psr_current = ctx;
+    psr_renderer = &psr_cmdbuf_recorder;
+    psr_cmdbuf_target = &t->chunks[t->fill_idx];
+    for (;;) {
+	pthread_mutex_lock(&t->lock);
+	while (t->frames_started == t->frames_requested && !t->quit) {
+	    pthread_cond_wait(&t->cond, &t->lock);
+	}
+	if (t->quit) {
+	    pthread_mutex_unlock(&t->lock);
+	    break;
+	}
+	++t->frames_started;
+	pthread_mutex_unlock(&t->lock);
+
+	t->usr_draw();
+	cmdbuf_submit(t, PSR_CMDBUF_END_OF_FRAME);
+    }
+    return NULL;
+}
+
+/* called with lock held */
+static void request_frame(struct psr_threaded *t)
+{
+    ++t->frames_requested;
+    t->frame_pending = 1;
+    pthread_cond_broadcast(&t->cond);
+}
+
+/** takes the place of usr_func.draw on the renderer's thread */
+static void threaded_draw(void)
+{
+    struct psr_ctx *ctx = psr_current;
+    struct psr_threaded *t = ctx->threaded;
+    struct psr_cmdbuf *buf;
+    int flags, r;
+
+    if (!t->thread_started) {
+	r = pthread_create(&t->draw_thread, NULL, draw_thread_main, ctx);
+	if (r) {
+	    psr_system_error(r, "can't create the draw thread.");
+	}
+	t->thread_started = 1;
+    }
+
+    pthread_mutex_lock(&t->lock);
+    if (!t->frame_pending) {
+	request_frame(t);
+    }
+    do {
+	while (!t->chunk_ready[t->consume_idx]) {
+	    pthread_cond_wait(&t->cond, &t->lock);
+	}
+	buf = &t->chunks[t->consume_idx];
+	flags = buf->flags;
+	if (flags & PSR_CMDBUF_END_OF_FRAME) {
+	    /* start on the next frame while this one is drawn */
+	    t->frame_pending = 0;
+	    if (ctx->looping) {
+		request_frame(t);
+	    }
+	}
+	pthread_mutex_unlock(&t->lock);
+
+	psr_cmdbuf_replay(buf, &ctx->renderer);
+
+	pthread_mutex_lock(&t->lock);
+	t->chunk_ready[t->consume_idx] = 0;
+	t->consume_idx ^= 1;
+	pthread_cond_broadcast(&t->cond);
+    } while (!(flags & PSR_CMDBUF_END_OF_FRAME));
+    pthread_mutex_unlock(&t->lock);
+}
+
+int psr_cmdbuf_threaded(struct psr_ctx *ctx)
+{
+    struct psr_context *cxt = &ctx->context;
+    struct psr_threaded *t;
+
+    t = calloc(1, sizeof(*t));
+    if (!t) {
+	psr_system_error(errno, "No memory for the draw thread.");
+	return -1;
+    }
+    pthread_mutex_init(&t->lock, NULL);
+    pthread_cond_init(&t->cond, NULL);
+    t->usr_draw = cxt->usr_func.draw;
+    ctx->threaded = t;
+    cxt->usr_func.draw = threaded_draw;
+    return 0;
+}
+
+/** a frame being recorded is dropped */
+void psr_cmdbuf_threaded_end(struct psr_ctx *ctx)
+{
+    struct psr_threaded *t = ctx->threaded;
+
+    if (!t) {
+	return;
+    }
+    if (t->thread_started) {
+	pthread_mutex_lock(&t->lock);
+	t->quit = 1;
+	pthread_cond_broadcast(&t->cond);
+	pthread_mutex_unlock(&t->lock);
+	pthread_join(t->draw_thread, NULL);
+    }
+    psr_cmdbuf_free(&t->chunks[0]);
+    psr_cmdbuf_free(&t->chunks[1]);
+    pthread_cond_destroy(&t->cond);
+    pthread_mutex_destroy(&t->lock);
+    free(t);
+    ctx->threaded = NULL;
+}
@@ -0,0 +1,211 @@
+/** Input events.  The window thread posts every event into a single
+ * producer, single consumer ring; the frame drains it before draw(), so
+ * key, mouse_x and friends only change between frames.  Runs of motion
+ * events are coalesced into one mouse_moved() or mouse_dragged() per
+ * frame, the complete run is still in input_events().  Each sketch has
+ * a queue of its own. */
+
+#include <time.h>
+#include <errno.h>
+
+#include "psr_internal.h"
+
+/* must be a power of two */
+#define INPUT_RING_SIZE (256)
+
+struct psr_input {
+    struct psr_event ring[INPUT_RING_SIZE];
+    unsigned int ring_head;	/* written by the producer only */
+    unsigned int ring_tail;	/* written by the consumer only */
+    unsigned long dropped;
+
+    /* the events of the last drain, for input_events() */
+    struct psr_event history[INPUT_RING_SIZE];
+    int history_count;
+
+    int draining;
+    void (*usr_draw) (void);
+
+    /* the sketch's key, mouse_x and friends, copied to the thread that
+     * drains */
+    char key;
+    int key_code;
+    int mouse_x, mouse_y, mouse_button;
+    int p_mouse_x, p_mouse_y;
+};
+
+/** the calling thread sees the state of its sketch */
+static void publish(const struct psr_input *in)
+{
+    key = in->key;
+    key_code = in->key_code;
+    mouse_x = in->mouse_x;
+    mouse_y = in->mouse_y;
+    mouse_button = in->mouse_button;
+    p_mouse_x = in->p_mouse_x;
+    p_mouse_y = in->p_mouse_y;
+    width = psr_current->width;
+    height = psr_current->height;
+}
+
+static void update_key(struct psr_input *in, int lkey, int lkeycode)
+{
+    in->key = lkey;
+    if (lkeycode != NONE) {
+	in->key_code = lkeycode;
+    }
+    publish(in);
+}
+
+static void update_mouse(struct psr_input *in, int x, int y, int button)
+{
+    in->p_mouse_x = in->mouse_x;
+    in->mouse_x = x;
+    in->p_mouse_y = in->mouse_y;
+    in->mouse_y = y;
+    if (button != NONE) {
+	in->mouse_button = button;
+    }
+    publish(in);
+}
+
+static inline int is_motion(int type)
+{
+    return type == PSR_EVENT_MOUSE_MOVED || type == PSR_EVENT_MOUSE_DRAGGED;
+}
+
+#define SAFE_CALL(func)				\
+    if (func) {					\
+	func();					\
+    }
+
+static void dispatch(struct psr_input *in, const struct psr_event *ev)
+{
+    struct psr_usr_func *usr_func = &psr_current->context.usr_func;
+
+    switch (ev->type) {
+    case PSR_EVENT_MOUSE_PRESSED:
+	update_mouse(in, ev->x, ev->y, ev->button);
+	SAFE_CALL(usr_func->mouse_pressed);
+	break;
+    case PSR_EVENT_MOUSE_RELEASED:
+	update_mouse(in, ev->x, ev->y, ev->button);
+	SAFE_CALL(usr_func->mouse_released);
+	break;
+    case PSR_EVENT_MOUSE_MOVED:
+	update_mouse(in, ev->x, ev->y, NONE);	/* don't update button */
+	SAFE_CALL(usr_func->mouse_moved);
+	break;
+    case PSR_EVENT_MOUSE_DRAGGED:
+	update_mouse(in, ev->x, ev->y, NONE);
+	SAFE_CALL(usr_func->mouse_dragged);
+	break;
+    case PSR_EVENT_KEY_PRESSED:
+	update_key(in, ev->key, ev->keycode);
+	SAFE_CALL(usr_func->key_pressed);
+	break;
+    default:
+	psr_warn("unknown input event %d", ev->type);
+    }
+}
+
+/** consume everything posted so far.  only one thread drains at a time,
+ * a second one leaves the events to the next frame. */
+void psr_input_drain(void)
+{
+    struct psr_input *in = psr_current->input;
+    unsigned int tail, head;
+    struct psr_event *ev;
+    int i;
+
+    if (__atomic_exchange_n(&in->draining, 1, __ATOMIC_ACQUIRE)) {
+	return;
+    }
+    publish(in);
+    tail = in->ring_tail;
+    head = __atomic_load_n(&in->ring_head, __ATOMIC_ACQUIRE);
+    for (in->history_count = 0; tail != head; ++tail) {
+	in->history[in->history_count++] =
+	    in->ring[tail & (INPUT_RING_SIZE - 1)];
+    }
+    __atomic_store_n(&in->ring_tail, tail, __ATOMIC_RELEASE);
+
+    for (i = 0; i < in->history_count; ++i) {
+	ev = &in->history[i];
+	/* only the last of a run of the same motion is dispatched */
+	if (is_motion(ev->type) && i + 1 < in->history_count
+	    && in->history[i + 1].type == ev->type) {
+	    continue;
+	}
+	dispatch(in, ev);
+    }
+    __atomic_store_n(&in->draining, 0, __ATOMIC_RELEASE);
+}
+
+/** called by the renderer on the window thread */
+static void post_event(const struct psr_event *ev)
+{
+    struct psr_input *in = psr_current->input;
+    unsigned int head = in->ring_head;
+    struct psr_event *slot;
+    struct timespec now;
+
+    if (head - __atomic_load_n(&in->ring_tail, __ATOMIC_ACQUIRE)
+	== INPUT_RING_SIZE) {
+	if (in->dropped++ == 0) {
+	    psr_warn("input queue full, dropping events.");
+	}
+	return;
+    }
+    slot = &in->ring[head & (INPUT_RING_SIZE - 1)];
+    *slot = *ev;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    slot->usec = now.tv_sec * 1000000LL + now.tv_nsec / 1000;
+    __atomic_store_n(&in->ring_head, head + 1, __ATOMIC_RELEASE);
+
+    /* no frame is coming to pick it up */
+    if (!psr_current->context.usr_func.draw || !psr_current->looping) {
+	psr_input_drain();
+    }
+}
+
+static void input_draw(void)
+{
+    psr_input_drain();
+    psr_current->input->usr_draw();
+}
+
+/** hook the queue into ctx.  draw() is wrapped before anything else, so
+ * the drain runs on whatever thread ends up calling draw(). */
+int psr_input_start(struct psr_ctx *ctx)
+{
+    struct psr_context *cxt = &ctx->context;
+
+    ctx->input = calloc(1, sizeof(*ctx->input));
+    if (!ctx->input) {
+	psr_system_error(errno, "No memory for the input queue.");
+	return -1;
+    }
+    cxt->post_event = post_event;
+    if (cxt->usr_func.draw) {
+	ctx->input->usr_draw = cxt->usr_func.draw;
+	cxt->usr_func.draw = input_draw;
+    }
+    return 0;
+}
+
+void psr_input_end(struct psr_ctx *ctx)
+{
+    free(ctx->input);
+    ctx->input = NULL;
+}
+
+/** the events handled at the start of this frame, oldest first,
+ * including every coalesced motion */
+int input_events(const struct psr_event **events)
+{
+    const struct psr_input *in = psr_current->input;
+
+    *events = in->history;
+    return in->history_count;
+}
@@ -0,0 +1,250 @@
+/** Layers.  A layer is a graphics target of the window's size with a
+ * draw function of its own, drawn again only when layer_dirty() was
+ * called for it.  Each frame the layers are composited with their blend
+ * mode and opacity, those of negative depth under what draw() puts on
+ * the window and the others over it, lower depths first.  A background
+ * or a HUD that rarely changes costs a textured quad a frame.
+ *
+ * With layers under draw() the window is cleared for it, and draw()
+ * leaves out background().  The layers are drawn around draw(), so a
+ * sketch of layers only has an empty one. */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "psr_internal.h"
+#include "processing.h"
+
+struct layer {
+    int id;
+    int depth;
+    void (*draw) (void);
+    int graphics;		/* 0 until the first frame */
+    int width, height;
+    int dirty;
+    int mode;
+    float opacity;
+};
+
+struct psr_layers {
+    /* by depth, then by creation */
+    struct layer *layers;
+    int count, size;
+    int next_id;
+    void (*usr_draw) (void);
+};
+
+static struct layer *find(int id)
+{
+    struct psr_layers *l = psr_current->layers;
+    int i;
+
+    if (!l) {
+	psr_error("no layers before the sketch runs.");
+	return NULL;
+    }
+    for (i = 0; i < l->count; ++i) {
+	if (l->layers[i].id == id) {
+	    return &l->layers[i];
+	}
+    }
+    psr_error("invalid layer %d.", id);
+    return NULL;
+}
+
+/** bring the target of y up to date, then put it on the window */
+static void layer_frame(struct layer *y)
+{
+    struct psr_ctx *ctx = psr_current;
+
+    if (y->width != ctx->width || y->height != ctx->height) {
+	if (y->graphics) {
+	    free_graphics(y->graphics);
+	}
+	y->graphics = create_graphics(ctx->width, ctx->height);
+	if (y->graphics < 0) {
+	    y->graphics = 0;
+	    return;
+	}
+	y->width = ctx->width;
+	y->height = ctx->height;
+	y->dirty = 1;
+    }
+    if (y->dirty) {
+	y->dirty = 0;
+	begin_draw(y->graphics);
+	psr_renderer->background(0, 0, 0, 0);
+	y->draw();
+	if (ctx->drawing == y->graphics) {
+	    end_draw();
+	}
+    }
+    psr_renderer->composite(y->graphics, y->mode, y->opacity);
+}
+
+static void layers_draw(void)
+{
+    struct psr_ctx *ctx = psr_current;
+    struct psr_layers *l = ctx->layers;
+    int i;
+
+    /* the frame starts over under the layers, the depth buffer too */
+    if (l->count && l->layers[0].depth < 0) {
+	psr_renderer->background(0, 0, 0, 0);
+    }
+    for (i = 0; i < l->count && l->layers[i].depth < 0; ++i) {
+	layer_frame(&l->layers[i]);
+    }
+    l->usr_draw();
+    if (ctx->drawing) {
+	psr_warn("end_draw() missing in draw().");
+	end_draw();
+    }
+    for (; i < l->count; ++i) {
+	layer_frame(&l->layers[i]);
+    }
+}
+
+/** wrap draw() of ctx, innermost */
+int psr_layer_start(struct psr_ctx *ctx)
+{
+    struct psr_context *cxt = &ctx->context;
+
+    ctx->layers = calloc(1, sizeof(*ctx->layers));
+    if (!ctx->layers) {
+	psr_system_error(errno, "No memory for layers.");
+	return -1;
+    }
+    if (cxt->usr_func.draw) {
+	ctx->layers->usr_draw = cxt->usr_func.draw;
+	cxt->usr_func.draw = layers_draw;
+    }
+    return 0;
+}
+
+/** the renderer frees the targets itself */
+void psr_layer_end(struct psr_ctx *ctx)
+{
+    if (!ctx->layers) {
+	return;
+    }
+    free(ctx->layers->layers);
+    free(ctx->layers);
+    ctx->layers = NULL;
+}
+
+/** a layer drawn by draw, over those of lower depth.  it is drawn at the
+ * first frame, then after each layer_dirty(). */
+int create_layer(int depth, void (*draw) (void))
+{
+    struct psr_layers *l = psr_current->layers;
+    struct layer *y;
+    int i, size;
+
+    psr_debug("create_layer(%d, %p)", depth, draw);
+    if (!l || !l->usr_draw) {
+	psr_error("layers need a draw().");
+	return -1;
+    }
+    if (!draw) {
+	psr_error("invalid draw function.");
+	return -1;
+    }
+    if (l->count == l->size) {
+	size = l->size ? l->size * 2 : 8;
+	y = realloc(l->layers, size * sizeof(*y));
+	if (!y) {
+	    psr_system_error(errno, "No memory for layers.");
+	}
+	l->layers = y;
+	l->size = size;
+    }
+    i = l->count;
+    while (i > 0 && l->layers[i - 1].depth > depth) {
+	--i;
+    }
+    memmove(&l->layers[i + 1], &l->layers[i],
+	    (l->count - i) * sizeof(*l->layers));
+    ++l->count;
+    y = &l->layers[i];
+    memset(y, 0, sizeof(*y));
+    y->id = ++l->next_id;
+    y->depth = depth;
+    y->draw = draw;
+    y->dirty = 1;
+    y->mode = BLEND;
+    y->opacity = 1;
+    return y->id;
+}
+
+int free_layer(int layer)
+{
+    struct psr_layers *l = psr_current->layers;
+    struct layer *y;
+
+    psr_debug("free_layer(%d)", layer);
+    y = find(layer);
+    if (!y) {
+	return -1;
+    }
+    if (y->graphics) {
+	free_graphics(y->graphics);
+    }
+    --l->count;
+    memmove(y, y + 1, (l->layers + l->count - y) * sizeof(*y));
+    return 0;
+}
+
+/** draw layer again before it is composited next */
+int layer_dirty(int layer)
+{
+    struct layer *y = find(layer);
+
+    if (!y) {
+	return -1;
+    }
+    y->dirty = 1;
+    return 0;
+}
+
+/** how layer goes onto what is under it: REPLACE, BLEND, ADD,
+ * SUBTRACT, LIGHTEST, DARKEST, MULTIPLY or SCREEN */
+int layer_blend(int layer, int mode)
+{
+    struct layer *y = find(layer);
+
+    psr_debug("layer_blend(%d, %d)", layer, mode);
+    if (!y) {
+	return -1;
+    }
+    switch (mode) {
+    case REPLACE:
+    case BLEND:
+    case ADD:
+    case SUBTRACT:
+    case LIGHTEST:
+    case DARKEST:
+    case MULTIPLY:
+    case SCREEN:
+	y->mode = mode;
+	return 0;
+    default:
+	psr_error("blend mode %d not supported.", mode);
+	return -1;
+    }
+}
+
+/** 0 to 1, multiplies the alpha of the layer.  LIGHTEST, DARKEST and
+ * SCREEN don't look at the alpha. */
+int layer_opacity(int layer, float opacity)
+{
+    struct layer *y = find(layer);
+
+    psr_debug("layer_opacity(%d, %f)", layer, opacity);
+    if (!y) {
+	return -1;
+    }
+    y->opacity = opacity < 0 ? 0 : (opacity > 1 ? 1 : opacity);
+    return 0;
+}
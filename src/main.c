@@ -1,115 +1,109 @@
 #include <limits.h>
 #include <dlfcn.h>
 #include <errno.h>
+#include <string.h>
 #include <time.h>
 
+#include "processing.h"
 #include "psr_internal.h"
+#include "psr_cmdbuf.h"
 
 /* Force a compilation error if condition is true */
 #define BUILD_BUG_ON(condition) ((void)sizeof(char[1 - 2*!!(condition)]))
 
-struct psr_context psr_context;
-struct psr_renderer_context renderer_context;
+__thread struct psr_ctx *psr_current;
+__thread struct psr_renderer_context *psr_renderer;
 
 //volatile int debug_level = 1 << 3 | 1 << 2;
 volatile int debug_level = 15;
 
-volatile char key;
-volatile int keycode;
-volatile int mouse_x;
-volatile int mouse_y;
-volatile int mouse_button;
-volatile int p_mouse_x;
-volatile int p_mouse_y;
-volatile int width;
-volatile int height;
-
-static int g_rect_mode;
-static int g_ellipse_mode;
-
-static int (*main_loop_start) (void);
-
-static int load_renderer(const char *libpath)
+__thread volatile char key;
+__thread volatile int key_code;
+__thread volatile int mouse_x;
+__thread volatile int mouse_y;
+__thread volatile int mouse_button;
+__thread volatile int p_mouse_x;
+__thread volatile int p_mouse_y;
+__thread volatile int width;
+__thread volatile int height;
+
+/** the backend is only initialized by psr_ctx_run(), on the thread
+ * that draws, as its state is per thread */
+static int load_renderer(struct psr_ctx *ctx, const char *libpath)
 {
-    int (*renderer_init) (struct psr_context *psr_cxt,
-			  struct psr_renderer_context *renderer_cxt);
-    void *handle;
     char *errstr;
 
-    handle = dlopen(libpath, RTLD_LAZY);
-    if (!handle) {
+    ctx->handle = dlopen(libpath, RTLD_LAZY);
+    if (!ctx->handle) {
 	goto error_exit;
     }
-    renderer_init = dlsym(handle, "init");
-    if (!renderer_init) {
+    ctx->renderer_init = dlsym(ctx->handle, "init");
+    if (!ctx->renderer_init) {
 	goto error_exit;
     }
-    main_loop_start = dlsym(handle, "main_loop_start");
-    if (!main_loop_start) {
+    ctx->main_loop_start = dlsym(ctx->handle, "main_loop_start");
+    if (!ctx->main_loop_start) {
 	goto error_exit;
     }
-    return renderer_init(&psr_context, &renderer_context);
+    return 0;
 
 error_exit:
     errstr = dlerror();
     if (errstr) {
 	psr_error("%s", errstr);
     }
-    if (handle) {
-	dlclose(handle);
+    if (ctx->handle) {
+	dlclose(ctx->handle);
+	ctx->handle = NULL;
     }
     return -1;
 }
 
-static void update_key(int lkey, int lkeycode)
-{
-    key = lkey;
-    if (lkeycode != NONE) {
-	keycode = lkeycode;
-    }
-}
-
-static void update_mouse(int x, int y, int button)
-{
-    p_mouse_x = mouse_x;
-    mouse_x = x;
-    p_mouse_y = mouse_y;
-    mouse_y = y;
-    if (button != NONE) {
-	mouse_button = button;
-    }
-}
-
 static void update_size(int lwidth, int lheight)
 {
-    width = lwidth;
-    height = lheight;
+    width = psr_current->width = lwidth;
+    height = psr_current->height = lheight;
 }
 
 int size(int lwidth, int lheight)
 {
     psr_debug("size(%d, %d)", lwidth, lheight);
-    width = lwidth;
-    height = lheight;
-    return renderer_context.size(width, height);
+    width = psr_current->width = lwidth;
+    height = psr_current->height = lheight;
+    return psr_renderer->size(width, height);
 }
 
 int no_loop(void)
 {
     psr_debug("no_loop()");
-    return renderer_context.no_loop();
+    psr_current->looping = 0;
+    return psr_renderer->no_loop();
 }
 
 int loop(void)
 {
     psr_debug("loop()");
-    return renderer_context.loop();
+    psr_current->looping = 1;
+    return psr_renderer->loop();
 }
 
 int redraw(void)
 {
     psr_debug("redraw()");
-    return renderer_context.redraw();
+    return psr_renderer->redraw();
+}
+
+/** mark a rectangle in window coordinates as changed.  the next redraw()
+ * draws only inside the union of the rectangles marked since the last
+ * one, and skips whatever is outside. */
+int dirty_rect(float x, float y, float width, float height)
+{
+    psr_debug("dirty_rect(%f, %f, %f, %f)", x, y, width, height);
+    if (width < 0 || height < 0) {
+	psr_error("invalid rectangle.");
+	return -1;
+    }
+    return psr_renderer->dirty_rect(x, y, width, height);
 }
 
 int delay(int milliseconds)
@@ -129,24 +123,55 @@ int delay(int milliseconds)
 int frame_rate(float framerate)
 {
     psr_debug("frame_rate(%f)", framerate);
-    return renderer_context.frame_rate(framerate);
+    psr_current->frame_rate = framerate;
+    return psr_renderer->frame_rate(framerate);
+}
+
+/** the number of the frame being drawn, from 1 on, 0 in setup() */
+unsigned long frame_count(void)
+{
+    return psr_current->frames;
+}
+
+static long long now_usec(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000000LL + now.tv_nsec / 1000;
+}
+
+/** milliseconds since the sketch started.  the headless renderer draws
+ * as fast as it can, its clock advances 1 / frame_rate() a frame, so a
+ * render doesn't depend on the machine. */
+long millis(void)
+{
+    const struct psr_ctx *ctx = psr_current;
+
+    if (ctx->context.virtual_clock) {
+	if (!ctx->frames || ctx->frame_rate <= 0) {
+	    return 0;
+	}
+	return (long) ((ctx->frames - 1) * 1000.0 / ctx->frame_rate);
+    }
+    return (now_usec() - ctx->start_usec) / 1000;
 }
 
 int cursor(int type)
 {
     psr_debug("cursor(%d)", type);
-    return renderer_context.cursor(type);
+    return psr_renderer->cursor(type);
 }
 
 int no_cursor(void)
 {
     psr_debug("no_cursor()");
-    return renderer_context.cursor(NONE);
+    return psr_renderer->cursor(NONE);
 }
 
 const char *binary(int i)
 {
-    static char buf[1024];  /* supports up to 1024 bits */
+    static __thread char buf[1024];  /* supports up to 1024 bits */
     char *p = buf;
     int len = sizeof(i) * 8;  /* length in bits */
     BUILD_BUG_ON(len >= 1024);
@@ -171,7 +196,7 @@ int unbinary(const char *s)
 
 const char *hex(int i)
 {
-    static char buf[256];  /* supports up to 1024 bits */
+    static __thread char buf[256];  /* supports up to 1024 bits */
     BUILD_BUG_ON(sizeof(i) > (1024 / 8));
     snprintf(buf, 256, "%X", i);
     return buf;
@@ -189,34 +214,115 @@ int unhex(const char *s)
     return (int) i;
 }
 
+/** x / 255 rounded, for x up to 255 * 255 */
+static inline int div255(int x)
+{
+    return ((x + 128) * 257) >> 16;
+}
+
+/** x / (255 * 256) rounded, the constant division is a multiply */
+static inline int div65280(int x)
+{
+    return (x + 32640) / 65280;
+}
+
+static inline int unit_byte(float c)
+{
+    return c <= 0 ? 0 : (c >= 1 ? 255 : (int) (c * 255 + 0.5f));
+}
+
+/** h, s and v in 0..1 to rgb in place.  the renderers keep colors as
+ * RGBA8 anyway, so this works in 8 bits with the hue in 8.8 fixed
+ * point. */
+static void hsb_to_rgb(float *h, float *s, float *v)
+{
+    int hue = (int) (*h * (6 << 8) + 0.5f) % (6 << 8);
+    const int sat = unit_byte(*s), val = unit_byte(*v);
+    int f, p, q, t, rgb[3];
+
+    if (hue < 0) {
+	hue += 6 << 8;
+    }
+    f = hue & 0xff;
+    p = div255(val * (255 - sat));
+    q = div65280(val * (65280 - sat * f));
+    t = div65280(val * (65280 - sat * (256 - f)));
+    switch (hue >> 8) {
+    case 0:
+	rgb[0] = val, rgb[1] = t, rgb[2] = p;
+	break;
+    case 1:
+	rgb[0] = q, rgb[1] = val, rgb[2] = p;
+	break;
+    case 2:
+	rgb[0] = p, rgb[1] = val, rgb[2] = t;
+	break;
+    case 3:
+	rgb[0] = p, rgb[1] = q, rgb[2] = val;
+	break;
+    case 4:
+	rgb[0] = t, rgb[1] = p, rgb[2] = val;
+	break;
+    default:
+	rgb[0] = val, rgb[1] = p, rgb[2] = q;
+	break;
+    }
+    *h = rgb[0] / 255.0f;
+    *s = rgb[1] / 255.0f;
+    *v = rgb[2] / 255.0f;
+}
+
+/** how fill(), stroke() and background() read their arguments, RGB or
+ * HSB.  the renderer always gets RGB. */
+int color_mode(int mode)
+{
+    psr_debug("color_mode(%d)", mode);
+    switch (mode) {
+    case RGB:
+    case HSB:
+	break;
+    default:
+	psr_error("invalid color mode");
+	return -1;
+    }
+    psr_current->color_mode = mode;
+    return 0;
+}
+
 int stroke(float r, float g, float b, float a)
 {
     psr_debug("stroke(%f, %f, %f, %f)", r, g, b, a);
-    return renderer_context.stroke(r, g, b, a);
+    if (psr_current->color_mode == HSB) {
+	hsb_to_rgb(&r, &g, &b);
+    }
+    return psr_renderer->stroke(r, g, b, a);
 }
 
 int no_stroke(void)
 {
     psr_debug("no_stroke()");
-    return renderer_context.no_stroke();
+    return psr_renderer->no_stroke();
 }
 
 int background(float r, float g, float b, float a)
 {
     psr_debug("background(%f, %f, %f, %f)", r, g, b, a);
-    return renderer_context.background(r, g, b, a);
+    if (psr_current->color_mode == HSB) {
+	hsb_to_rgb(&r, &g, &b);
+    }
+    return psr_renderer->background(r, g, b, a);
 }
 
 int push_matrix(void)
 {
     psr_debug("push_matrix()");
-    return renderer_context.push_matrix();
+    return psr_renderer->push_matrix();
 }
 
 int pop_matrix(void)
 {
     psr_debug("pop_matrix()");
-    return renderer_context.pop_matrix();
+    return psr_renderer->pop_matrix();
 }
 
 int apply_matrix(float n11, float n12, float n13, float n14,
@@ -228,7 +334,7 @@ int apply_matrix(float n11, float n12, float n13, float n14,
 	      ", %f, %f, %f, %f, %f, %f, %f, %f",
 	      n11, n12, n13, n14, n21, n22, n23, n24,
 	      n31, n32, n33, n34, n41, n42, n43, n44);
-    return renderer_context.apply_matrix(
+    return psr_renderer->apply_matrix(
 	n11, n12, n13, n14, n21, n22, n23, n24,
 	n31, n32, n33, n34, n41, n42, n43, n44);
 }
@@ -236,25 +342,25 @@ int apply_matrix(float n11, float n12, float n13, float n14,
 int reset_matrix(void)
 {
     psr_debug("reset_matrix()");
-    return renderer_context.reset_matrix();
+    return psr_renderer->reset_matrix();
 }
 
 int print_matrix(void)
 {
     psr_debug("print_matrix()");
-    return renderer_context.print_matrix();
+    return psr_renderer->print_matrix();
 }
 
 int translate(float x, float y, float z)
 {
     psr_debug("translate(%f, %f, %f)", x, y, z);
-    return renderer_context.translate(x, y, z);
+    return psr_renderer->translate(x, y, z);
 }
 
 int rotate(float angle, float x, float y, float z)
 {
     psr_debug("rotate(%f, %f, %f, %f)", angle, x, y, z);
-    return renderer_context.rotate(angle, x, y, z);
+    return psr_renderer->rotate(angle, x, y, z);
 }
 
 int rotate_x(float angle)
@@ -278,25 +384,25 @@ int rotate_z(float angle)
 int scale(float x, float y, float z)
 {
     psr_debug("scale(%f, %f, %f)", x, y, z);
-    return renderer_context.scale(x, y, z);
+    return psr_renderer->scale(x, y, z);
 }
 
 int begin_shape(int mode)
 {
     psr_debug("begin_shape(%d)", mode);
-    return renderer_context.begin_shape(mode);
+    return psr_renderer->begin_shape(mode);
 }
 
 int vertex(float x, float y, float z, float u, float v)
 {
     psr_debug("vertex(%f, %f, %f, %f, %f)", x, y, z, u, v);
-    return renderer_context.vertex(x, y, z, u, v);
+    return psr_renderer->vertex(x, y, z, u, v);
 }
 
 int end_shape(int end_mode)
 {
     psr_debug("end_shape(%d)", end_mode);
-    return renderer_context.end_shape(end_mode);
+    return psr_renderer->end_shape(end_mode);
 }
 
 int triangle(float x1, float y1,
@@ -325,7 +431,7 @@ int arc(float x, float y, float width, float height, float start,
 	float stop)
 {
     psr_debug("arc(%f, %f, %f, %f, %f, %f)", x, y, width, height, start, stop);
-    switch(g_ellipse_mode) {
+    switch(psr_current->ellipse_mode) {
     case CENTER:
 	break;
     case RADIUS:
@@ -343,10 +449,10 @@ int arc(float x, float y, float width, float height, float start,
 	height = fabsf(y - height);
 	break;
     default:
-	psr_error("invalid g_ellipse_mode.  this should not happen");
+	psr_error("invalid psr_current->ellipse_mode.  this should not happen");
 	return -1;
     }
-    return renderer_context.arc(x, y, width, height, start, stop);
+    return psr_renderer->arc(x, y, width, height, start, stop);
 }
 
 int point(float x, float y, float z)
@@ -391,7 +497,7 @@ int ellipse_mode(int mode)
 	psr_error("invalid ellipse mode");
 	return -1;
     }
-    g_ellipse_mode = mode;
+    psr_current->ellipse_mode = mode;
     return 0;
 }
 
@@ -399,7 +505,7 @@ int rect(float x, float y, float width, float height)
 {
     psr_debug("rect(%f, %f, %f, %f)", x, y, width, height);
     begin_shape(QUADS);
-    switch(g_rect_mode) {
+    switch(psr_current->rect_mode) {
     case CORNER:
 	vertex(x, y, 0, 0, 0);
 	vertex(x + width, y, 0, 0, 0);
@@ -426,7 +532,7 @@ int rect(float x, float y, float width, float height)
 	break;
     default:
 	end_shape(CLOSE);
-	psr_error("invalid g_rect_mode.  this should not happen.");
+	psr_error("invalid psr_current->rect_mode.  this should not happen.");
 	return -1;
     }
     return end_shape(CLOSE);
@@ -445,14 +551,14 @@ int rect_mode(int mode)
 	psr_error("invalid rect mode");
 	return -1;
     }
-    g_rect_mode = mode;
+    psr_current->rect_mode = mode;
     return 0;
 }
 
 int bezier_detail(int level)
 {
     psr_debug("bezier_detail(%d)", level);
-    return renderer_context.bezier_detail(level);
+    return psr_renderer->bezier_detail(level);
 }
 
 int bezier_vertex(float cx1, float cy1, float cz1,
@@ -461,7 +567,7 @@ int bezier_vertex(float cx1, float cy1, float cz1,
 {
     psr_debug("bezier_vertex(%f, %f, %f, %f, %f, %f, %f, %f, %f",
 	      cx1, cy1, cz1, cx2, cy2, cz2, x, y, z);
-    return renderer_context.bezier_vertex(cx1, cy1, cz1, cx2, cy2, cz2, x, y, z);
+    return psr_renderer->bezier_vertex(cx1, cy1, cz1, cx2, cy2, cz2, x, y, z);
 }
 
 int bezier(float x1, float y1, float z1,
@@ -477,71 +583,200 @@ int bezier(float x1, float y1, float z1,
     return end_shape(OPEN);
 }
 
+float bezier_point(float a, float b, float c, float d, float t)
+{
+    float p;
+
+    psr_bezier_eval(&a, &b, &c, &d, 0, &t, 1, &p, NULL);
+    return p;
+}
+
+float bezier_tangent(float a, float b, float c, float d, float t)
+{
+    float g;
+
+    psr_bezier_eval(&a, &b, &c, &d, 0, &t, 1, NULL, &g);
+    return g;
+}
+
+/** one curve at n values of t.  points or tangents may be NULL. */
+int bezier_points(float a, float b, float c, float d,
+		  const float *t, int n, float *points, float *tangents)
+{
+    psr_bezier_eval(&a, &b, &c, &d, 0, t, n, points, tangents);
+    return 0;
+}
+
+/** n curves, each with its own control values and t */
+int bezier_points_multi(const float *a, const float *b,
+			const float *c, const float *d,
+			const float *t, int n, float *points,
+			float *tangents)
+{
+    psr_bezier_eval(a, b, c, d, 1, t, n, points, tangents);
+    return 0;
+}
+
+int curve_detail(int level)
+{
+    psr_debug("curve_detail(%d)", level);
+    return psr_renderer->curve_detail(level);
+}
+
+int curve_tightness(float tightness)
+{
+    psr_debug("curve_tightness(%f)", tightness);
+    psr_curve_basis(tightness, psr_current->curve_basis);
+    return psr_renderer->curve_tightness(tightness);
+}
+
+int curve_vertex(float x, float y, float z)
+{
+    psr_debug("curve_vertex(%f, %f, %f)", x, y, z);
+    return psr_renderer->curve_vertex(x, y, z);
+}
+
+/** the curve runs from the second point to the third, the others only
+ * steer it */
+int curve(float x1, float y1, float z1,
+	  float x2, float y2, float z2,
+	  float x3, float y3, float z3,
+	  float x4, float y4, float z4)
+{
+    psr_debug("curve(%f, %f, %f, %f, %f, %f, %f, %f, %f, %f, %f, %f)",
+	      x1, y1, z1, x2, y2, z2, x3, y3, z3, x4, y4, z4);
+    begin_shape(POLYGON);
+    curve_vertex(x1, y1, z1);
+    curve_vertex(x2, y2, z2);
+    curve_vertex(x3, y3, z3);
+    curve_vertex(x4, y4, z4);
+    return end_shape(OPEN);
+}
+
+float curve_point(float a, float b, float c, float d, float t)
+{
+    return psr_spline_point(psr_current->curve_basis, a, b, c, d, t);
+}
+
+float curve_tangent(float a, float b, float c, float d, float t)
+{
+    return psr_spline_tangent(psr_current->curve_basis, a, b, c, d, t);
+}
+
 /** FIXME: not finished yet. */
 int box(float width, float height, float depth)
 {
     psr_debug("box(%f, %f, %f)", width, height, depth);
-    return renderer_context.box(width, height, depth);
+    return psr_renderer->box(width, height, depth);
 }
 
 int sphere(float radius)
 {
     psr_debug("sphere(%f)", radius);
-    return renderer_context.sphere(radius);
+    return psr_renderer->sphere(radius);
 }
 
 int sphere_detail(int n)
 {
     psr_debug("sphere_detail(%d)", n);
-    return renderer_context.sphere_detail(n);
+    return psr_renderer->sphere_detail(n);
+}
+
+/** take the detail of sphere(), arc() and bezier_vertex() from their size
+ * on the screen, so they are at most max_error pixels off.  the detail
+ * levels set are the most they get.  0 turns it off. */
+int auto_detail(float max_error)
+{
+    psr_debug("auto_detail(%f)", max_error);
+    if (max_error < 0) {
+	psr_error("invalid 'max_error' argument.");
+	return -1;
+    }
+    return psr_renderer->auto_detail(max_error);
 }
 
 int stroke_weight(float width)
 {
     psr_debug("stroke_weight(%f)", width);
-    return renderer_context.stroke_weight(width);
+    return psr_renderer->stroke_weight(width);
+}
+
+int stroke_join(int join)
+{
+    psr_debug("stroke_join(%d)", join);
+    return psr_renderer->stroke_join(join);
+}
+
+int stroke_cap(int cap)
+{
+    psr_debug("stroke_cap(%d)", cap);
+    return psr_renderer->stroke_cap(cap);
 }
 
 int smooth(void)
 {
     psr_debug("smooth()");
-    return renderer_context.smooth();
+    return psr_renderer->smooth();
 }
 
 int no_smooth(void)
 {
     psr_debug("no_smooth()");
-    return renderer_context.no_smooth();
+    return psr_renderer->no_smooth();
+}
+
+int hint(int which)
+{
+    psr_debug("hint(%d)", which);
+    if (which == 0 || which <= -HINT_COUNT || which >= HINT_COUNT) {
+	psr_error("invalid 'which' argument.");
+	return -1;
+    }
+    return psr_renderer->hint(which);
+}
+
+/** tag what is drawn from now on with id for pick(), 0 to stop */
+int pick_id(int id)
+{
+    psr_debug("pick_id(%d)", id);
+    if (id < 0) {
+	psr_error("invalid 'id' argument.");
+	return -1;
+    }
+    return psr_renderer->pick_id(id);
 }
 
 int fill(float r, float g, float b, float a)
 {
     psr_debug("fill(%f, %f, %f, %f)", r, g, b, a);
-    return renderer_context.fill(r, g, b, a);
+    if (psr_current->color_mode == HSB) {
+	hsb_to_rgb(&r, &g, &b);
+    }
+    return psr_renderer->fill(r, g, b, a);
 }
 
 int no_fill(void)
 {
     psr_debug("no_fill()");
-    return renderer_context.no_fill();
+    return psr_renderer->no_fill();
 }
 
 int save(struct psr_image *img)
 {
     psr_debug("save(%p)", img);
-    return renderer_context.save(img);
+    return psr_renderer->save(img);
 }
 
 int image(struct psr_image *img, float x, float y, float width, float height)
 {
     psr_debug("image(%p, %f, %f, %f, %f)", img, x, y, width, height);
-    return renderer_context.image(img, x, y, width, height);
+    return psr_renderer->image(img, x, y, width, height);
 }
 
 int camera_default(void)
 {
     psr_debug("camera_default()");
-    return renderer_context.camera_default();
+    return psr_renderer->camera_default();
 }
 
 int camera(float eye_x, float eye_y, float eye_z,
@@ -552,7 +787,7 @@ int camera(float eye_x, float eye_y, float eye_z,
 	      eye_x, eye_y, eye_z,
 	      center_x, center_y, center_z,
 	      up_x, up_y, up_z);
-    return renderer_context.camera(
+    return psr_renderer->camera(
 	eye_x, eye_y, eye_z,
 	center_x, center_y, center_z,
 	up_x, up_y, up_z);
@@ -561,13 +796,13 @@ int camera(float eye_x, float eye_y, float eye_z,
 int begin_camera(void)
 {
     psr_debug("begin_camera()");
-    return renderer_context.begin_camera();
+    return psr_renderer->begin_camera();
 }
 
 int end_camera(void)
 {
     psr_debug("end_camera()");
-    return renderer_context.end_camera();
+    return psr_renderer->end_camera();
 }
 
 int ortho(float left, float right, float bottom, float top,
@@ -575,7 +810,257 @@ int ortho(float left, float right, float bottom, float top,
 {
     psr_debug("ortho(%f, %f, %f, %f, %f, %f)",
 	      left, right, bottom, top, near, far);
-    return renderer_context.ortho(left, right, bottom, top, near, far);
+    return psr_renderer->ortho(left, right, bottom, top, near, far);
+}
+
+/** a handle from h, the freed ones first.  they start at 1. */
+static int handle_get(struct psr_handles *h)
+{
+    if (h->free_count) {
+	return h->free[--h->free_count];
+    }
+    return ++h->next;
+}
+
+static void handle_put(struct psr_handles *h, int handle)
+{
+    int *handles;
+
+    if (h->free_count == h->free_size) {
+	h->free_size = h->free_size ? h->free_size * 2 : 16;
+	handles = realloc(h->free, h->free_size * sizeof(*handles));
+	if (!handles) {
+	    psr_system_error(errno, "No memory for handles.");
+	}
+	h->free = handles;
+    }
+    h->free[h->free_count++] = handle;
+}
+
+static int shape_valid(int handle)
+{
+    const struct psr_ctx *ctx = psr_current;
+
+    if (handle <= 0 || handle >= ctx->shape_live_len
+	|| !ctx->shape_live[handle]) {
+	psr_error("invalid shape %d.", handle);
+	return 0;
+    }
+    return 1;
+}
+
+int create_shape(void)
+{
+    struct psr_ctx *ctx = psr_current;
+    int handle, len;
+    char *live;
+
+    psr_debug("create_shape()");
+    if (ctx->recording_shape) {
+	psr_error("create_shape() while shape %d is recorded",
+		  ctx->recording_shape);
+	return -1;
+    }
+    handle = handle_get(&ctx->shapes);
+    if (handle >= ctx->shape_live_len) {
+	len = ctx->shape_live_len ? ctx->shape_live_len * 2 : 16;
+	while (len <= handle) {
+	    len *= 2;
+	}
+	live = realloc(ctx->shape_live, len);
+	if (!live) {
+	    psr_system_error(errno, "No memory for shape handles.");
+	}
+	memset(live + ctx->shape_live_len, 0, len - ctx->shape_live_len);
+	ctx->shape_live = live;
+	ctx->shape_live_len = len;
+    }
+    if (psr_renderer->create_shape(handle)) {
+	handle_put(&ctx->shapes, handle);
+	return -1;
+    }
+    ctx->shape_live[handle] = 1;
+    ctx->recording_shape = handle;
+    return handle;
+}
+
+int end_shape_record(void)
+{
+    int handle = psr_current->recording_shape;
+
+    psr_debug("end_shape_record()");
+    if (!handle) {
+	psr_error("end_shape_record() without create_shape().");
+	return -1;
+    }
+    psr_current->recording_shape = 0;
+    if (psr_renderer->end_shape_record()) {
+	return -1;
+    }
+    return handle;
+}
+
+int shape(int handle)
+{
+    psr_debug("shape(%d)", handle);
+    if (!shape_valid(handle)) {
+	return -1;
+    }
+    return psr_renderer->shape(handle);
+}
+
+int free_shape(int handle)
+{
+    psr_debug("free_shape(%d)", handle);
+    if (!shape_valid(handle)) {
+	return -1;
+    }
+    if (handle == psr_current->recording_shape) {
+	psr_error("free_shape() of the shape recorded.");
+	return -1;
+    }
+    if (psr_renderer->free_shape(handle)) {
+	return -1;
+    }
+    psr_current->shape_live[handle] = 0;
+    handle_put(&psr_current->shapes, handle);
+    return 0;
+}
+
+/** an offscreen target of width x height, transparent.  what is drawn
+ * between begin_draw() and end_draw() goes there, and it is shown with
+ * image_graphics(), without a round trip through memory. */
+int create_graphics(int width, int height)
+{
+    struct psr_ctx *ctx = psr_current;
+    int handle, *sizes, len;
+
+    psr_debug("create_graphics(%d, %d)", width, height);
+    if (width <= 0 || height <= 0) {
+	psr_error("invalid size.");
+	return -1;
+    }
+    handle = handle_get(&ctx->graphics);
+    if (handle >= ctx->graphics_size_len) {
+	len = ctx->graphics_size_len ? ctx->graphics_size_len * 2 : 16;
+	while (len <= handle) {
+	    len *= 2;
+	}
+	sizes = realloc(ctx->graphics_size, 2 * len * sizeof(*sizes));
+	if (!sizes) {
+	    psr_system_error(errno, "No memory for graphics handles.");
+	}
+	ctx->graphics_size = sizes;
+	ctx->graphics_size_len = len;
+    }
+    if (psr_renderer->create_graphics(handle, width, height)) {
+	handle_put(&ctx->graphics, handle);
+	return -1;
+    }
+    ctx->graphics_size[2 * handle] = width;
+    ctx->graphics_size[2 * handle + 1] = height;
+    return handle;
+}
+
+static int graphics_valid(int target)
+{
+    const struct psr_ctx *ctx = psr_current;
+
+    if (target <= 0 || target >= ctx->graphics_size_len
+	|| !ctx->graphics_size[2 * target]) {
+	psr_error("invalid graphics %d.", target);
+	return 0;
+    }
+    return 1;
+}
+
+int free_graphics(int target)
+{
+    psr_debug("free_graphics(%d)", target);
+    if (!graphics_valid(target)) {
+	return -1;
+    }
+    if (target == psr_current->drawing) {
+	psr_error("free_graphics() of the target drawn into.");
+	return -1;
+    }
+    if (psr_renderer->free_graphics(target)) {
+	return -1;
+    }
+    psr_current->graphics_size[2 * target] = 0;
+    handle_put(&psr_current->graphics, target);
+    return 0;
+}
+
+/** draw into target until end_draw().  the matrices and the camera start
+ * over for the target's size, the window's come back after. */
+int begin_draw(int target)
+{
+    psr_debug("begin_draw(%d)", target);
+    if (!graphics_valid(target)) {
+	return -1;
+    }
+    if (psr_current->drawing) {
+	psr_error("begin_draw() while drawing into %d.",
+		  psr_current->drawing);
+	return -1;
+    }
+    if (psr_renderer->begin_draw(target)) {
+	return -1;
+    }
+    psr_current->drawing = target;
+    return 0;
+}
+
+int end_draw(void)
+{
+    psr_debug("end_draw()");
+    if (!psr_current->drawing) {
+	psr_error("end_draw() without begin_draw().");
+	return -1;
+    }
+    psr_current->drawing = 0;
+    return psr_renderer->end_draw();
+}
+
+/** the picture of target, like image().  0 for width or height keeps
+ * the size of the target. */
+int image_graphics(int target, float x, float y, float width, float height)
+{
+    psr_debug("image_graphics(%d, %f, %f, %f, %f)", target, x, y, width,
+	      height);
+    if (!graphics_valid(target)) {
+	return -1;
+    }
+    if (target == psr_current->drawing) {
+	psr_error("image_graphics() of the target drawn into.");
+	return -1;
+    }
+    return psr_renderer->image_graphics(target, x, y, width, height);
+}
+
+int text_font(const char *path)
+{
+    psr_debug("text_font(%s)", path ? path : "NULL");
+    return psr_renderer->text_font(path);
+}
+
+int text_size(float size)
+{
+    psr_debug("text_size(%f)", size);
+    return psr_renderer->text_size(size);
+}
+
+int text(const char *str, float x, float y)
+{
+    psr_debug("text(\"%s\", %f, %f)", str, x, y);
+    return psr_renderer->text(str, x, y);
+}
+
+/** how many primitives were dropped so far for being off screen */
+unsigned long culled_primitives(void)
+{
+    return psr_current->context.culled;
 }
 
 /* default setup */
@@ -584,9 +1069,12 @@ static void default_setup(void)
     psr_debug("default_setup()");
     //size(100, 100);
     frame_rate(60);
+    color_mode(RGB);
     rect_mode(CORNER);
     ellipse_mode(CENTER);
     bezier_detail(20);
+    curve_detail(20);
+    curve_tightness(0);
     sphere_detail(30);
     stroke(0, 0, 0, 1);
     fill(1, 1, 1, 1);
@@ -594,22 +1082,180 @@ static void default_setup(void)
     psr_debug("end of default_setup()");
 }
 
-int processor_init(void)
+/** getenv() for the backends, with the overrides of the current
+ * sketch */
+static const char *ctx_getenv(const char *name)
 {
-    psr_context.update_key = update_key;
-    psr_context.update_mouse = update_mouse;
-    psr_context.update_size = update_size;
-    psr_context.default_setup = default_setup;
+    const struct psr_ctx *ctx = psr_current;
+    int i;
 
-    /* FIXME: check return value */
-    load_renderer("./opengl/libpsr_gl.so");
+    for (i = 0; i < ctx->env_count; ++i) {
+	if (!strcmp(ctx->env[i].name, name)) {
+	    return ctx->env[i].value;
+	}
+    }
+    return getenv(name);
+}
+
+/** a new sketch drawn by the renderer at the path, NULL for
+ * PSR_RENDERER or else ./opengl/libpsr_gl.so.  GLUT takes a single
+ * sketch, the headless ./opengl/libpsr_egl.so any number. */
+struct psr_ctx *psr_ctx_new(const char *renderer)
+{
+    struct psr_ctx *ctx;
 
+    ctx = calloc(1, sizeof(*ctx));
+    if (!ctx) {
+	psr_system_error(errno, "No memory for the context.");
+	return NULL;
+    }
+    ctx->context.update_size = update_size;
+    ctx->context.default_setup = default_setup;
+    ctx->context.getenv = ctx_getenv;
+    ctx->looping = 1;
+    ctx->color_mode = RGB;
+
+    if (!renderer) {
+	renderer = getenv("PSR_RENDERER");
+    }
+    if (load_renderer(ctx, renderer ? renderer : "./opengl/libpsr_gl.so")
+	|| psr_pick_start(ctx)) {
+	psr_ctx_free(ctx);
+	return NULL;
+    }
+    return ctx;
+}
+
+/** set an environment variable for ctx only, before psr_ctx_run().
+ * NULL hides the one of the process. */
+int psr_ctx_setenv(struct psr_ctx *ctx, const char *name, const char *value)
+{
+    struct psr_env *env;
+    int i;
+
+    for (i = 0; i < ctx->env_count; ++i) {
+	if (!strcmp(ctx->env[i].name, name)) {
+	    break;
+	}
+    }
+    if (i == ctx->env_count) {
+	env = realloc(ctx->env, (i + 1) * sizeof(*env));
+	if (!env) {
+	    psr_system_error(errno, "No memory for the environment.");
+	    return -1;
+	}
+	ctx->env = env;
+	env[i].name = strdup(name);
+	env[i].value = NULL;
+	++ctx->env_count;
+    }
+    free(ctx->env[i].value);
+    ctx->env[i].value = value ? strdup(value) : NULL;
     return 0;
 }
 
-int processor_run(struct psr_usr_func *usr_func)
+/** the API calls of this thread go to ctx from now on */
+void psr_ctx_make_current(struct psr_ctx *ctx)
+{
+    psr_current = ctx;
+    psr_renderer = ctx ? &ctx->renderer : NULL;
+    if (ctx) {
+	width = ctx->width;
+	height = ctx->height;
+    }
+}
+
+struct psr_ctx *psr_ctx_get_current(void)
+{
+    return psr_current;
+}
+
+/* the innermost wrapper of draw(), on the thread that runs it */
+static void count_draw(void)
+{
+    struct psr_ctx *ctx = psr_current;
+
+    /* the renderer ended the target setup() left open with its frame */
+    ctx->drawing = 0;
+    ++ctx->frames;
+    ctx->usr_draw();
+}
+
+/** run the sketch on this thread, once.  input events are queued and
+ * handled at frame start, see input.c.  with PSR_THREADED set, draw()
+ * runs on its own thread, see cmdbuf.c.  with PSR_TRACE set, all
+ * renderer calls are written to that file, see trace.c */
+int psr_ctx_run(struct psr_ctx *ctx, struct psr_usr_func *usr_func)
+{
+    const char *trace;
+
+    psr_ctx_make_current(ctx);
+    if (ctx->renderer_init(&ctx->context, &ctx->renderer)) {
+	return -1;
+    }
+    ctx->context.usr_func = *usr_func;
+    ctx->start_usec = now_usec();
+    psr_layer_start(ctx);
+    if (usr_func->draw) {
+	ctx->usr_draw = ctx->context.usr_func.draw;
+	ctx->context.usr_func.draw = count_draw;
+    }
+    psr_input_start(ctx);
+    if (ctx_getenv("PSR_THREADED") && usr_func->draw) {
+	psr_cmdbuf_threaded(ctx);
+    }
+    trace = ctx_getenv("PSR_TRACE");
+    if (trace) {
+	psr_trace_start(trace, ctx);
+    }
+    return ctx->main_loop_start();
+}
+
+/** after psr_ctx_run() returned, or instead of it */
+void psr_ctx_free(struct psr_ctx *ctx)
 {
-    psr_context.usr_func = *usr_func;
-    main_loop_start();
+    int i;
+
+    if (!ctx) {
+	return;
+    }
+    psr_cmdbuf_threaded_end(ctx);
+    psr_trace_end(ctx);
+    psr_input_end(ctx);
+    psr_layer_end(ctx);
+    psr_noise_end(ctx);
+    psr_pick_end(ctx);
+    for (i = 0; i < ctx->env_count; ++i) {
+	free(ctx->env[i].name);
+	free(ctx->env[i].value);
+    }
+    free(ctx->env);
+    free(ctx->shapes.free);
+    free(ctx->shape_live);
+    free(ctx->graphics.free);
+    free(ctx->graphics_size);
+    if (ctx->handle) {
+	dlclose(ctx->handle);
+    }
+    if (psr_current == ctx) {
+	psr_ctx_make_current(NULL);
+    }
+    free(ctx);
+}
+
+/** the sketch of PSR_RENDERER, made current */
+int processor_init(void)
+{
+    struct psr_ctx *ctx = psr_ctx_new(NULL);
+
+    if (!ctx) {
+	return -1;
+    }
+    psr_ctx_make_current(ctx);
     return 0;
 }
+
+int processor_run(struct psr_usr_func *usr_func)
+{
+    return psr_ctx_run(psr_current, usr_func);
+}
@@ -0,0 +1,292 @@
+/** noise() and random_range().
+ *
+ * noise() is Perlin's improved gradient noise, summed over the octaves
+ * of noise_detail() like Processing's.  The lattice points are hashed
+ * instead of looked up in a permutation table, so there is nothing to
+ * gather and four points go through at once in the vector extensions of
+ * gcc, SSE or NEON underneath.  noise() is the same code for a single
+ * point, so noise_grid() gives exactly what noise() would.
+ *
+ * random_range() is xoshiro128**.  Both keep their state in the sketch
+ * and start from a fixed seed, so a sketch comes out the same on every
+ * run, also with PSR_THREADED or PSR_WORKERS. */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <errno.h>
+
+#include "psr_internal.h"
+#include "processing.h"
+
+#define NOISE_OCTAVES_MAX (16)
+
+typedef float v4f __attribute__ ((vector_size(16)));
+typedef int32_t v4i __attribute__ ((vector_size(16)));
+typedef uint32_t v4u __attribute__ ((vector_size(16)));
+
+struct psr_noise {
+    uint32_t seed;
+    int octaves;
+    float falloff;
+    uint32_t rng[4];
+};
+
+static void rng_seed(uint32_t *s, unsigned long seed)
+{
+    uint64_t z, x = seed;
+    int i;
+
+    /* splitmix64, as the xoshiro authors suggest */
+    for (i = 0; i < 4; i += 2) {
+	x += 0x9e3779b97f4a7c15ULL;
+	z = x;
+	z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+	z ^= z >> 31;
+	s[i] = z;
+	s[i + 1] = z >> 32;
+    }
+}
+
+static inline uint32_t rotl(uint32_t x, int k)
+{
+    return (x << k) | (x >> (32 - k));
+}
+
+static inline uint32_t rng_next(uint32_t *s)
+{
+    const uint32_t r = rotl(s[1] * 5, 7) * 9;
+    const uint32_t t = s[1] << 9;
+
+    s[2] ^= s[0];
+    s[3] ^= s[1];
+    s[1] ^= s[2];
+    s[0] ^= s[3];
+    s[2] ^= t;
+    s[3] = rotl(s[3], 11);
+    return r;
+}
+
+/** the noise state of the sketch, made on first use */
+static struct psr_noise *state(void)
+{
+    struct psr_ctx *ctx = psr_current;
+    struct psr_noise *n = ctx->noise;
+
+    if (n) {
+	return n;
+    }
+    n = calloc(1, sizeof(*n));
+    if (!n) {
+	psr_system_error(errno, "No memory for noise.");
+    }
+    n->octaves = 4;
+    n->falloff = 0.5f;
+    rng_seed(n->rng, 0);
+    ctx->noise = n;
+    return n;
+}
+
+void psr_noise_end(struct psr_ctx *ctx)
+{
+    free(ctx->noise);
+    ctx->noise = NULL;
+}
+
+/********************************************************************
+ * Noise functions
+ ********************************************************************/
+
+static inline v4f splat(float f)
+{
+    v4f v = {f, f, f, f};
+    return v;
+}
+
+/** a where m is set, b elsewhere */
+static inline v4f select4(v4i m, v4f a, v4f b)
+{
+    return (v4f) (((v4i) a & m) | ((v4i) b & ~m));
+}
+
+static inline v4i floor4(v4f x)
+{
+    v4i i = __builtin_convertvector(x, v4i);
+
+    /* truncated towards 0, a true comparison is -1 */
+    return i + (v4i) (x < __builtin_convertvector(i, v4f));
+}
+
+static inline v4u hash4(v4i i, v4i j, v4i k, uint32_t seed)
+{
+    v4u h = ((v4u) i * 0x8da6b343u) ^ ((v4u) j * 0xd8163841u)
+	^ ((v4u) k * 0xcb1ab31fu) ^ seed;
+
+    h ^= h >> 16;
+    h *= 0x7feb352du;
+    h ^= h >> 15;
+    h *= 0x846ca68bu;
+    h ^= h >> 16;
+    return h;
+}
+
+/** the gradient of Perlin's improved noise the top 4 bits of h choose,
+ * dotted with x, y, z */
+static inline v4f grad4(v4u h, v4f x, v4f y, v4f z)
+{
+    const v4u g = h >> 28;
+    v4f u, v;
+
+    u = select4((v4i) (g < 8), x, y);
+    v = select4((v4i) (g < 4), y,
+		select4((v4i) ((g == 12) | (g == 14)), x, z));
+    u = (v4f) ((v4u) u ^ ((g & 1) << 31));
+    v = (v4f) ((v4u) v ^ ((g & 2) << 30));
+    return u + v;
+}
+
+static inline v4f fade4(v4f t)
+{
+    return t * t * t * (t * (t * 6 - 15) + 10);
+}
+
+static inline v4f lerp4(v4f t, v4f a, v4f b)
+{
+    return a + t * (b - a);
+}
+
+/** a single octave, about -1 to 1 */
+static v4f perlin4(v4f x, v4f y, v4f z, uint32_t seed)
+{
+    const v4i ix = floor4(x), iy = floor4(y), iz = floor4(z);
+    const v4i one = {1, 1, 1, 1};
+    const v4i jx = ix + one, jy = iy + one, jz = iz + one;
+    v4f u, v, w, a, b, c, d;
+
+    x -= __builtin_convertvector(ix, v4f);
+    y -= __builtin_convertvector(iy, v4f);
+    z -= __builtin_convertvector(iz, v4f);
+    u = fade4(x);
+    v = fade4(y);
+    w = fade4(z);
+
+    a = lerp4(u, grad4(hash4(ix, iy, iz, seed), x, y, z),
+	      grad4(hash4(jx, iy, iz, seed), x - 1, y, z));
+    b = lerp4(u, grad4(hash4(ix, jy, iz, seed), x, y - 1, z),
+	      grad4(hash4(jx, jy, iz, seed), x - 1, y - 1, z));
+    c = lerp4(u, grad4(hash4(ix, iy, jz, seed), x, y, z - 1),
+	      grad4(hash4(jx, iy, jz, seed), x - 1, y, z - 1));
+    d = lerp4(u, grad4(hash4(ix, jy, jz, seed), x, y - 1, z - 1),
+	      grad4(hash4(jx, jy, jz, seed), x - 1, y - 1, z - 1));
+    return lerp4(w, lerp4(v, a, b), lerp4(v, c, d));
+}
+
+/** the octaves summed as Processing does, 0 to about 1 */
+static v4f noise4(const struct psr_noise *n, v4f x, v4f y, v4f z)
+{
+    v4f r = splat(0);
+    float amplitude = 0.5f;
+    int i;
+
+    for (i = 0; i < n->octaves; ++i) {
+	r += amplitude * (perlin4(x, y, z, n->seed + i) * 0.5f + 0.5f);
+	amplitude *= n->falloff;
+	x *= 2;
+	y *= 2;
+	z *= 2;
+    }
+    return r;
+}
+
+/** smooth noise at x, y, z, 0 to about 1.  0 for the coordinates not
+ * needed, noise(x, 0, 0) is 1D noise. */
+float noise(float x, float y, float z)
+{
+    return noise4(state(), splat(x), splat(y), splat(z))[0];
+}
+
+/** noise() over a grid of cols x rows: out[r * cols + c] gets
+ * noise(x + c * x_step, y + r * y_step, z), four at a time */
+int noise_grid(float *out, int cols, int rows, float x, float y, float z,
+	       float x_step, float y_step)
+{
+    const struct psr_noise *n = state();
+    const v4f lane = {0, 1, 2, 3};
+    v4f vx, vy, r;
+    int i, j, k;
+
+    if (!out || cols < 0 || rows < 0) {
+	psr_error("invalid grid.");
+	return -1;
+    }
+    for (j = 0; j < rows; ++j) {
+	vy = splat(y + j * y_step);
+	for (i = 0; i < cols; i += 4) {
+	    vx = splat(x) + (lane + (float) i) * x_step;
+	    r = noise4(n, vx, vy, splat(z));
+	    for (k = 0; k < 4 && i + k < cols; ++k) {
+		out[j * cols + i + k] = r[k];
+	    }
+	}
+    }
+    return 0;
+}
+
+/** octaves of noise() and how much each one counts less than the one
+ * before.  4 and 0.5 to begin with. */
+int noise_detail(int octaves, float falloff)
+{
+    struct psr_noise *n = state();
+
+    psr_debug("noise_detail(%d, %f)", octaves, falloff);
+    if (octaves < 1 || octaves > NOISE_OCTAVES_MAX || falloff < 0) {
+	psr_error("invalid noise detail.");
+	return -1;
+    }
+    n->octaves = octaves;
+    n->falloff = falloff;
+    return 0;
+}
+
+int noise_seed(unsigned long seed)
+{
+    psr_debug("noise_seed(%lu)", seed);
+    state()->seed = seed ^ (uint64_t) seed >> 32;
+    return 0;
+}
+
+/********************************************************************
+ * Random functions
+ ********************************************************************/
+
+/** low up to high, uniformly.  random() itself is the C library's. */
+float random_range(float low, float high)
+{
+    const float r = (rng_next(state()->rng) >> 8) * (1.0f / 16777216);
+
+    return low + (high - low) * r;
+}
+
+/** n of random_range(), in the order it would give them */
+int random_array(float *out, int n, float low, float high)
+{
+    uint32_t *s = state()->rng;
+    int i;
+
+    if (!out || n < 0) {
+	psr_error("invalid array.");
+	return -1;
+    }
+    for (i = 0; i < n; ++i) {
+	out[i] = low + (high - low)
+	    * ((rng_next(s) >> 8) * (1.0f / 16777216));
+    }
+    return 0;
+}
+
+int random_seed(unsigned long seed)
+{
+    psr_debug("random_seed(%lu)", seed);
+    rng_seed(state()->rng, seed);
+    return 0;
+}
@@ -0,0 +1,181 @@
+/** hint(ENABLE_DEPTH_SORT).  Translucent triangles are not drawn when
+ * they come but kept in eye space until the end of the frame, then
+ * sorted back to front and drawn in one glDrawArrays().  Opaque drawing
+ * does not come here.
+ *
+ * The sort is an LSD radix sort on the eye z of the centroids, 8 bits a
+ * pass.  It is stable, so triangles at the same depth keep the order
+ * they were drawn in. */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <GL/gl.h>
+
+#include "gl_internal.h"
+
+struct triangle {
+    struct stroke_point v[3];
+};
+
+static __thread struct triangle *tris = NULL;
+static __thread uint32_t *keys = NULL;
+static __thread int tri_len = 0, tri_size = 0;
+/* the modelview matrix of the primitive being added */
+static __thread GLfloat modelview[16];
+/* sort scratch and the vertices in drawing order */
+static __thread uint32_t *order = NULL, *order_tmp = NULL, *keys_tmp = NULL;
+static __thread struct triangle *sorted = NULL;
+static __thread int sorted_size = 0;
+
+/** take the modelview matrix for the triangles that follow */
+void depth_sort_begin(void)
+{
+    glGetFloatv(GL_MODELVIEW_MATRIX, modelview);
+}
+
+static inline void to_eye(struct stroke_point *e, const struct stroke_point *p)
+{
+    const GLfloat *m = modelview;
+
+    *e = *p;
+    e->x = m[0] * p->x + m[4] * p->y + m[8] * p->z + m[12];
+    e->y = m[1] * p->x + m[5] * p->y + m[9] * p->z + m[13];
+    e->z = m[2] * p->x + m[6] * p->y + m[10] * p->z + m[14];
+}
+
+/** floats in the order of their bits as unsigned, negative ones have
+ * all bits flipped and positive ones the sign bit */
+static inline uint32_t float_key(float f)
+{
+    uint32_t u;
+
+    memcpy(&u, &f, sizeof(u));
+    return u ^ (-(u >> 31) | 0x80000000);
+}
+
+void depth_sort_triangle(const struct stroke_point *a,
+			 const struct stroke_point *b,
+			 const struct stroke_point *c)
+{
+    struct triangle *t;
+
+    if (tri_len == tri_size) {
+	tri_size = tri_size ? tri_size * 2 : 256;
+	t = realloc(tris, tri_size * sizeof(*tris));
+	keys = realloc(keys, tri_size * sizeof(*keys));
+	if (!t || !keys) {
+	    psr_system_error(errno, "No memory for depth sorting.");
+	}
+	tris = t;
+    }
+    t = &tris[tri_len];
+    to_eye(&t->v[0], a);
+    to_eye(&t->v[1], b);
+    to_eye(&t->v[2], c);
+    /* the eye looks down -z, the farthest triangle has the smallest z
+     * and comes first */
+    keys[tri_len++] = float_key(t->v[0].z + t->v[1].z + t->v[2].z);
+}
+
+static void radix_sort(int n)
+{
+    uint32_t *src = order, *dst = order_tmp, *k = keys, *kd = keys_tmp;
+    int count[256];
+    int shift, i;
+
+    for (i = 0; i < n; ++i) {
+	order[i] = i;
+    }
+    for (shift = 0; shift < 32; shift += 8) {
+	uint32_t *swap;
+	int sum = 0;
+
+	memset(count, 0, sizeof(count));
+	for (i = 0; i < n; ++i) {
+	    ++count[(k[i] >> shift) & 0xff];
+	}
+	if (count[(k[0] >> shift) & 0xff] == n) {
+	    continue;		/* all the same in this byte */
+	}
+	for (i = 0; i < 256; ++i) {
+	    int c = count[i];
+	    count[i] = sum;
+	    sum += c;
+	}
+	for (i = 0; i < n; ++i) {
+	    int j = count[(k[i] >> shift) & 0xff]++;
+	    dst[j] = src[i];
+	    kd[j] = k[i];
+	}
+	swap = src;
+	src = dst;
+	dst = swap;
+	swap = k;
+	k = kd;
+	kd = swap;
+    }
+    if (src != order) {
+	memcpy(order, src, n * sizeof(*order));
+    }
+    /* keys may now live in keys_tmp, they are not needed any more */
+}
+
+/** draw everything deferred so far, back to front */
+int depth_sort_flush(void)
+{
+    int i;
+
+    if (!tri_len) {
+	return 0;
+    }
+    if (sorted_size < tri_size) {
+	sorted_size = tri_size;
+	order = realloc(order, sorted_size * sizeof(*order));
+	order_tmp = realloc(order_tmp, sorted_size * sizeof(*order_tmp));
+	keys_tmp = realloc(keys_tmp, sorted_size * sizeof(*keys_tmp));
+	sorted = realloc(sorted, sorted_size * sizeof(*sorted));
+	if (!order || !order_tmp || !keys_tmp || !sorted) {
+	    psr_system_error(errno, "No memory for depth sorting.");
+	}
+    }
+    radix_sort(tri_len);
+    for (i = 0; i < tri_len; ++i) {
+	sorted[i] = tris[order[i]];
+    }
+
+    /* the vertices are in eye space already */
+    glMatrixMode(GL_MODELVIEW);
+    glPushMatrix();
+    glLoadIdentity();
+    glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
+    /* opaque drawing still hides them, but they don't hide each other */
+    glDepthMask(GL_FALSE);
+    glEnableClientState(GL_VERTEX_ARRAY);
+    glEnableClientState(GL_COLOR_ARRAY);
+    glVertexPointer(3, GL_FLOAT, sizeof(struct stroke_point),
+		    &sorted->v[0].x);
+    glColorPointer(4, GL_UNSIGNED_BYTE, sizeof(struct stroke_point),
+		   &sorted->v[0].color);
+    glDrawArrays(GL_TRIANGLES, 0, tri_len * 3);
+    glDisableClientState(GL_COLOR_ARRAY);
+    glDisableClientState(GL_VERTEX_ARRAY);
+    glDepthMask(GL_TRUE);
+    glPopMatrix();
+    tri_len = 0;
+    return 0;
+}
+
+void depth_sort_end(void)
+{
+    free(tris);
+    free(keys);
+    free(order);
+    free(order_tmp);
+    free(keys_tmp);
+    free(sorted);
+    tris = sorted = NULL;
+    keys = order = order_tmp = keys_tmp = NULL;
+    tri_len = tri_size = sorted_size = 0;
+}
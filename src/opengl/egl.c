@@ -0,0 +1,645 @@
+/** Headless renderer.  Draws into an EGL pbuffer on mesa's surfaceless
+ * platform, so no X display is needed, and dumps every frame in the
+ * raw RGB format of save().
+ *
+ * environment:
+ *   PSR_FRAMES   number of frames to render (default 1)
+ *   PSR_DUMP     printf() pattern for the frame files, e.g.
+ *                "out/sketch-%04d.rgb".  without a conversion all the
+ *                frames go into the one file, see psr_frames.h.
+ *                nothing is written if unset.
+ *   PSR_RING     shared memory name, e.g. "/sketch", to publish the
+ *                frames in for showpix -s.  see psr_ring.h.
+ *   PSR_WORKERS  number of processes to render in.  setup() runs once,
+ *                then the frames are split in slices among forked
+ *                workers.  the frame file of PSR_DUMP counts the frames
+ *                in order as they are done.  not with PSR_RING.
+ *
+ * or the same with psr_ctx_setenv().  Several sketches can render at
+ * once, each on its own thread with its own EGL context.
+ *
+ * The clock of millis() is virtual, it advances 1 / frame_rate() a
+ * frame, so what is drawn doesn't depend on how fast it is.
+ */
+
+#include <limits.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#include <GL/gl.h>
+
+#include "psr_internal.h"
+#include "psr_cmdbuf.h"
+#include "psr_frames.h"
+
+static __thread struct psr_context *psr_cxt = NULL;
+static __thread struct psr_renderer_context *renderer_cxt = NULL;
+static __thread volatile int looping = 1;
+static __thread volatile int redraw_pending = 0;
+
+/* the display is shared by the sketches of the process, the last one
+ * to close terminates it */
+static EGLDisplay egl_dpy = EGL_NO_DISPLAY;
+static int egl_users = 0;
+static pthread_mutex_t egl_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static __thread EGLConfig egl_config;
+static __thread EGLContext egl_cxt = EGL_NO_CONTEXT;
+static __thread EGLSurface egl_surface = EGL_NO_SURFACE;
+/* the frame file of a PSR_DUMP without a conversion */
+static __thread FILE *frames_fp = NULL;
+static __thread struct psr_frames frames_head;
+
+/* in a PSR_WORKERS process: the frame file, and the pipe the frames
+ * done are reported to */
+static __thread int frames_fd = -1;
+static __thread int report_fd = -1;
+/* the calls of a draw() that isn't shown */
+static __thread struct psr_cmdbuf skipped;
+
+/** what a worker reports for each frame */
+struct frame_done {
+    uint32_t frame;
+    uint32_t width, height;
+};
+
+/* functions from gl.c .  too lazy to make a header file for this */
+extern int gl_init(struct psr_context *psr_cxt,
+		   struct psr_renderer_context *renderer_cxt);
+
+extern int gl_end(void);
+
+extern int gl_reshape(int width, int height);
+
+extern int gl_present(void);
+
+extern void gl_frame_begin(void);
+
+extern void gl_frame_end(void);
+
+extern int gl_ring_publish(const char *name);
+
+extern void gl_ring_close(void);
+/* end functions */
+
+
+/********************************************************************
+ * For EGL
+ ********************************************************************/
+
+static EGLDisplay egl_get_display(void)
+{
+    PFNEGLGETPLATFORMDISPLAYEXTPROC get_platform_display;
+
+    get_platform_display = (PFNEGLGETPLATFORMDISPLAYEXTPROC)
+	eglGetProcAddress("eglGetPlatformDisplayEXT");
+    if (get_platform_display) {
+	EGLDisplay dpy = get_platform_display(EGL_PLATFORM_SURFACELESS_MESA,
+					      EGL_DEFAULT_DISPLAY, NULL);
+	if (dpy != EGL_NO_DISPLAY) {
+	    return dpy;
+	}
+    }
+    return eglGetDisplay(EGL_DEFAULT_DISPLAY);
+}
+
+/** one user less of the display, see egl_open() */
+static void egl_release(void)
+{
+    eglReleaseThread();
+    pthread_mutex_lock(&egl_lock);
+    if (!--egl_users) {
+	eglTerminate(egl_dpy);
+	egl_dpy = EGL_NO_DISPLAY;
+    }
+    pthread_mutex_unlock(&egl_lock);
+}
+
+static int egl_open(void)
+{
+    static const EGLint config_attr[] = {
+	EGL_SURFACE_TYPE, EGL_PBUFFER_BIT,
+	EGL_RED_SIZE, 8,
+	EGL_GREEN_SIZE, 8,
+	EGL_BLUE_SIZE, 8,
+	EGL_ALPHA_SIZE, 8,
+	EGL_DEPTH_SIZE, 16,
+	EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+	EGL_NONE
+    };
+    EGLint major, minor, n;
+
+    pthread_mutex_lock(&egl_lock);
+    if (!egl_users) {
+	egl_dpy = egl_get_display();
+	if (egl_dpy == EGL_NO_DISPLAY
+	    || !eglInitialize(egl_dpy, &major, &minor)) {
+	    pthread_mutex_unlock(&egl_lock);
+	    psr_error("no EGL display.");
+	    return -1;
+	}
+	psr_debug("EGL version: %d.%d", major, minor);
+    }
+    ++egl_users;
+    pthread_mutex_unlock(&egl_lock);
+    /* on failure the display goes with the last user, who may be us */
+    if (!eglChooseConfig(egl_dpy, config_attr, &egl_config, 1, &n) || n < 1) {
+	egl_release();
+	psr_error("no matching EGL config.");
+	return -1;
+    }
+    if (!eglBindAPI(EGL_OPENGL_API)) {
+	egl_release();
+	psr_error("eglBindAPI(EGL_OPENGL_API) failed.");
+	return -1;
+    }
+    egl_cxt = eglCreateContext(egl_dpy, egl_config, EGL_NO_CONTEXT, NULL);
+    if (egl_cxt == EGL_NO_CONTEXT) {
+	n = eglGetError();
+	egl_release();
+	psr_error("eglCreateContext failed: 0x%x", n);
+	return -1;
+    }
+    return 0;
+}
+
+/** (re)create the pbuffer.  the GL state lives in the context, so it
+ * survives the switch. */
+static int egl_resize(int width, int height)
+{
+    const EGLint surface_attr[] = {
+	EGL_WIDTH, width,
+	EGL_HEIGHT, height,
+	EGL_NONE
+    };
+    EGLSurface surface;
+
+    surface = eglCreatePbufferSurface(egl_dpy, egl_config, surface_attr);
+    if (surface == EGL_NO_SURFACE) {
+	psr_error("eglCreatePbufferSurface(%d, %d) failed: 0x%x",
+		  width, height, eglGetError());
+	return -1;
+    }
+    if (!eglMakeCurrent(egl_dpy, surface, surface, egl_cxt)) {
+	psr_error("eglMakeCurrent failed: 0x%x", eglGetError());
+	eglDestroySurface(egl_dpy, surface);
+	return -1;
+    }
+    if (egl_surface != EGL_NO_SURFACE) {
+	eglDestroySurface(egl_dpy, egl_surface);
+    }
+    egl_surface = surface;
+
+    psr_cxt->update_size(width, height);
+    return gl_reshape(width, height);
+}
+
+static void egl_close(void)
+{
+    eglMakeCurrent(egl_dpy, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+    if (egl_surface != EGL_NO_SURFACE) {
+	eglDestroySurface(egl_dpy, egl_surface);
+	egl_surface = EGL_NO_SURFACE;
+    }
+    if (egl_cxt != EGL_NO_CONTEXT) {
+	eglDestroyContext(egl_dpy, egl_cxt);
+	egl_cxt = EGL_NO_CONTEXT;
+    }
+    egl_release();
+}
+
+/** add img to the frame file, then count it in the header */
+static int dump_append(const char *path, const struct psr_image *img)
+{
+    const size_t size = (size_t) 3 * img->width * img->height;
+    struct psr_frames *h = &frames_head;
+
+    if (!frames_fp) {
+	frames_fp = fopen(path, "w");
+	if (!frames_fp) {
+	    psr_system_warn(errno, "can't open %s", path);
+	    return -1;
+	}
+	h->magic = PSR_FRAMES_MAGIC;
+	h->format = PSR_RING_RGB;
+	h->width = img->width;
+	h->height = img->height;
+	h->frames = 0;
+	h->offset = sizeof(*h);
+    } else if (img->width != h->width || img->height != h->height) {
+	psr_warn("the size changed, %s ends here", path);
+	return -1;
+    }
+    if (fseek(frames_fp, h->offset + h->frames * size, SEEK_SET)
+	|| fwrite(img->data, 1, size, frames_fp) != size) {
+	psr_warn("short write to %s", path);
+	return -1;
+    }
+    ++h->frames;
+    rewind(frames_fp);
+    if (fwrite(h, sizeof(*h), 1, frames_fp) != 1 || fflush(frames_fp)) {
+	psr_warn("short write to %s", path);
+	return -1;
+    }
+    return 0;
+}
+
+/** put img at its place in the frame file of a worker.  the parent
+ * writes the header. */
+static int dump_put(const char *path, int frame, const struct psr_image *img)
+{
+    const size_t size = (size_t) 3 * img->width * img->height;
+    struct psr_frames *h = &frames_head;
+
+    if (frames_fd < 0) {
+	frames_fd = open(path, O_WRONLY);
+	if (frames_fd < 0) {
+	    psr_system_warn(errno, "can't open %s", path);
+	    return -1;
+	}
+	h->width = img->width;
+	h->height = img->height;
+    } else if (img->width != h->width || img->height != h->height) {
+	psr_warn("the size changed, %s ends here", path);
+	return -1;
+    }
+    if (pwrite(frames_fd, img->data, size, sizeof(*h) + frame * size)
+	!= size) {
+	psr_warn("short write to %s", path);
+	return -1;
+    }
+    return 0;
+}
+
+static int dump_frame(const char *pattern, int frame)
+{
+    struct psr_image img = {0, 0, NULL};
+    char path[PATH_MAX];
+    FILE *fp;
+    size_t n;
+    int r;
+
+    r = renderer_cxt->save(&img);
+    if (r) {
+	return r;
+    }
+    if (!strchr(pattern, '%')) {
+	if (report_fd >= 0) {
+	    r = dump_put(pattern, frame, &img);
+	} else {
+	    r = dump_append(pattern, &img);
+	}
+	free(img.data);
+	return r;
+    }
+    snprintf(path, sizeof(path), pattern, frame);
+    fp = fopen(path, "w");
+    if (!fp) {
+	psr_system_warn(errno, "can't open %s", path);
+	free(img.data);
+	return -1;
+    }
+    n = fwrite(img.data, 3, img.width * img.height, fp);
+    fclose(fp);
+    free(img.data);
+    if (n != img.width * img.height) {
+	psr_warn("short write to %s", path);
+	return -1;
+    }
+    return 0;
+}
+
+
+/********************************************************************
+ * Structure functions
+ ********************************************************************/
+
+static int size(int width, int height)
+{
+    return egl_resize(width, height);
+}
+
+static int no_loop(void)
+{
+    looping = 0;
+    return 0;
+}
+
+static int loop(void)
+{
+    looping = 1;
+    return 0;
+}
+
+static int redraw(void)
+{
+    redraw_pending = 1;
+    return 0;
+}
+
+
+/********************************************************************
+ * Environment functions
+ ********************************************************************/
+
+/* frames are rendered back to back, there is no display to pace. */
+static int frame_rate(float framerate)
+{
+    return 0;
+}
+
+static int cursor(int type)
+{
+    return 0;
+}
+
+
+/********************************************************************
+ * Other functions
+ ********************************************************************/
+
+int init(struct psr_context *lpsr_cxt,
+	 struct psr_renderer_context *lrenderer_cxt)
+{
+    psr_debug("module init");
+    psr_cxt = lpsr_cxt;
+    psr_cxt->virtual_clock = 1;
+    renderer_cxt = lrenderer_cxt;
+    renderer_cxt->size = size;
+    renderer_cxt->no_loop = no_loop;
+    renderer_cxt->loop = loop;
+    renderer_cxt->redraw = redraw;
+    renderer_cxt->frame_rate = frame_rate;
+    renderer_cxt->cursor = cursor;
+    return 0;
+}
+
+/** save() has no pixels to give while recording */
+static int no_save(struct psr_image *img)
+{
+    psr_warn("save() draws nothing here.");
+    return -1;
+}
+
+/** call func with the calls recorded into buf instead of drawn */
+static void record(struct psr_cmdbuf *buf, void (*func) (void))
+{
+    struct psr_renderer_context real = *renderer_cxt;
+    struct psr_cmdbuf *target = psr_cmdbuf_target;
+
+    *renderer_cxt = psr_cmdbuf_recorder;
+    renderer_cxt->save = no_save;
+    psr_cmdbuf_target = buf;
+    func();
+    psr_cmdbuf_target = target;
+    *renderer_cxt = real;
+}
+
+/** draw() of a frame before the first of a worker: what it changes is
+ * kept, what it draws is dropped */
+static void skip_draw(int *recording)
+{
+    skipped.len = 0;
+    record(&skipped, psr_cxt->usr_func.draw);
+    psr_cmdbuf_replay_state(&skipped, renderer_cxt, recording);
+}
+
+/** the frames up to last; those before first are only caught up with.
+ * setup is what setup() did in the parent of a worker, or NULL to call
+ * it. */
+static int render(int first, int last, const char *dump, const char *ring,
+		  const struct psr_cmdbuf *setup)
+{
+    struct frame_done done;
+    int frame, recording = 0;
+
+    if (egl_open()) {
+	return -1;
+    }
+    if (egl_resize(DEFAULT_WIDTH, DEFAULT_HEIGHT)) {
+	egl_close();
+	return -1;
+    }
+    gl_init(psr_cxt, renderer_cxt);
+
+    if (setup) {
+	psr_cmdbuf_replay(setup, renderer_cxt);
+    } else {
+	psr_cxt->default_setup();
+	psr_cxt->usr_func.setup();
+    }
+    gl_frame_end();
+
+    for (frame = 0; frame < last; ++frame) {
+	if (psr_cxt->usr_func.draw && (looping || redraw_pending)) {
+	    redraw_pending = 0;
+	    if (frame < first) {
+		skip_draw(&recording);
+	    } else {
+		gl_frame_begin();
+		psr_cxt->usr_func.draw();
+		gl_frame_end();
+	    }
+	}
+	if (frame < first) {
+	    continue;
+	}
+	gl_present();
+	glFinish();
+	if (dump && dump_frame(dump, frame)) {
+	    break;
+	}
+	if (ring && gl_ring_publish(ring)) {
+	    break;
+	}
+	if (report_fd >= 0) {
+	    done.frame = frame;
+	    done.width = frames_head.width;
+	    done.height = frames_head.height;
+	    if (write(report_fd, &done, sizeof(done)) != sizeof(done)) {
+		psr_system_warn(errno, "can't report frame %d", frame);
+		break;
+	    }
+	}
+    }
+
+    if (frames_fp) {
+	fclose(frames_fp);
+	frames_fp = NULL;
+    }
+    if (frames_fd >= 0) {
+	close(frames_fd);
+	frames_fd = -1;
+    }
+    psr_cmdbuf_free(&skipped);
+    gl_ring_close();
+    /* the thread may go on with another sketch */
+    gl_end();
+    egl_close();
+    return frame < last ? -1 : 0;
+}
+
+static void setup_all(void)
+{
+    psr_cxt->default_setup();
+    psr_cxt->usr_func.setup();
+}
+
+/** the header of the frame file counts the frames done without a gap */
+static void frames_advance(int fd, const char *dump, int count,
+			   const struct frame_done *done)
+{
+    const struct psr_frames h = {
+	.magic = PSR_FRAMES_MAGIC,
+	.format = PSR_RING_RGB,
+	.width = done->width,
+	.height = done->height,
+	.frames = count,
+	.offset = sizeof(h),
+    };
+
+    if (pwrite(fd, &h, sizeof(h), 0) != sizeof(h)) {
+	psr_system_warn(errno, "can't write to %s", dump);
+    }
+}
+
+/** setup() here, without GL, then the frames in workers forked from
+ * this process, each with a slice.  they don't share anything after the
+ * fork, so each one runs the draw() of the frames before its slice, to
+ * be in the state of the sketch there, but only draws its own. */
+static int render_workers(int frames, int workers, const char *dump,
+			  const char *ring)
+{
+    struct psr_cmdbuf setup = {NULL, 0, 0, 0};
+    struct frame_done done;
+    unsigned char *finished;
+    int fds[2], fd = -1, next = 0, k, status, r = 0;
+    pid_t *pids;
+    ssize_t n;
+
+    /* forked threads of an EGL display are lost */
+    pthread_mutex_lock(&egl_lock);
+    k = egl_users;
+    pthread_mutex_unlock(&egl_lock);
+    if (k) {
+	psr_warn("EGL is in use, rendering in this process only.");
+	return render(0, frames, dump, ring, NULL);
+    }
+    if (ring) {
+	psr_warn("PSR_RING isn't published by PSR_WORKERS.");
+    }
+
+    psr_cxt->update_size(DEFAULT_WIDTH, DEFAULT_HEIGHT);
+    record(&setup, setup_all);
+
+    if (dump && !strchr(dump, '%')) {
+	fd = open(dump, O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0) {
+	    psr_system_warn(errno, "can't open %s", dump);
+	    psr_cmdbuf_free(&setup);
+	    return -1;
+	}
+    }
+    pids = calloc(workers, sizeof(*pids));
+    finished = calloc(frames, 1);
+    if (!pids || !finished) {
+	psr_system_error(errno, "No memory for the workers.");
+	return -1;
+    }
+    if (pipe(fds)) {
+	psr_system_error(errno, "can't make the report pipe.");
+	return -1;
+    }
+    /* or the children print it again */
+    fflush(NULL);
+    for (k = 0; k < workers; ++k) {
+	pids[k] = fork();
+	if (pids[k] < 0) {
+	    psr_system_warn(errno, "can't fork worker %d", k);
+	    r = -1;
+	    break;
+	}
+	if (!pids[k]) {
+	    close(fds[0]);
+	    report_fd = fds[1];
+	    r = render((long long) frames * k / workers,
+		       (long long) frames * (k + 1) / workers, dump, NULL,
+		       &setup);
+	    fflush(NULL);
+	    _exit(r ? 1 : 0);
+	}
+    }
+    close(fds[1]);
+
+    for (;;) {
+	n = read(fds[0], &done, sizeof(done));
+	if (n < 0 && errno == EINTR) {
+	    continue;
+	}
+	if (n != sizeof(done)) {
+	    break;
+	}
+	if (done.frame >= frames) {
+	    continue;
+	}
+	finished[done.frame] = 1;
+	if (done.frame != next) {
+	    continue;
+	}
+	while (next < frames && finished[next]) {
+	    ++next;
+	}
+	if (fd >= 0) {
+	    frames_advance(fd, dump, next, &done);
+	}
+    }
+    close(fds[0]);
+
+    while (k-- > 0) {
+	if (waitpid(pids[k], &status, 0) < 0 || !WIFEXITED(status)
+	    || WEXITSTATUS(status)) {
+	    psr_warn("worker %d failed.", k);
+	    r = -1;
+	}
+    }
+    if (next < frames) {
+	psr_warn("%d of %d frames done.", next, frames);
+	r = -1;
+    }
+    if (fd >= 0) {
+	close(fd);
+    }
+    free(finished);
+    free(pids);
+    psr_cmdbuf_free(&setup);
+    return r;
+}
+
+int main_loop_start(void)
+{
+    const char *frames_env = psr_cxt->getenv("PSR_FRAMES");
+    const char *workers_env = psr_cxt->getenv("PSR_WORKERS");
+    const char *dump = psr_cxt->getenv("PSR_DUMP");
+    const char *ring = psr_cxt->getenv("PSR_RING");
+    int frames = frames_env ? atoi(frames_env) : 1;
+    int workers = workers_env ? atoi(workers_env) : 1;
+
+    psr_debug("main_loop_start");
+
+    if (!psr_cxt->usr_func.setup) {
+	psr_error("we need setup() at least.");
+	return -1;
+    }
+    if (workers > frames) {
+	workers = frames;
+    }
+    if (workers > 1) {
+	return render_workers(frames, workers, dump, ring);
+    }
+    return render(0, frames, dump, ring, NULL);
+}
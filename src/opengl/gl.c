@@ -1,45 +1,80 @@
 #include <stdlib.h>
 #include <errno.h>
+#include <math.h>
 #include <GL/gl.h>
 #include <GL/glu.h>
 #include <string.h>
 
-#include "psr_internal.h"
+#include "gl_internal.h"
 #include "linux_list.h"
 
-static struct psr_context *psr_cxt = NULL;
-
-struct color_internal {
-    float r;
-    float g;
-    float b;
-    float a;
-};
+static __thread struct psr_context *psr_cxt = NULL;
 
 struct vertex {
     float x;
     float y;
     float z;
-    /* if not 0, it means this is a glList. */
-    GLuint gl_list;
-    struct color_internal stroke;
-    struct color_internal fill;
+    struct rgba8 stroke;
+    struct rgba8 fill;
     struct llist_head list;
 };
 
-static struct color_internal stroke_color, fill_color;
-
-static LLIST_HEAD(vertex_list_head);
-
-static int glmode = -1;
-static int bezier_detail_level;
-static int sphere_detail_level;
-static GLUquadric *quad = NULL;
-static int dont_fill = 0, dont_stroke = 0;
-static GLuint recorded_list = 0;
-static GLfloat saved_modelview[16];
-static int g_width, g_height;
-static GLdouble g_depth;
+static __thread struct rgba8 stroke_color, fill_color;
+
+static __thread struct llist_head vertex_list_head;
+
+static __thread int glmode = -1;
+static __thread int bezier_detail_level;
+/* the t values of bezier_detail(), then room for the t values of
+ * auto_detail() and for x, y and z */
+static __thread float *bezier_t = NULL;
+/* curve_vertex(): the last four control points and the points of a
+ * segment */
+static __thread int curve_detail_level = 20;
+static __thread float curve_tightness_value = 0;
+static __thread float curve_draw[16];
+static __thread float curve_ctrl[12];
+static __thread int curve_count = 0, curve_started = 0;
+static __thread float *curve_points = NULL;
+static __thread int curve_points_size = 0;
+/* the vertex list as an array, see shape_points() */
+static __thread struct stroke_point *shape_buf = NULL;
+static __thread int shape_buf_size = 0;
+static __thread int sphere_detail_level;
+static __thread GLUquadric *quad = NULL;
+static __thread int dont_fill = 0, dont_stroke = 0;
+static __thread float stroke_width = 1;
+static __thread int stroke_join_mode = MITER, stroke_cap_mode = ROUND;
+/* hint() settings, 1 when on */
+static __thread int hints[HINT_COUNT];
+static __thread int smoothing = 0;
+/* the pick_id() of what is drawn, 0 for none */
+static __thread int pick_current = 0;
+/* auto_detail(), pixels.  0 for the fixed detail levels */
+static __thread float lod_error = 0;
+/* the window size of the last box culled() let through, 0 if unknown */
+static __thread float culled_size;
+/* dirty_rect() so far, x0, y0, x1, y1 in window coordinates */
+static __thread float dirty_box[4];
+static __thread int dirty = 0;
+/* the region of a partial redraw, while it is drawn and until the
+ * next frame for gl_save_update() */
+static __thread int scissor_box[4];
+static __thread int scissoring = 0, partial = 0;
+/* the drawing of gl_record(), a chain of display lists.  lists don't
+ * nest, so a retained shape recorded meanwhile starts a new one. */
+static __thread GLuint *recorded_lists = NULL;
+static __thread int recorded_count = 0, recorded_size = 0;
+static __thread int recording = 0;
+
+void gl_record_free(void);
+/* display lists of the retained shapes, indexed by handle */
+static __thread GLuint *shape_lists = NULL;
+static __thread int shape_lists_size = 0;
+static __thread int recording_shape = 0;
+static __thread GLfloat saved_modelview[16];
+static __thread int g_width, g_height;
+static __thread GLdouble g_depth;
 
 #define glCheckError()					\
     ({							\
@@ -52,35 +87,363 @@ static GLdouble g_depth;
 	r;						\
     })
 
+/******************************************************************** 
+ * Flat functions
+ ********************************************************************/
+
+/* hint(DISABLE_DEPTH_TEST) is the 2D mode: an orthographic projection,
+ * no depth buffer, and the modelview kept here as a 3x2 affine matrix
+ * {a, b, c, d, e, f}, x' = a x + c y + e and y' = b x + d y + f.
+ * vertices are transformed when they are added and go to GL as x, y;
+ * the GL modelview is only loaded for what GL transforms itself, like
+ * arc() or text().
+ *
+ * a retained shape is recorded with raw vertices and the transforms
+ * mirrored into its display list, shape() plays it under the loaded
+ * matrix. */
+#define FLAT_STACK_DEPTH (32)
+
+enum {
+    FLAT_GL_IDENTITY,		/* GL modelview is identity */
+    FLAT_GL_CURRENT,		/* it is the current affine matrix */
+    FLAT_GL_STALE,		/* it is an older one */
+};
+
+static __thread int flat = 0;
+static __thread float flat_stack[FLAT_STACK_DEPTH][6];
+static __thread int flat_top = 0;
+static __thread float *affine;
+static __thread int flat_gl = FLAT_GL_IDENTITY;
+/* the matrix at create_shape(), restored by end_shape_record() */
+static __thread float flat_shape_saved[6];
+
+static inline void affine_identity(float *m)
+{
+    m[0] = m[3] = 1;
+    m[1] = m[2] = m[4] = m[5] = 0;
+}
+
+/** affine = affine * n */
+static void affine_mult(const float *n)
+{
+    const float *m = affine;
+    const float r[6] = {
+	m[0] * n[0] + m[2] * n[1], m[1] * n[0] + m[3] * n[1],
+	m[0] * n[2] + m[2] * n[3], m[1] * n[2] + m[3] * n[3],
+	m[0] * n[4] + m[2] * n[5] + m[4], m[1] * n[4] + m[3] * n[5] + m[5],
+    };
+
+    memcpy(affine, r, sizeof(r));
+    if (flat_gl == FLAT_GL_CURRENT) {
+	flat_gl = FLAT_GL_STALE;
+    }
+}
+
+static inline void affine_apply(float *x, float *y)
+{
+    const float tx = *x;
+
+    *x = affine[0] * tx + affine[2] * *y + affine[4];
+    *y = affine[1] * tx + affine[3] * *y + affine[5];
+}
+
+/** how much the matrix scales lengths, for the stroke width */
+static inline float affine_scale(void)
+{
+    return sqrtf(fabsf(affine[0] * affine[3] - affine[1] * affine[2]));
+}
+
+/** vertices are transformed on the CPU, but not into a display list of
+ * a retained shape */
+static inline int flat_cpu(void)
+{
+    return flat && !recording_shape;
+}
+
+/** make the GL modelview the affine matrix, for GL to transform */
+void gl_flat_load(void)
+{
+    const float *m = affine;
+    const GLfloat gl[16] = {
+	m[0], m[1], 0, 0,
+	m[2], m[3], 0, 0,
+	0, 0, 1, 0,
+	m[4], m[5], 0, 1,
+    };
+
+    if (!flat_cpu() || flat_gl == FLAT_GL_CURRENT) {
+	return;
+    }
+    glLoadMatrixf(gl);
+    flat_gl = FLAT_GL_CURRENT;
+}
+
+/** make it identity, for vertices transformed here */
+static void flat_unload(void)
+{
+    if (!flat_cpu() || flat_gl == FLAT_GL_IDENTITY) {
+	return;
+    }
+    glLoadIdentity();
+    flat_gl = FLAT_GL_IDENTITY;
+}
+
+static void flat_reset(void)
+{
+    flat_top = 0;
+    affine = flat_stack[0];
+    affine_identity(affine);
+    glLoadIdentity();
+    flat_gl = FLAT_GL_IDENTITY;
+}
+
+/** the projection of the current mode */
+static void projection(void)
+{
+    const GLdouble fov = 60;
+    const GLdouble aspect = (GLdouble) g_width / g_height;
+    const GLdouble z_near = g_depth / 10;
+    const GLdouble z_far = g_depth * 10;
+
+    glMatrixMode(GL_PROJECTION);
+    glLoadIdentity();
+    if (flat) {
+	/* y goes down, like the processing coordinate */
+	glOrtho(0, g_width, g_height, 0, -z_far, z_far);
+    } else {
+	psr_debug("aspect %f, z_near %f, z_far %f", aspect, z_near, z_far);
+	gluPerspective(fov, aspect, z_near, z_far);
+    }
+    glMatrixMode(GL_MODELVIEW);
+}
+
+static int camera_default(void);
+
+/******************************************************************** 
+ * Culling functions
+ ********************************************************************/
+
+/* a primitive whose bounding box is entirely off screen, or outside
+ * the dirty region of a partial redraw, is dropped before it reaches GL,
+ * and counted in psr_context.culled.  nothing is
+ * culled into a display list, it may be replayed under another
+ * camera. */
+
+/** the outcodes of a clip space point, one bit per clip plane */
+static inline int outcode(const GLfloat *m, float x, float y, float z)
+{
+    const float cx = m[0] * x + m[4] * y + m[8] * z + m[12];
+    const float cy = m[1] * x + m[5] * y + m[9] * z + m[13];
+    const float cz = m[2] * x + m[6] * y + m[10] * z + m[14];
+    const float cw = m[3] * x + m[7] * y + m[11] * z + m[15];
+
+    return (cx < -cw) | (cx > cw) << 1 | (cy < -cw) << 2 | (cy > cw) << 3
+	| (cz < -cw) << 4 | (cz > cw) << 5;
+}
+
+/** the matrix from object to clip space */
+static void clip_matrix(GLfloat *m)
+{
+    GLfloat mv[16], pr[16];
+    int i, j;
+
+    if (flat) {
+	/* the affine matrix and the window, as a clip matrix */
+	const float sx = 2.0f / g_width, sy = -2.0f / g_height;
+
+	memset(m, 0, 16 * sizeof(*m));
+	m[0] = affine[0] * sx;
+	m[1] = affine[1] * sy;
+	m[4] = affine[2] * sx;
+	m[5] = affine[3] * sy;
+	m[12] = affine[4] * sx - 1;
+	m[13] = affine[5] * sy + 1;
+	m[15] = 1;
+    } else {
+	glGetFloatv(GL_MODELVIEW_MATRIX, mv);
+	glGetFloatv(GL_PROJECTION_MATRIX, pr);
+	for (i = 0; i < 4; ++i) {
+	    for (j = 0; j < 4; ++j) {
+		m[j * 4 + i] = pr[i] * mv[j * 4] + pr[4 + i] * mv[j * 4 + 1]
+		    + pr[8 + i] * mv[j * 4 + 2] + pr[12 + i] * mv[j * 4 + 3];
+	    }
+	}
+    }
+}
+
+/** the window coordinates of point p under the clip matrix m.  -1 if
+ * it is behind the eye. */
+static inline int to_window(const GLfloat *m, float x, float y, float z,
+			    float *w)
+{
+    const float cw = m[3] * x + m[7] * y + m[11] * z + m[15];
+
+    if (cw <= 0) {
+	return -1;
+    }
+    w[0] = ((m[0] * x + m[4] * y + m[8] * z + m[12]) / cw + 1) / 2 * g_width;
+    w[1] = (1 - (m[1] * x + m[5] * y + m[9] * z + m[13]) / cw) / 2 * g_height;
+    return 0;
+}
+
+/** the window bounds x0, y0, x1, y1 of the box l, h.  a box reaching
+ * behind the eye gets the whole window and -1. */
+static int window_bounds(const GLfloat *m, const float *l, const float *h,
+			 float *b)
+{
+    float w[2];
+    int i;
+
+    b[0] = g_width;
+    b[1] = g_height;
+    b[2] = b[3] = 0;
+    for (i = 0; i < 8; ++i) {
+	if (to_window(m, i & 1 ? h[0] : l[0], i & 2 ? h[1] : l[1],
+		      i & 4 ? h[2] : l[2], w)) {
+	    b[0] = b[1] = 0;
+	    b[2] = g_width;
+	    b[3] = g_height;
+	    return -1;
+	}
+	b[0] = fminf(b[0], w[0]);
+	b[1] = fminf(b[1], w[1]);
+	b[2] = fmaxf(b[2], w[0]);
+	b[3] = fmaxf(b[3], w[1]);
+    }
+    return 0;
+}
+
+/** lo and hi are the corners of the box.  with screen set they are
+ * window coordinates already, the vertices of the 2D mode.  this is
+ * also where the bounds for pick() are taken. */
+static int culled(const float *lo, const float *hi, int screen)
+{
+    GLfloat m[16];
+    float margin = dont_stroke ? 0 : stroke_width / 2;
+    float l[3], h[3], b[4];
+    int code = ~0, i, known = 1;
+
+    culled_size = 0;
+    if (recording_shape || (recording && !pick_current)) {
+	return 0;
+    }
+    if (screen) {
+	/* a pixel more for thin lines and smoothing */
+	margin = margin * affine_scale() + 1;
+	b[0] = lo[0] - margin;
+	b[1] = lo[1] - margin;
+	b[2] = hi[0] + margin;
+	b[3] = hi[1] + margin;
+	if (!recording && (b[2] < 0 || b[0] > g_width
+			   || b[3] < 0 || b[1] > g_height)) {
+	    ++psr_cxt->culled;
+	    return 1;
+	}
+    } else {
+	clip_matrix(m);
+	for (i = 0; i < 3; ++i) {
+	    l[i] = lo[i] - margin;
+	    h[i] = hi[i] + margin;
+	}
+	/* off screen if all eight corners are beyond the same plane */
+	for (i = 0; i < 8 && code; ++i) {
+	    code &= outcode(m, i & 1 ? h[0] : l[0], i & 2 ? h[1] : l[1],
+			    i & 4 ? h[2] : l[2]);
+	}
+	if (code && !recording) {
+	    ++psr_cxt->culled;
+	    return 1;
+	}
+	if (!pick_current && !lod_error && !scissoring) {
+	    return 0;
+	}
+	known = !window_bounds(m, l, h, b);
+    }
+    if (pick_current) {
+	psr_pick_add(pick_current, b[0], b[1], b[2], b[3]);
+    }
+    if (recording || !known) {
+	return 0;
+    }
+    /* outside the dirty region of a partial redraw */
+    if (scissoring && (b[2] < scissor_box[0] || b[0] > scissor_box[2]
+		       || b[3] < scissor_box[1] || b[1] > scissor_box[3])) {
+	++psr_cxt->culled;
+	return 1;
+    }
+    culled_size = fmaxf(b[2] - b[0], b[3] - b[1]);
+    return 0;
+}
+
+static void flat_mode(int on)
+{
+    if (on == flat) {
+	return;
+    }
+    flat = on;
+    if (flat) {
+	glDisable(GL_DEPTH_TEST);
+    } else {
+	glEnable(GL_DEPTH_TEST);
+    }
+    projection();
+    camera_default();
+}
+
 /******************************************************************** 
  * Shape functions
  ********************************************************************/
 
+/** the slices of a disk part, out of n for the full circle */
+static inline int arc_slices(int n, float sweep)
+{
+    const int s = ceilf(n * fabsf(sweep) / 360);
+
+    return s < 1 ? 1 : (s > n ? n : s);
+}
+
+/** the draw style and the slices of the full circle, see lod.c.  the
+ * full ellipse of ellipse() is cached. */
+static void arc_disk(GLenum style, int n, float start, float stop)
+{
+    if (start == 0 && stop == 360) {
+	lod_disk(quad, n, style, !recording && !recording_shape);
+    } else {
+	gluQuadricDrawStyle(quad, style);
+	/* the fixed detail is for any part */
+	gluPartialDisk(quad, 0, 1,
+		       lod_error > 0 ? arc_slices(n, stop - start) : n, 1,
+		       start, stop - start);
+    }
+}
+
 static int arc(float x, float y, float width, float height, float start,
 	       float stop)
 {
-    float ratio = width / height;
+    const float lo[3] = {x - width / 2, y - height / 2, 0};
+    const float hi[3] = {x + width / 2, y + height / 2, 0};
 
-    height = height / 2;	/* we need radius */
+    if (culled(lo, hi, 0)) {
+	return 0;
+    }
+    gl_flat_load();
 
-    /* set coordinates.  revert y again to get the angle right.
-     * set ratio to get asymmetry disk */
+    /* set coordinates.  revert y again to get the angle right.  the
+     * disk is of radius 1, the scale makes it the ellipse */
     glPushMatrix();
     glTranslatef(x, y, 0);
-    glScalef(ratio, -1, 1);
+    glScalef(width / 2, -height / 2, 1);
 
     if (!dont_fill) {
-	glColor4f(fill_color.r, fill_color.g, fill_color.b, fill_color.a);
-	gluQuadricDrawStyle(quad, GLU_FILL);
-	/* FIXME: hardcode 30 */
-	gluPartialDisk(quad, 0, height, 30, 1, start, stop - start);
+	glColor4ubv(&fill_color.r);
+	arc_disk(GLU_FILL, lod_segments(culled_size / 2, lod_error, 4, 30),
+		 start, stop);
     }
 
     if (!dont_stroke) {
-	glColor4f(stroke_color.r, stroke_color.g, stroke_color.b,
-		  stroke_color.a);
-	gluQuadricDrawStyle(quad, GLU_SILHOUETTE);
-	gluPartialDisk(quad, 0, height, 20, 1, start, stop - start);
+	glColor4ubv(&stroke_color.r);
+	arc_disk(GLU_SILHOUETTE,
+		 lod_segments(culled_size / 2, lod_error, 4, 20), start, stop);
     }
 
     glPopMatrix();		/* restore coordinates */
@@ -118,11 +481,13 @@ static int begin_shape(int mode)
 	psr_error("invalid 'mode' argument.");
 	return -1;
     }
+    curve_count = 0;
+    curve_started = 0;
     return 0;
 }
 
-/** FIXME: don't care about texture yet. */
-static int vertex(float x, float y, float z, float u, float v)
+/** add a vertex as it is, see vertex() */
+static void add_vertex(float x, float y, float z)
 {
     struct vertex *vertex = malloc(sizeof(struct vertex));
     if (!vertex) {
@@ -131,79 +496,414 @@ static int vertex(float x, float y, float z, float u, float v)
     vertex->x = x;
     vertex->y = y;
     vertex->z = z;
-    vertex->gl_list = 0;	/* not a list */
     vertex->stroke = stroke_color;
     vertex->fill = fill_color;
     llist_add_tail(&vertex->list, &vertex_list_head);
+}
+
+/** FIXME: don't care about texture yet. */
+static int vertex(float x, float y, float z, float u, float v)
+{
+    if (flat_cpu()) {
+	affine_apply(&x, &y);
+	z = 0;
+    }
+    add_vertex(x, y, z);
     return 0;
 }
 
+/** the t values of the detail points, 1 / level up to 1 */
 static int bezier_detail(int level)
 {
+    float *t;
+    int i;
+
+    if (level < 1) {
+	psr_error("invalid 'level' argument.");
+	return -1;
+    }
+    t = realloc(bezier_t, level * 5 * sizeof(*t));
+    if (!t) {
+	psr_system_error(errno, "No memory for bezier points.");
+    }
+    bezier_t = t;
+    for (i = 0; i < level; ++i) {
+	bezier_t[i] = (float) (i + 1) / level;
+    }
     bezier_detail_level = level;
     return 0;
 }
 
+/** the segments of the curve under auto_detail(), by Wang's formula:
+ * the polyline is off by at most 3/4 of the largest second difference
+ * of the control points over the square of the segments. */
+static int bezier_segments(const float *p0, const float *p1, const float *p2,
+			   const float *p3)
+{
+    const float *p[4] = {p0, p1, p2, p3};
+    float w[4][2], d = 0;
+    GLfloat m[16];
+    int i, n;
+
+    if (lod_error <= 0 || recording || recording_shape) {
+	return bezier_detail_level;
+    }
+    if (flat_cpu()) {
+	/* window coordinates already */
+	for (i = 0; i < 4; ++i) {
+	    w[i][0] = p[i][0];
+	    w[i][1] = p[i][1];
+	}
+    } else {
+	clip_matrix(m);
+	for (i = 0; i < 4; ++i) {
+	    if (to_window(m, p[i][0], p[i][1], p[i][2], w[i])) {
+		return bezier_detail_level;
+	    }
+	}
+    }
+    for (i = 0; i < 2; ++i) {
+	d = fmaxf(d, hypotf(w[i][0] - 2 * w[i + 1][0] + w[i + 2][0],
+			    w[i][1] - 2 * w[i + 1][1] + w[i + 2][1]));
+    }
+    n = ceilf(sqrtf(0.75f * d / lod_error));
+    return n < 1 ? 1 : (n > bezier_detail_level ? bezier_detail_level : n);
+}
+
+/** the curve is evaluated here rather than with a display list, so it
+ * can be part of a retained shape.  the points come from the kernel of
+ * bezier_point(). */
 static int bezier_vertex(float cx1, float cy1, float cz1,
 			 float cx2, float cy2, float cz2,
 			 float x, float y, float z)
 {
-    struct vertex *last_v, *v;
-    GLfloat ctrlpoints[4][3];
-    int i;
+    const int level = bezier_detail_level;
+    float *t = bezier_t, *px = bezier_t + 2 * level, *py = px + level;
+    float *pz = py + level;
+    struct vertex *last_v;
+    int i, n;
 
-    /* get the last vertex */
-    last_v = llist_entry(vertex_list_head.prev, struct vertex, list);
-    if (!last_v) {
+    if (llist_empty(&vertex_list_head)) {
 	/* if there is none, no way we can draw the curve */
 	psr_error("Set at least one vertex before you call bezier_vertex");
 	return -1;
     }
-    v = malloc(sizeof(struct vertex));
-    if (!v) {
-	psr_system_error(errno, "No memory for new vertex.");
+    /* get the last vertex, it is transformed already.  the curve is
+     * affine invariant, so the other control points can be too. */
+    last_v = llist_entry(vertex_list_head.prev, struct vertex, list);
+    if (flat_cpu()) {
+	affine_apply(&cx1, &cy1);
+	affine_apply(&cx2, &cy2);
+	affine_apply(&x, &y);
+	cz1 = cz2 = z = 0;
     }
-    v->x = x;
-    v->y = y;
-    v->z = z;
-    v->stroke = stroke_color;
-    v->fill = fill_color;
-
-    ctrlpoints[0][0] = last_v->x;
-    ctrlpoints[0][1] = last_v->y;
-    ctrlpoints[0][2] = last_v->z;
-    ctrlpoints[1][0] = cx1;
-    ctrlpoints[1][1] = cy1;
-    ctrlpoints[1][2] = cz1;
-    ctrlpoints[2][0] = cx2;
-    ctrlpoints[2][1] = cy2;
-    ctrlpoints[2][2] = cz2;
-    ctrlpoints[3][0] = x;
-    ctrlpoints[3][1] = y;
-    ctrlpoints[3][2] = z;
-
-    glMap1f(GL_MAP1_VERTEX_3, 0, 1, 3, 4, (GLfloat *) ctrlpoints);
-
-    /* we create a list of this curve for later usage. */
-    v->gl_list = glGenLists(1);
-    if (v->gl_list == 0) {
-	free(v);
-	return glCheckError();
+
+    {
+	const float c1[3] = {cx1, cy1, cz1}, c2[3] = {cx2, cy2, cz2};
+	const float end[3] = {x, y, z};
+
+	n = bezier_segments(&last_v->x, c1, c2, end);
     }
-    glNewList(v->gl_list, GL_COMPILE);
-    for (i = 0; i <= bezier_detail_level; ++i) {
-	glEvalCoord1f((GLfloat) i / bezier_detail_level);
+    if (n < level) {
+	t = bezier_t + level;
+	for (i = 0; i < n; ++i) {
+	    t[i] = (float) (i + 1) / n;
+	}
     }
-    glEndList();
-    llist_add_tail(&v->list, &vertex_list_head);
+    psr_bezier_eval(&last_v->x, &cx1, &cx2, &x, 0, t, n, px, NULL);
+    psr_bezier_eval(&last_v->y, &cy1, &cy2, &y, 0, t, n, py, NULL);
+    psr_bezier_eval(&last_v->z, &cz1, &cz2, &z, 0, t, n, pz, NULL);
+    for (i = 0; i < n; ++i) {
+	add_vertex(px[i], py[i], pz[i]);
+    }
+    return 0;
+}
 
-    return glCheckError();
+/** the draw matrix only changes with the detail or the tightness */
+static void curve_update(void)
+{
+    float basis[16];
+
+    psr_curve_basis(curve_tightness_value, basis);
+    psr_spline_draw_matrix(basis, curve_detail_level, curve_draw);
 }
 
-static int end_shape(int end_mode)
+static int curve_detail(int level)
+{
+    if (level < 1) {
+	psr_error("invalid 'level' argument.");
+	return -1;
+    }
+    curve_detail_level = level;
+    curve_update();
+    return 0;
+}
+
+static int curve_tightness(float tightness)
+{
+    curve_tightness_value = tightness;
+    curve_update();
+    return 0;
+}
+
+/** every curve vertex from the fourth on adds the segment between the
+ * two before it.  the points go right into the vertex list. */
+static int curve_vertex(float x, float y, float z)
+{
+    float *out;
+    int i;
+
+    if (curve_count == 4) {
+	memmove(curve_ctrl, curve_ctrl + 3, 9 * sizeof(*curve_ctrl));
+	curve_count = 3;
+    }
+    curve_ctrl[curve_count * 3] = x;
+    curve_ctrl[curve_count * 3 + 1] = y;
+    curve_ctrl[curve_count * 3 + 2] = z;
+    if (++curve_count < 4) {
+	return 0;
+    }
+    if (curve_points_size < curve_detail_level) {
+	out = realloc(curve_points, curve_detail_level * 3 * sizeof(*out));
+	if (!out) {
+	    psr_system_error(errno, "No memory for curve points.");
+	}
+	curve_points = out;
+	curve_points_size = curve_detail_level;
+    }
+    if (!curve_started) {
+	/* the first segment starts at the second point */
+	vertex(curve_ctrl[3], curve_ctrl[4], curve_ctrl[5], 0, 0);
+	curve_started = 1;
+    }
+    psr_spline_plot(curve_draw, curve_detail_level, curve_ctrl, curve_points);
+    for (i = 0, out = curve_points; i < curve_detail_level; ++i, out += 3) {
+	vertex(out[0], out[1], out[2], 0, 0);
+    }
+    return 0;
+}
+
+/** translucent drawing goes to depthsort.c after
+ * hint(ENABLE_DEPTH_SORT).  not in retained shapes, their display lists
+ * would miss it. */
+static inline int depth_sorting(void)
+{
+    return hints[ENABLE_DEPTH_SORT] && !recording_shape;
+}
+
+/** 1 if any vertex of the shape has a translucent fill, or stroke */
+static int shape_translucent(int fill)
+{
+    struct vertex *pos;
+
+    llist_for_each_entry(pos, &vertex_list_head, list) {
+	if ((fill ? pos->fill.a : pos->stroke.a) < 255) {
+	    return 1;
+	}
+    }
+    return 0;
+}
+
+/** the vertex list as an array, with the fill or the stroke colors.
+ * the array is reused by the next call. */
+static struct stroke_point *shape_points(int fill, int *count)
+{
+    struct stroke_point *p;
+    struct vertex *pos;
+    int n = 0;
+
+    llist_for_each_entry(pos, &vertex_list_head, list) {
+	++n;
+    }
+    if (n > shape_buf_size) {
+	p = realloc(shape_buf, n * sizeof(*p));
+	if (!p) {
+	    psr_system_error(errno, "No memory for the shape.");
+	}
+	shape_buf = p;
+	shape_buf_size = n;
+    }
+    p = shape_buf;
+    llist_for_each_entry(pos, &vertex_list_head, list) {
+	p->x = pos->x;
+	p->y = pos->y;
+	p->z = pos->z;
+	p->color = fill ? pos->fill : pos->stroke;
+	++p;
+    }
+    *count = n;
+    return shape_buf;
+}
+
+/** draw the vertex list in mode, all vertices in one array */
+static void draw_points(GLenum mode, int fill)
+{
+    struct stroke_point *p;
+    int n;
+
+    p = shape_points(fill, &n);
+    glEnableClientState(GL_VERTEX_ARRAY);
+    glEnableClientState(GL_COLOR_ARRAY);
+    /* the 2D mode only needs x and y */
+    glVertexPointer(flat ? 2 : 3, GL_FLOAT, sizeof(*p), &p->x);
+    glColorPointer(4, GL_UNSIGNED_BYTE, sizeof(*p), &p->color);
+    glDrawArrays(mode, 0, n);
+    glDisableClientState(GL_COLOR_ARRAY);
+    glDisableClientState(GL_VERTEX_ARRAY);
+}
+
+/** the fill of the shape as triangles for depthsort.c */
+static void sort_fill(void)
+{
+    struct stroke_point *p;
+    int n, i;
+
+    p = shape_points(1, &n);
+    depth_sort_begin();
+    switch (glmode) {
+    case GL_TRIANGLES:
+	for (i = 0; i + 2 < n; i += 3) {
+	    depth_sort_triangle(&p[i], &p[i + 1], &p[i + 2]);
+	}
+	break;
+    case GL_TRIANGLE_STRIP:
+	for (i = 0; i + 2 < n; ++i) {
+	    depth_sort_triangle(&p[i], &p[i + 1], &p[i + 2]);
+	}
+	break;
+    case GL_TRIANGLE_FAN:
+    case GL_POLYGON:
+	for (i = 1; i + 1 < n; ++i) {
+	    depth_sort_triangle(&p[0], &p[i], &p[i + 1]);
+	}
+	break;
+    case GL_QUADS:
+	for (i = 0; i + 3 < n; i += 4) {
+	    depth_sort_triangle(&p[i], &p[i + 1], &p[i + 2]);
+	    depth_sort_triangle(&p[i], &p[i + 2], &p[i + 3]);
+	}
+	break;
+    case GL_QUAD_STRIP:
+	for (i = 0; i + 3 < n; i += 2) {
+	    depth_sort_triangle(&p[i], &p[i + 1], &p[i + 3]);
+	    depth_sort_triangle(&p[i], &p[i + 3], &p[i + 2]);
+	}
+	break;
+    }
+}
+
+/** the outline of every primitive of the shape, tessellated by
+ * stroke.c and drawn in one go, or handed to depthsort.c */
+static void tessellate_stroke(int sort)
+{
+    struct stroke_point *p, q[4];
+    int n, i;
+
+    p = shape_points(0, &n);
+    stroke_set(flat_cpu() ? stroke_width * affine_scale() : stroke_width,
+	       stroke_join_mode, stroke_cap_mode);
+    switch (glmode) {
+    case GL_POINTS:
+	for (i = 0; i < n; ++i) {
+	    stroke_dot(&p[i]);
+	}
+	break;
+    case GL_LINES:
+	for (i = 0; i + 1 < n; i += 2) {
+	    stroke_polyline(&p[i], 2, 0);
+	}
+	break;
+    case GL_LINE_STRIP:
+	stroke_polyline(p, n, 0);
+	break;
+    case GL_LINE_LOOP:
+	stroke_polyline(p, n, 1);
+	break;
+    case GL_TRIANGLES:
+	for (i = 0; i + 2 < n; i += 3) {
+	    stroke_polyline(&p[i], 3, 1);
+	}
+	break;
+    case GL_TRIANGLE_STRIP:
+	for (i = 0; i + 2 < n; ++i) {
+	    stroke_polyline(&p[i], 3, 1);
+	}
+	break;
+    case GL_TRIANGLE_FAN:
+	for (i = 1; i + 1 < n; ++i) {
+	    q[0] = p[0];
+	    q[1] = p[i];
+	    q[2] = p[i + 1];
+	    stroke_polyline(q, 3, 1);
+	}
+	break;
+    case GL_QUADS:
+	for (i = 0; i + 3 < n; i += 4) {
+	    stroke_polyline(&p[i], 4, 1);
+	}
+	break;
+    case GL_QUAD_STRIP:
+	for (i = 0; i + 3 < n; i += 2) {
+	    q[0] = p[i];
+	    q[1] = p[i + 1];
+	    q[2] = p[i + 3];
+	    q[3] = p[i + 2];
+	    stroke_polyline(q, 4, 1);
+	}
+	break;
+    }
+    if (sort) {
+	stroke_sort();
+    } else {
+	stroke_flush();
+    }
+}
+
+static void free_vertices(void)
 {
     struct vertex *pos, *n;
 
+    llist_for_each_entry_safe(pos, n, &vertex_list_head, list) {
+	llist_del(&pos->list);
+	free(pos);
+    }
+}
+
+/** the bounding box of the vertex list */
+static int shape_culled(void)
+{
+    struct vertex *pos;
+    float lo[3], hi[3];
+
+    if (llist_empty(&vertex_list_head)) {
+	return 0;
+    }
+    pos = llist_entry(vertex_list_head.next, struct vertex, list);
+    lo[0] = hi[0] = pos->x;
+    lo[1] = hi[1] = pos->y;
+    lo[2] = hi[2] = pos->z;
+    llist_for_each_entry(pos, &vertex_list_head, list) {
+	lo[0] = fminf(lo[0], pos->x);
+	hi[0] = fmaxf(hi[0], pos->x);
+	lo[1] = fminf(lo[1], pos->y);
+	hi[1] = fmaxf(hi[1], pos->y);
+	lo[2] = fminf(lo[2], pos->z);
+	hi[2] = fmaxf(hi[2], pos->z);
+    }
+    return culled(lo, hi, flat_cpu());
+}
+
+static int end_shape(int end_mode)
+{
+    const int sorting = depth_sorting();
+    int sort_stroke;
+
+    if (shape_culled()) {
+	free_vertices();
+	return 0;
+    }
+    flat_unload();
+
     /* we fill the shape first, then draw the edges */
 
     /* do fill */
@@ -215,21 +915,12 @@ static int end_shape(int end_mode)
 	if (dont_fill) {
 	    break;
 	}
-	glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
-	glBegin(glmode);
-	llist_for_each_entry(pos, &vertex_list_head, list) {
-	    glColor4f(pos->fill.r, pos->fill.g, pos->fill.b, pos->fill.a);
-	    if (pos->gl_list) {
-		glCallList(pos->gl_list);
-	    } else {
-		glVertex3f(pos->x, pos->y, pos->z);
-		psr_debug
-		    ("fill point: (%f, %f, %f) color: (%f, %f, %f, %f)",
-		     pos->x, pos->y, pos->z, pos->fill.r, pos->fill.g,
-		     pos->fill.b, pos->fill.a);
-	    }
+	if (sorting && shape_translucent(1)) {
+	    sort_fill();
+	    break;
 	}
-	glEnd();
+	glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
+	draw_points(glmode, 1);
     }
     if (glmode == GL_POLYGON) {
 	/* depends on CLOSE or not */
@@ -240,43 +931,61 @@ static int end_shape(int end_mode)
 	}
     }
 
-    /* do stroke */
-    if (!dont_stroke) {
+    /* do stroke.  translucent lines are sorted as triangles too */
+    sort_stroke = !dont_stroke && sorting && shape_translucent(0);
+    if (!dont_stroke && (stroke_width > 1 || sort_stroke)) {
+	tessellate_stroke(sort_stroke);
+    } else if (!dont_stroke) {
 	glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
-	glBegin(glmode);
-	llist_for_each_entry(pos, &vertex_list_head, list) {
-	    glColor4f(pos->stroke.r, pos->stroke.g, pos->stroke.b,
-		      pos->stroke.a);
-	    if (pos->gl_list) {
-		glCallList(pos->gl_list);
-	    } else {
-		glVertex3f(pos->x, pos->y, pos->z);
-		psr_debug
-		    ("stroke point: (%f, %f, %f) color: (%f, %f, %f, %f)",
-		     pos->x, pos->y, pos->z, pos->stroke.r, pos->stroke.g,
-		     pos->stroke.b, pos->stroke.a);
-	    }
-	}
-	glEnd();
+	draw_points(glmode, 0);
     }
 
     /* release the resource */
-    llist_for_each_entry_safe(pos, n, &vertex_list_head, list) {
-	if (pos->gl_list) {
-	    glDeleteLists(pos->gl_list, 1);
+    free_vertices();
+    return glCheckError();
+}
+
+/** the faces of box() as triangles for depthsort.c */
+static void sort_box(float w, float h, float d)
+{
+    /* back, left, right, front, top, bottom */
+    static const signed char faces[24][3] = {
+	{-1, -1, -1}, {-1, 1, -1}, {1, 1, -1}, {1, -1, -1},
+	{-1, -1, -1}, {-1, -1, 1}, {-1, 1, 1}, {-1, 1, -1},
+	{1, -1, -1}, {1, -1, 1}, {1, 1, 1}, {1, 1, -1},
+	{-1, -1, 1}, {-1, 1, 1}, {1, 1, 1}, {1, -1, 1},
+	{-1, -1, -1}, {-1, -1, 1}, {1, -1, 1}, {1, -1, -1},
+	{-1, 1, -1}, {-1, 1, 1}, {1, 1, 1}, {1, 1, -1},
+    };
+    struct stroke_point p[4];
+    int i, j;
+
+    depth_sort_begin();
+    for (i = 0; i < 24; i += 4) {
+	for (j = 0; j < 4; ++j) {
+	    p[j].x = faces[i + j][0] * w;
+	    p[j].y = faces[i + j][1] * h;
+	    p[j].z = faces[i + j][2] * d;
+	    p[j].color = fill_color;
 	}
-	llist_del(&pos->list);
-	free(pos);
+	depth_sort_triangle(&p[0], &p[1], &p[2]);
+	depth_sort_triangle(&p[0], &p[2], &p[3]);
     }
-    return glCheckError();
 }
 
 static int box(float width, float height, float depth)
 {
     const float w = width/2, h = height/2, d = depth/2;
+    const float lo[3] = {-w, -h, -d}, hi[3] = {w, h, d};
 
-    if (!dont_fill) {
-	glColor4f(fill_color.r, fill_color.g, fill_color.b, fill_color.a);
+    if (culled(lo, hi, 0)) {
+	return 0;
+    }
+    gl_flat_load();
+    if (!dont_fill && fill_color.a < 255 && depth_sorting()) {
+	sort_box(w, h, d);
+    } else if (!dont_fill) {
+	glColor4ubv(&fill_color.r);
 	glBegin(GL_QUADS);
 	/* back */
 	glVertex3f(-w, -h, -d);
@@ -311,7 +1020,10 @@ static int box(float width, float height, float depth)
 	glEnd();
     }
     if (!dont_stroke) {
-	glColor4f(stroke_color.r, stroke_color.g, stroke_color.b, stroke_color.a);
+	glColor4ubv(&stroke_color.r);
+	/* the edges over the faces; the 2D mode keeps its depth test off,
+	 * also when a retained shape is replayed there */
+	glPushAttrib(GL_ENABLE_BIT);
 	glDisable(GL_DEPTH_TEST);
 	glBegin(GL_LINE_LOOP);
 	glVertex3f(-w, -h, -d);
@@ -335,53 +1047,230 @@ static int box(float width, float height, float depth)
 	glVertex3f(-w,  h,  d);
 	glVertex3f(-w,  h, -d);
 	glEnd();
-	glEnable(GL_DEPTH_TEST);
+	glPopAttrib();
+    }
+    return glCheckError();
+}
+
+static int sphere(float radius)
+{
+    const float lo[3] = {-radius, -radius, -radius};
+    const float hi[3] = {radius, radius, radius};
+
+    if (culled(lo, hi, 0)) {
+	return 0;
+    }
+    gl_flat_load();
+    if (!dont_fill) {
+	glColor4ubv(&fill_color.r);
+	glPushMatrix();
+	glScalef(radius, radius, radius);
+	lod_sphere(quad, lod_segments(culled_size / 2, lod_error, 4,
+				      sphere_detail_level),
+		   !recording && !recording_shape);
+	glPopMatrix();
+    }
+    return 0;
+}
+
+static int sphere_detail(int n)
+{
+    sphere_detail_level = n;
+    return 0;
+}
+
+/** the detail levels become upper bounds, see lod.c */
+static int auto_detail(float max_error)
+{
+    lod_error = max_error;
+    return 0;
+}
+
+/** lines wider than a pixel are tessellated, glLineWidth() is left for
+ * arc() and sphere() */
+static int stroke_weight(float width)
+{
+    stroke_width = width;
+    glPointSize(width);
+    glLineWidth(width);
+    return glCheckError();
+}
+
+static int stroke_join(int join)
+{
+    switch (join) {
+    case MITER:
+    case BEVEL:
+    case ROUND:
+	break;
+    default:
+	psr_error("invalid 'join' argument.");
+	return -1;
+    }
+    stroke_join_mode = join;
+    return 0;
+}
+
+static int stroke_cap(int cap)
+{
+    switch (cap) {
+    case SQUARE:
+    case PROJECT:
+    case ROUND:
+	break;
+    default:
+	psr_error("invalid 'cap' argument.");
+	return -1;
+    }
+    stroke_cap_mode = cap;
+    return 0;
+}
+
+/** smooth() is multisampling, see msaa.c.  2 samples unless
+ * hint(ENABLE_OPENGL_4X_SMOOTH). */
+static int smooth(void)
+{
+    smoothing = 1;
+    return gl_msaa_set(hints[ENABLE_OPENGL_4X_SMOOTH] ? 4 : 2);
+}
+
+static int no_smooth(void)
+{
+    smoothing = 0;
+    return gl_msaa_set(0);
+}
+
+static int hint(int which)
+{
+    const int on = which >= 0;
+
+    if (!on) {
+	which = -which;
+    }
+    hints[which] = on;
+    switch (which) {
+    case ENABLE_OPENGL_2X_SMOOTH:
+	hints[ENABLE_OPENGL_4X_SMOOTH] = !on;
+	/* fall through */
+    case ENABLE_OPENGL_4X_SMOOTH:
+	if (smoothing) {
+	    return smooth();
+	}
+	break;
+    case ENABLE_DEPTH_SORT:
+	if (!on) {
+	    depth_sort_flush();
+	}
+	break;
+    case DISABLE_DEPTH_TEST:
+	flat_mode(on);
+	break;
+    default:
+	break;
+    }
+    return glCheckError();
+}
+
+static int pick_id(int id)
+{
+    pick_current = id;
+    return 0;
+}
+
+
+/******************************************************************** 
+ * Retained shape functions
+ ********************************************************************/
+
+/** a retained shape is compiled into a display list, which the GL keeps
+ * on its side, so its vertices are uploaded only once.  the handles come
+ * from the caller. */
+static int record_segment(void);
+
+static int create_shape(int handle)
+{
+    GLuint list;
+
+    if (recording_shape) {
+	psr_error("create_shape() while shape %d is recorded.",
+		  recording_shape);
+	return -1;
+    }
+    if (recording) {
+	glEndList();
+    }
+    if (handle >= shape_lists_size) {
+	int size = shape_lists_size ? shape_lists_size : 16;
+	GLuint *lists;
+
+	while (size <= handle) {
+	    size *= 2;
+	}
+	lists = realloc(shape_lists, size * sizeof(*lists));
+	if (!lists) {
+	    psr_system_error(errno, "No memory for shapes.");
+	}
+	memset(lists + shape_lists_size, 0,
+	       (size - shape_lists_size) * sizeof(*lists));
+	shape_lists = lists;
+	shape_lists_size = size;
+    }
+    list = glGenLists(1);
+    if (list == 0) {
+	return glCheckError();
+    }
+    if (shape_lists[handle]) {
+	glDeleteLists(shape_lists[handle], 1);
     }
+    shape_lists[handle] = list;
+    memcpy(flat_shape_saved, affine, sizeof(flat_shape_saved));
+    recording_shape = handle;
+    glNewList(list, GL_COMPILE);
     return glCheckError();
 }
 
-static int sphere(float radius)
+static int end_shape_record(void)
 {
-    if (!dont_fill) {
-	glColor4f(fill_color.r, fill_color.g, fill_color.b, fill_color.a);
-	gluQuadricDrawStyle(quad, GLU_FILL);
-	gluSphere(quad, radius, sphere_detail_level, sphere_detail_level);
+    if (!recording_shape) {
+	psr_error("end_shape_record() without create_shape().");
+	return -1;
     }
-    return 0;
-}
-
-static int sphere_detail(int n)
-{
-    sphere_detail_level = n;
-    return 0;
+    glEndList();
+    recording_shape = 0;
+    memcpy(affine, flat_shape_saved, sizeof(flat_shape_saved));
+    if (recording) {
+	return record_segment();
+    }
+    return glCheckError();
 }
 
-static int stroke_weight(float width)
+static inline int valid_shape(int handle)
 {
-    glPointSize(width);
-    glLineWidth(width);
-    return glCheckError();
+    return handle > 0 && handle < shape_lists_size && shape_lists[handle];
 }
 
-static int smooth(void)
+/** transforms inside the shape do not leak out of it */
+static int shape(int handle)
 {
-    glHint(GL_POINT_SMOOTH_HINT, GL_NICEST);
-    glHint(GL_LINE_SMOOTH_HINT, GL_NICEST);
-    glHint(GL_POLYGON_SMOOTH_HINT, GL_NICEST);
-    glEnable(GL_POINT_SMOOTH);
-    glEnable(GL_LINE_SMOOTH);
-    glEnable(GL_POLYGON_SMOOTH);
+    if (!valid_shape(handle)) {
+	psr_error("invalid shape %d", handle);
+	return -1;
+    }
+    gl_flat_load();
+    glPushMatrix();
+    glCallList(shape_lists[handle]);
+    glPopMatrix();
     return glCheckError();
 }
 
-static int no_smooth(void)
+static int free_shape(int handle)
 {
-    glHint(GL_POINT_SMOOTH_HINT, GL_FASTEST);
-    glHint(GL_LINE_SMOOTH_HINT, GL_FASTEST);
-    glHint(GL_POLYGON_SMOOTH_HINT, GL_FASTEST);
-    glDisable(GL_POINT_SMOOTH);
-    glDisable(GL_LINE_SMOOTH);
-    glDisable(GL_POLYGON_SMOOTH);
+    if (!valid_shape(handle)) {
+	psr_error("invalid shape %d", handle);
+	return -1;
+    }
+    glDeleteLists(shape_lists[handle], 1);
+    shape_lists[handle] = 0;
     return glCheckError();
 }
 
@@ -390,16 +1279,34 @@ static int no_smooth(void)
  * Output functions
  ********************************************************************/
 
+/** read the window into data in the format of save(), if it has room
+ * for it.  width and height are set either way. */
+int gl_read_window(void *data, size_t size, int *width, int *height)
+{
+    *width = g_width;
+    *height = g_height;
+    if (!data || (size_t) 3 * g_width * g_height > size) {
+	return -1;
+    }
+    gl_msaa_read_begin();
+    /* the rows are packed, whatever the width */
+    glPixelStorei(GL_PACK_ALIGNMENT, 1);
+    glReadPixels(0, 0, g_width, g_height, GL_RGB, GL_UNSIGNED_BYTE, data);
+    glPixelStorei(GL_PACK_ALIGNMENT, 4);
+    gl_msaa_read_end();
+    return glCheckError();
+}
+
 /** notice: since we don't deal with file format here, we return the
  * memory block for the upper level to handle.  upper level must free
  * this block of memory. */
 static int save(struct psr_image *img)
 {
-    int r;
-    void *saved_image = malloc(sizeof(GLubyte) * 3 * g_width * g_height);
-    glReadPixels(0, 0, g_width, g_height, GL_RGB, GL_UNSIGNED_BYTE,
-		 saved_image);
-    r = glCheckError();
+    const size_t size = sizeof(GLubyte) * 3 * g_width * g_height;
+    void *saved_image = malloc(size);
+    int r, width, height;
+
+    r = gl_read_window(saved_image, size, &width, &height);
     if (r) {
 	/* something wrong */
 	free(saved_image);
@@ -415,44 +1322,165 @@ static int save(struct psr_image *img)
     return 0;
 }
 
+/** after a partial redraw only the region is read into img, if it has
+ * the size of the window.  otherwise it is saved again. */
+int gl_save_update(struct psr_image *img)
+{
+    const int *s = scissor_box;
+
+    if (!partial || !img->data || img->width != g_width
+	|| img->height != g_height) {
+	free(img->data);
+	img->data = NULL;
+	return save(img);
+    }
+    gl_msaa_read_begin();
+    glPixelStorei(GL_PACK_ALIGNMENT, 1);
+    glPixelStorei(GL_PACK_ROW_LENGTH, g_width);
+    glPixelStorei(GL_PACK_SKIP_PIXELS, s[0]);
+    glPixelStorei(GL_PACK_SKIP_ROWS, g_height - s[3]);
+    glReadPixels(s[0], g_height - s[3], s[2] - s[0], s[3] - s[1], GL_RGB,
+		 GL_UNSIGNED_BYTE, img->data);
+    glPixelStorei(GL_PACK_SKIP_ROWS, 0);
+    glPixelStorei(GL_PACK_SKIP_PIXELS, 0);
+    glPixelStorei(GL_PACK_ROW_LENGTH, 0);
+    glPixelStorei(GL_PACK_ALIGNMENT, 4);
+    gl_msaa_read_end();
+    return glCheckError();
+}
+
+/** the next redraw() draws only into the union of these, in window
+ * coordinates */
+static int dirty_rect(float x, float y, float width, float height)
+{
+    if (!dirty) {
+	dirty_box[0] = x;
+	dirty_box[1] = y;
+	dirty_box[2] = x + width;
+	dirty_box[3] = y + height;
+	dirty = 1;
+	return 0;
+    }
+    dirty_box[0] = fminf(dirty_box[0], x);
+    dirty_box[1] = fminf(dirty_box[1], y);
+    dirty_box[2] = fmaxf(dirty_box[2], x + width);
+    dirty_box[3] = fmaxf(dirty_box[3], y + height);
+    return 0;
+}
+
 
 /******************************************************************** 
  * Transform functions
  ********************************************************************/
 
+/* in the 2D mode the transforms go to the affine matrix, and to GL
+ * only inside a retained shape */
+
 static int push_matrix(void)
 {
-    glPushMatrix();
-    return glCheckError();
+    if (!flat) {
+	glPushMatrix();
+	return glCheckError();
+    }
+    if (flat_top + 1 == FLAT_STACK_DEPTH) {
+	psr_error("push_matrix() too deep.");
+	return -1;
+    }
+    memcpy(flat_stack[flat_top + 1], affine, sizeof(flat_stack[0]));
+    affine = flat_stack[++flat_top];
+    if (recording_shape) {
+	glPushMatrix();
+    }
+    return 0;
 }
 
 static int pop_matrix(void)
 {
-    glPopMatrix();
-    return glCheckError();
+    if (!flat) {
+	glPopMatrix();
+	return glCheckError();
+    }
+    if (flat_top == 0) {
+	psr_error("pop_matrix() without push_matrix().");
+	return -1;
+    }
+    affine = flat_stack[--flat_top];
+    if (flat_gl == FLAT_GL_CURRENT) {
+	flat_gl = FLAT_GL_STALE;
+    }
+    if (recording_shape) {
+	glPopMatrix();
+    }
+    return 0;
 }
 
 static int translate(float x, float y, float z)
 {
-    glTranslatef(x, y, z);
-    return glCheckError();
+    const float n[6] = {1, 0, 0, 1, x, y};
+
+    if (!flat) {
+	glTranslatef(x, y, z);
+	return glCheckError();
+    }
+    affine_mult(n);
+    if (recording_shape) {
+	glTranslatef(x, y, 0);
+    }
+    return 0;
 }
 
 static int rotate(float angle, float x, float y, float z)
 {
-    glRotatef(angle * 180 / M_PI, x, y, z);
-    return glCheckError();
+    float n[6];
+
+    if (!flat) {
+	glRotatef(angle * 180 / M_PI, x, y, z);
+	return glCheckError();
+    }
+    if (x != 0 || y != 0 || z == 0) {
+	psr_warn("only rotations around z in 2D mode.");
+	return 0;
+    }
+    if (z < 0) {
+	angle = -angle;
+    }
+    n[0] = n[3] = cosf(angle);
+    n[1] = sinf(angle);
+    n[2] = -n[1];
+    n[4] = n[5] = 0;
+    affine_mult(n);
+    if (recording_shape) {
+	glRotatef(angle * 180 / M_PI, 0, 0, 1);
+    }
+    return 0;
 }
 
 static int scale(float x, float y, float z)
 {
-    glScalef(x, y, z);
-    return glCheckError();
+    const float n[6] = {x, 0, 0, y, 0, 0};
+
+    if (!flat) {
+	glScalef(x, y, z);
+	return glCheckError();
+    }
+    affine_mult(n);
+    if (recording_shape) {
+	glScalef(x, y, 1);
+    }
+    return 0;
 }
 
 static int print_matrix(void)
 {
     GLfloat matrix[16];
+
+    if (flat) {
+	printf("%10.4f, %10.4f, %10.4f, \n"
+	       "%10.4f, %10.4f, %10.4f, \n",
+	       affine[0], affine[2], affine[4],
+	       affine[1], affine[3], affine[5]);
+	return 0;
+    }
     glGetFloatv(GL_MODELVIEW_MATRIX, (GLfloat *) matrix);
     printf("%10.4f, %10.4f, %10.4f, %10.4f, \n"
 	   "%10.4f, %10.4f, %10.4f, %10.4f, \n"
@@ -475,12 +1503,28 @@ static int apply_matrix(float n11, float n12, float n13, float n14,
 			n13, n23, n33, n43,
 			n14, n24, n34, n44};
 
+    if (flat) {
+	/* the x, y part */
+	const float n[6] = {n11, n21, n12, n22, n14, n24};
+
+	affine_mult(n);
+	if (!recording_shape) {
+	    return 0;
+	}
+    }
     glMultMatrixf((GLfloat *) matrix);
     return glCheckError();
 }
 
 static int reset_matrix(void)
 {
+    if (flat) {
+	affine_identity(affine);
+	if (flat_gl == FLAT_GL_CURRENT) {
+	    flat_gl = FLAT_GL_STALE;
+	}
+	return 0;
+    }
     glLoadIdentity();
     glScalef(1, -1, 1);
     return glCheckError();
@@ -494,10 +1538,7 @@ static int reset_matrix(void)
 static int stroke(float r, float g, float b, float a)
 {
     dont_stroke = 0;
-    stroke_color.r = r;
-    stroke_color.g = g;
-    stroke_color.b = b;
-    stroke_color.a = a;
+    stroke_color = rgba8(r, g, b, a);
     return 0;
 }
 
@@ -510,10 +1551,7 @@ static int no_stroke(void)
 static int fill(float r, float g, float b, float a)
 {
     dont_fill = 0;
-    fill_color.r = r;
-    fill_color.g = g;
-    fill_color.b = b;
-    fill_color.a = a;
+    fill_color = rgba8(r, g, b, a);
     return 0;
 }
 
@@ -526,7 +1564,143 @@ static int no_fill(void)
 static int background(float r, float g, float b, float a)
 {
     glClearColor(r, g, b, a);
-    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    /* nothing to clear in the depth buffer in 2D mode */
+    glClear(flat ? GL_COLOR_BUFFER_BIT
+	    : GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    return glCheckError();
+}
+
+
+/******************************************************************** 
+ * Graphics functions
+ ********************************************************************/
+
+/* begin_draw() points everything at a target: its size stands in for the
+ * window's, with a fresh camera.  the window state is kept here and put
+ * back by end_draw().  in gl_record() the target is drawn once, between
+ * two display lists of the recording, and a replay leaves it alone. */
+static __thread int drawing_target = 0;
+static __thread struct {
+    GLint viewport[4];
+    GLfloat projection[16], modelview[16];
+    int width, height;
+    GLdouble depth;
+    float flat_stack[FLAT_STACK_DEPTH][6];
+    int flat_top, flat_gl;
+    int scissoring, pick_current;
+    int recording;
+} window;
+
+/** the target is made between two display lists of gl_record(), its
+ * clear isn't replayed */
+static int create_graphics(int handle, int width, int height)
+{
+    int r;
+
+    if (recording_shape) {
+	psr_error("create_graphics() while shape %d is recorded.",
+		  recording_shape);
+	return -1;
+    }
+    if (recording) {
+	glEndList();
+    }
+    r = gl_graphics_create(handle, width, height);
+    if (recording && record_segment()) {
+	return -1;
+    }
+    return r;
+}
+
+static int free_graphics(int handle)
+{
+    return gl_graphics_free(handle);
+}
+
+static int begin_draw(int handle)
+{
+    int width, height;
+
+    if (recording_shape) {
+	psr_error("begin_draw() while shape %d is recorded.",
+		  recording_shape);
+	return -1;
+    }
+    if (drawing_target) {
+	psr_error("begin_draw() while drawing into %d.", drawing_target);
+	return -1;
+    }
+    depth_sort_flush();
+    if (recording) {
+	glEndList();
+    }
+    glGetIntegerv(GL_VIEWPORT, window.viewport);
+    glGetFloatv(GL_PROJECTION_MATRIX, window.projection);
+    glGetFloatv(GL_MODELVIEW_MATRIX, window.modelview);
+    if (gl_graphics_bind(handle, &width, &height)) {
+	if (recording) {
+	    record_segment();
+	}
+	return -1;
+    }
+    drawing_target = handle;
+    window.recording = recording;
+    recording = 0;
+    window.width = g_width;
+    window.height = g_height;
+    window.depth = g_depth;
+    memcpy(window.flat_stack, flat_stack, sizeof(flat_stack));
+    window.flat_top = flat_top;
+    window.flat_gl = flat_gl;
+    window.scissoring = scissoring;
+    window.pick_current = pick_current;
+
+    /* the dirty region and the pick ids are the window's */
+    if (scissoring) {
+	glDisable(GL_SCISSOR_TEST);
+	scissoring = 0;
+    }
+    pick_current = 0;
+    g_width = width;
+    g_height = height;
+    g_depth = height / 2 / 0.577350269;	/* tan(30 deg) */
+    glViewport(0, 0, width, height);
+    projection();
+    camera_default();
+    return glCheckError();
+}
+
+static int end_draw(void)
+{
+    if (!drawing_target) {
+	psr_error("end_draw() without begin_draw().");
+	return -1;
+    }
+    depth_sort_flush();
+    gl_graphics_unbind();
+    drawing_target = 0;
+    g_width = window.width;
+    g_height = window.height;
+    g_depth = window.depth;
+    glViewport(window.viewport[0], window.viewport[1], window.viewport[2],
+	       window.viewport[3]);
+    memcpy(flat_stack, window.flat_stack, sizeof(flat_stack));
+    flat_top = window.flat_top;
+    affine = flat_stack[flat_top];
+    flat_gl = window.flat_gl;
+    glMatrixMode(GL_PROJECTION);
+    glLoadMatrixf(window.projection);
+    glMatrixMode(GL_MODELVIEW);
+    glLoadMatrixf(window.modelview);
+    if (window.scissoring) {
+	glEnable(GL_SCISSOR_TEST);
+	scissoring = 1;
+    }
+    pick_current = window.pick_current;
+    if (window.recording) {
+	recording = 1;
+	return record_segment();
+    }
     return glCheckError();
 }
 
@@ -535,11 +1709,119 @@ static int background(float r, float g, float b, float a)
  * Image functions
  ********************************************************************/
 
+/** the blending of a layer_blend() mode, 0 if it has one */
+static int blend_mode(int mode)
+{
+    switch (mode) {
+    case REPLACE:
+	glDisable(GL_BLEND);
+	return 0;
+    case BLEND:
+	glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+	break;
+    case ADD:
+	glBlendFunc(GL_SRC_ALPHA, GL_ONE);
+	break;
+    case SUBTRACT:
+	glBlendEquation(GL_FUNC_REVERSE_SUBTRACT);
+	glBlendFunc(GL_SRC_ALPHA, GL_ONE);
+	break;
+    case LIGHTEST:
+	glBlendEquation(GL_MAX);
+	break;
+    case DARKEST:
+	glBlendEquation(GL_MIN);
+	break;
+    case MULTIPLY:
+	glBlendFunc(GL_DST_COLOR, GL_ONE_MINUS_SRC_ALPHA);
+	break;
+    case SCREEN:
+	glBlendFunc(GL_ONE, GL_ONE_MINUS_SRC_COLOR);
+	break;
+    default:
+	psr_error("blend mode %d not supported.", mode);
+	return -1;
+    }
+    glEnable(GL_BLEND);
+    return 0;
+}
+
+/** the texture of a create_graphics() target as a quad, in the
+ * convention of image(): x, y is the lower left corner in the window */
+static int texture_quad(int handle, float x, float y, float width,
+			float height, int mode, float opacity)
+{
+    GLuint texture;
+    int w, h, r;
+
+    texture = gl_graphics_texture(handle, &w, &h);
+    if (!texture) {
+	return -1;
+    }
+    if (width == 0 || height == 0) {
+	width = w;
+	height = h;
+    }
+    /* whatever is sorted so far is behind it */
+    depth_sort_flush();
+    glPushAttrib(GL_ENABLE_BIT | GL_TEXTURE_BIT | GL_COLOR_BUFFER_BIT
+		 | GL_CURRENT_BIT);
+    r = blend_mode(mode);
+    if (r) {
+	glPopAttrib();
+	return r;
+    }
+    glDisable(GL_DEPTH_TEST);
+    glEnable(GL_TEXTURE_2D);
+    glBindTexture(GL_TEXTURE_2D, texture);
+    glTexEnvi(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_MODULATE);
+    glColor4f(1, 1, 1, opacity);
+
+    glPushMatrix();
+    glMatrixMode(GL_PROJECTION);
+    glPushMatrix();
+    glLoadIdentity();
+    gluOrtho2D(0, g_width, 0, g_height);
+    glMatrixMode(GL_MODELVIEW);
+    glLoadIdentity();
+    glBegin(GL_QUADS);
+    glTexCoord2f(0, 0);
+    glVertex2f(x, y);
+    glTexCoord2f(1, 0);
+    glVertex2f(x + width, y);
+    glTexCoord2f(1, 1);
+    glVertex2f(x + width, y + height);
+    glTexCoord2f(0, 1);
+    glVertex2f(x, y + height);
+    glEnd();
+    glPopMatrix();
+    glMatrixMode(GL_PROJECTION);
+    glPopMatrix();
+    glMatrixMode(GL_MODELVIEW);
+
+    glBindTexture(GL_TEXTURE_2D, 0);
+    glPopAttrib();
+    return glCheckError();
+}
+
+static int image_graphics(int handle, float x, float y, float width,
+			  float height)
+{
+    return texture_quad(handle, x, y, width, height, BLEND, 1);
+}
+
+/** a layer onto the whole window, see layer.c */
+static int composite(int handle, int mode, float opacity)
+{
+    return texture_quad(handle, 0, 0, g_width, g_height, mode, opacity);
+}
+
 static int image(struct psr_image *img, float x, float y, float width,
 		 float height)
 {
     glPushMatrix();
     glMatrixMode(GL_PROJECTION);
+    glPushMatrix();
     glLoadIdentity();
     gluOrtho2D(0, g_width, 0, g_height);
     glMatrixMode(GL_MODELVIEW);
@@ -556,6 +1838,9 @@ static int image(struct psr_image *img, float x, float y, float width,
 		     img->data);
     }
     glPopMatrix();
+    glMatrixMode(GL_PROJECTION);
+    glPopMatrix();
+    glMatrixMode(GL_MODELVIEW);
     return glCheckError();
 }
 
@@ -566,6 +1851,10 @@ static int image(struct psr_image *img, float x, float y, float width,
 
 static int camera_default(void)
 {
+    if (flat) {
+	flat_reset();
+	return glCheckError();
+    }
     glLoadIdentity();
     /* flip y-axis to match with the processing coordinate */
     glScalef(1, -1, 1);
@@ -579,6 +1868,10 @@ static int camera(float eye_x, float eye_y, float eye_z,
 		  float center_x, float center_y, float center_z,
 		  float up_x, float up_y, float up_z)
 {
+    if (flat) {
+	psr_warn("camera() is ignored in 2D mode.");
+	return 0;
+    }
     glLoadIdentity();
     gluLookAt(eye_x, -eye_y, eye_z,
 	      center_x, -center_y, center_z,
@@ -589,6 +1882,10 @@ static int camera(float eye_x, float eye_y, float eye_z,
 
 static int begin_camera(void)
 {
+    if (flat) {
+	psr_warn("begin_camera() is ignored in 2D mode.");
+	return 0;
+    }
     /* save the current modelview matrix */
     glGetFloatv(GL_MODELVIEW_MATRIX, (GLfloat *) saved_modelview);
     glLoadIdentity();
@@ -601,6 +1898,10 @@ static int begin_camera(void)
 static int end_camera(void)
 {
     GLfloat camera_view[16];
+
+    if (flat) {
+	return 0;
+    }
     /* invert y offset */
     glGetFloatv(GL_MODELVIEW_MATRIX, (GLfloat *) camera_view);
     camera_view[13] = -camera_view[13];
@@ -614,6 +1915,10 @@ static int end_camera(void)
 static int ortho(float left, float right, float bottom, float top,
 		 float near, float far)
 {
+    if (flat) {
+	psr_warn("ortho() is ignored in 2D mode.");
+	return 0;
+    }
     glMatrixMode(GL_PROJECTION);
     glLoadIdentity();
     glOrtho(left, right, -bottom, -top, near, far);
@@ -626,6 +1931,13 @@ static int ortho(float left, float right, float bottom, float top,
  * Other functions
  ********************************************************************/
 
+/** the fill color for text.c, returns 0 after no_fill() */
+int gl_fill_color(struct rgba8 *color)
+{
+    *color = fill_color;
+    return !dont_fill;
+}
+
 static GLvoid glu_error_handle(GLenum e)
 {
     psr_error("gluQuadric error: %s", gluErrorString(e));
@@ -646,7 +1958,6 @@ int gl_init(struct psr_context *lpsr_cxt,
     glHint(GL_PERSPECTIVE_CORRECTION_HINT, GL_FASTEST);
     glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
     glEnable(GL_BLEND);
-    glEnable(GL_MAP1_VERTEX_3);
     glFlush();
     r = glCheckError();
 
@@ -654,6 +1965,10 @@ int gl_init(struct psr_context *lpsr_cxt,
     gluQuadricCallback(quad, GLU_ERROR, glu_error_handle);
     gluQuadricNormals(quad, GLU_NONE);
 
+    /* the state is per thread, its addresses aren't constants */
+    INIT_LLIST_HEAD(&vertex_list_head);
+    affine = flat_stack[0];
+
     psr_cxt = lpsr_cxt;
     renderer_cxt->stroke = stroke;
     renderer_cxt->no_stroke = no_stroke;
@@ -672,9 +1987,19 @@ int gl_init(struct psr_context *lpsr_cxt,
     renderer_cxt->box = box;
     renderer_cxt->sphere = sphere;
     renderer_cxt->sphere_detail = sphere_detail;
+    renderer_cxt->auto_detail = auto_detail;
+    renderer_cxt->dirty_rect = dirty_rect;
     renderer_cxt->stroke_weight = stroke_weight;
+    renderer_cxt->stroke_join = stroke_join;
+    renderer_cxt->stroke_cap = stroke_cap;
+    renderer_cxt->curve_detail = curve_detail;
+    renderer_cxt->curve_tightness = curve_tightness;
+    renderer_cxt->curve_vertex = curve_vertex;
+    curve_update();
     renderer_cxt->smooth = smooth;
     renderer_cxt->no_smooth = no_smooth;
+    renderer_cxt->hint = hint;
+    renderer_cxt->pick_id = pick_id;
     renderer_cxt->fill = fill;
     renderer_cxt->no_fill = no_fill;
     renderer_cxt->save = save;
@@ -687,70 +2012,201 @@ int gl_init(struct psr_context *lpsr_cxt,
     renderer_cxt->begin_camera = begin_camera;
     renderer_cxt->end_camera = end_camera;
     renderer_cxt->ortho = ortho;
+    renderer_cxt->create_shape = create_shape;
+    renderer_cxt->end_shape_record = end_shape_record;
+    renderer_cxt->shape = shape;
+    renderer_cxt->free_shape = free_shape;
+    renderer_cxt->create_graphics = create_graphics;
+    renderer_cxt->free_graphics = free_graphics;
+    renderer_cxt->begin_draw = begin_draw;
+    renderer_cxt->end_draw = end_draw;
+    renderer_cxt->image_graphics = image_graphics;
+    renderer_cxt->composite = composite;
+    gl_text_init(renderer_cxt);
 
     return r;
 }
 
 int gl_end(void)
 {
+    int i;
+
     gluDeleteQuadric(quad);
     quad = NULL;
-    if (recorded_list) {
-	glDeleteLists(recorded_list, 1);
+    gl_record_free();
+    gl_text_end();
+    stroke_end();
+    if (drawing_target) {
+	end_draw();
+    }
+    gl_graphics_end();
+    gl_msaa_end();
+    depth_sort_end();
+    lod_end();
+    free(curve_points);
+    curve_points = NULL;
+    free(bezier_t);
+    bezier_t = NULL;
+    free(shape_buf);
+    shape_buf = NULL;
+    shape_buf_size = 0;
+    curve_points_size = 0;
+    for (i = 0; i < shape_lists_size; ++i) {
+	if (shape_lists[i]) {
+	    glDeleteLists(shape_lists[i], 1);
+	}
     }
+    free(shape_lists);
+    shape_lists = NULL;
+    shape_lists_size = 0;
+    /* for the next sketch on this thread */
+    memset(hints, 0, sizeof(hints));
+    flat = flat_top = smoothing = 0;
+    flat_gl = FLAT_GL_IDENTITY;
+    pick_current = 0;
+    lod_error = 0;
+    dirty = scissoring = partial = 0;
     return 0;
 }
 
 int gl_reshape(int width, int height)
 {
-    const GLdouble fov = 60;
-    const GLdouble aspect = width / height;
-    const GLdouble z = height / 2 / 0.577350269;	/* tan(30 deg) */
-    const GLdouble z_near = z / 10;
-    const GLdouble z_far = z * 10;
-
-    psr_debug("gl_reshape(%d, %d), aspect %f, z_near %f, z_far %f",
-	      width, height, aspect, z_near, z_far);
+    psr_debug("gl_reshape(%d, %d)", width, height);
 
     g_width = width;
     g_height = height;
-    g_depth = z;
+    g_depth = height / 2 / 0.577350269;	/* tan(30 deg) */
+    /* all of it has to be drawn again */
+    dirty = 0;
 
     glViewport(0, 0, width, height);
+    gl_msaa_resize(width, height);
 
-    glMatrixMode(GL_PROJECTION);
-    glLoadIdentity();
-    gluPerspective(fov, aspect, z_near, z_far);
-
-    glMatrixMode(GL_MODELVIEW);
+    projection();
     camera_default();
 
     return glCheckError();
 }
 
-int gl_record(void (*func) (void))
+/** draw() is about to run.  with dirty_rect() since the last one it is
+ * a partial redraw. */
+void gl_frame_begin(void)
+{
+    int *s = scissor_box;
+
+    partial = dirty;
+    if (!dirty) {
+	return;
+    }
+    dirty = 0;
+    s[0] = fmaxf(floorf(dirty_box[0]), 0);
+    s[1] = fmaxf(floorf(dirty_box[1]), 0);
+    s[2] = fminf(ceilf(dirty_box[2]), g_width);
+    s[3] = fminf(ceilf(dirty_box[3]), g_height);
+    if (s[2] < s[0]) {
+	s[2] = s[0];
+    }
+    if (s[3] < s[1]) {
+	s[3] = s[1];
+    }
+    glEnable(GL_SCISSOR_TEST);
+    glScissor(s[0], g_height - s[3], s[2] - s[0], s[3] - s[1]);
+    scissoring = 1;
+}
+
+/** a frame of setup() or draw() is complete, pick() may see it */
+void gl_frame_end(void)
+{
+    if (scissoring) {
+	/* the sorted triangles belong to the region too */
+	depth_sort_flush();
+	glDisable(GL_SCISSOR_TEST);
+	scissoring = 0;
+    }
+    if (drawing_target) {
+	psr_warn("end_draw() missing at the end of the frame.");
+	end_draw();
+    }
+    psr_pick_frame(g_width, g_height);
+}
+
+/** start the next display list of the recording */
+static int record_segment(void)
 {
-    if (recorded_list) {
-	glDeleteLists(recorded_list, 1);
+    GLuint list;
+
+    if (recorded_count == recorded_size) {
+	GLuint *lists;
+
+	recorded_size = recorded_size ? recorded_size * 2 : 4;
+	lists = realloc(recorded_lists, recorded_size * sizeof(*lists));
+	if (!lists) {
+	    psr_system_error(errno, "No memory for display lists.");
+	}
+	recorded_lists = lists;
     }
-    recorded_list = glGenLists(1);
-    if (recorded_list == 0) {
+    list = glGenLists(1);
+    if (list == 0) {
 	return glCheckError();
     }
-    glGetFloatv(GL_MODELVIEW_MATRIX, (GLfloat *) saved_modelview);
-    glNewList(recorded_list, GL_COMPILE_AND_EXECUTE);
+    recorded_lists[recorded_count++] = list;
+    glNewList(list, GL_COMPILE_AND_EXECUTE);
+    return glCheckError();
+}
+
+void gl_record_free(void)
+{
+    int i;
+
+    for (i = 0; i < recorded_count; ++i) {
+	glDeleteLists(recorded_lists[i], 1);
+    }
+    free(recorded_lists);
+    recorded_lists = NULL;
+    recorded_count = recorded_size = 0;
+}
+
+/** draw and record at the same time.  gl_replay() redraws it without
+ * calling func again. */
+int gl_record(void (*func) (void))
+{
+    int r;
+
+    gl_record_free();
+    r = record_segment();
+    if (r) {
+	return r;
+    }
+    recording = 1;
+    if (flat) {
+	flat_reset();
+    }
     func();			/* do the actual drawing */
+    if (drawing_target) {
+	psr_warn("end_draw() missing.");
+	end_draw();
+    }
+    /* sorted drawing is part of the recording */
+    depth_sort_flush();
+    recording = 0;
     glEndList();
     return glCheckError();
 }
 
+/** the recording is replayed under the current camera, so it follows
+ * the window when it is resized. */
 int gl_replay(void)
 {
-    if (recorded_list) {
-	glPushMatrix();
-	glLoadMatrixf((GLfloat *) saved_modelview);
-	glCallList(recorded_list);
-	glPopMatrix();
+    int i;
+
+    glPushMatrix();
+    for (i = 0; i < recorded_count; ++i) {
+	glCallList(recorded_lists[i]);
+    }
+    glPopMatrix();
+    if (flat) {
+	/* whatever the recording left, it is gone now */
+	flat_gl = FLAT_GL_STALE;
     }
     return glCheckError();
 }
@@ -0,0 +1,88 @@
+#ifndef GL_INTERNAL_H
+#define GL_INTERNAL_H
+
+/* shared between the files of the GL renderer.  its state is thread
+ * local: the sketches of a process each draw on a thread of their own,
+ * see psr_ctx_new(). */
+
+#include <stdint.h>
+#include <GL/gl.h>
+#include <GL/glu.h>
+
+#include "psr_internal.h"
+
+/** colors are kept as RGBA8 from fill() and stroke() on, and go to GL
+ * as GL_UNSIGNED_BYTE */
+struct rgba8 {
+    uint8_t r, g, b, a;
+};
+
+static inline uint8_t color_byte(float c)
+{
+    return c <= 0 ? 0 : (c >= 1 ? 255 : (uint8_t) (c * 255 + 0.5f));
+}
+
+static inline struct rgba8 rgba8(float r, float g, float b, float a)
+{
+    struct rgba8 c = {color_byte(r), color_byte(g), color_byte(b),
+		      color_byte(a)};
+    return c;
+}
+
+/* gl.c */
+extern int gl_fill_color(struct rgba8 *color);
+extern void gl_flat_load(void);
+extern int gl_read_window(void *data, size_t size, int *width, int *height);
+
+/* text.c */
+extern int gl_text_init(struct psr_renderer_context *renderer_cxt);
+extern int gl_text_end(void);
+
+/* stroke.c */
+struct stroke_point {
+    float x, y, z;
+    struct rgba8 color;
+};
+
+extern void stroke_set(float weight, int join, int cap);
+extern void stroke_polyline(const struct stroke_point *p, int n, int closed);
+extern void stroke_dot(const struct stroke_point *p);
+extern int stroke_flush(void);
+extern void stroke_sort(void);
+extern void stroke_end(void);
+
+/* depthsort.c */
+extern void depth_sort_begin(void);
+extern void depth_sort_triangle(const struct stroke_point *a,
+				const struct stroke_point *b,
+				const struct stroke_point *c);
+extern int depth_sort_flush(void);
+extern void depth_sort_end(void);
+
+/* lod.c */
+extern int lod_segments(float radius, float error, int min, int max);
+extern void lod_sphere(GLUquadric *quad, int n, int compile);
+extern void lod_disk(GLUquadric *quad, int n, GLenum style, int compile);
+extern void lod_end(void);
+
+/* ring.c */
+extern int gl_ring_publish(const char *name);
+extern void gl_ring_close(void);
+
+/* graphics.c */
+extern int gl_graphics_create(int handle, int width, int height);
+extern int gl_graphics_free(int handle);
+extern int gl_graphics_bind(int handle, int *width, int *height);
+extern void gl_graphics_unbind(void);
+extern GLuint gl_graphics_texture(int handle, int *width, int *height);
+extern void gl_graphics_end(void);
+
+/* msaa.c */
+extern int gl_msaa_set(int samples);
+extern int gl_msaa_resize(int width, int height);
+extern int gl_present(void);
+extern void gl_msaa_read_begin(void);
+extern void gl_msaa_read_end(void);
+extern void gl_msaa_end(void);
+
+#endif				/* GL_INTERNAL_H */
@@ -20,6 +20,14 @@ extern int gl_reshape(int width, int height);
 extern int gl_record(void (*func) (void));
 
 extern int gl_replay(void);
+
+extern int gl_present(void);
+
+extern void gl_frame_begin(void);
+
+extern void gl_frame_end(void);
+
+extern int gl_save_update(struct psr_image *img);
 /* end functions */
 
 
@@ -29,33 +37,43 @@ extern int gl_replay(void);
 
 static void update_display(void)
 {
-    /* display the saved drawing.  this is called during the window
+    /* replay the recorded setup().  this is called during the window
      * manager redraw event. */
     psr_debug("update_display()");
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-    renderer_cxt->image(&saved_img, 0, 0, 0, 0);
+    gl_replay();
+    gl_present();
     glutSwapBuffers();
 }
 
+static void run_setup(void)
+{
+    psr_cxt->default_setup();
+    psr_cxt->usr_func.setup();
+}
+
 static void display_loop_draw(void)
 {
+    gl_frame_begin();
     psr_cxt->usr_func.draw();
+    gl_frame_end();
+    gl_present();
     glutSwapBuffers();
 }
 
 static inline void save_current_drawing(void)
 {
     psr_debug("save_current_drawing()");
-    if (saved_img.data) {
-	free(saved_img.data);
-    }
-    renderer_cxt->save(&saved_img);
+    /* only the dirty region after a partial redraw */
+    gl_save_update(&saved_img);
 }
 
 static void display_draw(void)
 {
     psr_debug("display_draw()");
+    gl_frame_begin();
     psr_cxt->usr_func.draw();
+    gl_frame_end();
     save_current_drawing();
     if (looping) {
 	psr_debug("use display_loop_draw");
@@ -66,6 +84,7 @@ static void display_draw(void)
 	glutDisplayFunc(display_draw);
 	glutIdleFunc(NULL);
     }
+    gl_present();
     glutSwapBuffers();
 }
 
@@ -74,15 +93,15 @@ static void display_setup(void)
     /* we call setup() just once.  we 'record' it, replay it if
      * necessary */
     psr_debug("display_setup()");
-    psr_cxt->default_setup();
     if (psr_cxt->usr_func.draw) {
-	psr_cxt->usr_func.setup();
+	run_setup();
 	glutDisplayFunc(display_draw);
     } else {
-	psr_cxt->usr_func.setup();
-	save_current_drawing();
-	//glutDisplayFunc(update_display);
+	gl_record(run_setup);
+	glutDisplayFunc(update_display);
     }
+    gl_frame_end();
+    gl_present();
     glutSwapBuffers();
 }
 
@@ -166,6 +185,29 @@ static void visible(int vis)
     }
 }
 
+/* input goes through the queue of input.c, it is handled at the start
+ * of the next frame */
+static void post_key(int key, int keycode)
+{
+    struct psr_event ev = {
+	.type = PSR_EVENT_KEY_PRESSED,
+	.key = key,
+	.keycode = keycode,
+    };
+    psr_cxt->post_event(&ev);
+}
+
+static void post_mouse(int type, int x, int y, int button)
+{
+    struct psr_event ev = {
+	.type = type,
+	.x = x,
+	.y = y,
+	.button = button,
+    };
+    psr_cxt->post_event(&ev);
+}
+
 static void keyboard(unsigned char key, int x, int y)
 {
     int keycode = NONE;		/* NONE means we don't update keycode */
@@ -181,7 +223,7 @@ static void keyboard(unsigned char key, int x, int y)
     default:
 	break;
     }
-    psr_cxt->update_key(key, keycode);
+    post_key(key, keycode);
     return;
 }
 
@@ -191,16 +233,16 @@ static void special(int key, int x, int y)
     psr_debug("special(%d, %d, %d)", key, x, y);
     switch (key) {
     case GLUT_KEY_UP:
-	psr_cxt->update_key(CODED, UP);
+	post_key(CODED, UP);
 	break;
     case GLUT_KEY_DOWN:
-	psr_cxt->update_key(CODED, DOWN);
+	post_key(CODED, DOWN);
 	break;
     case GLUT_KEY_LEFT:
-	psr_cxt->update_key(CODED, LEFT);
+	post_key(CODED, LEFT);
 	break;
     case GLUT_KEY_RIGHT:
-	psr_cxt->update_key(CODED, RIGHT);
+	post_key(CODED, RIGHT);
 	break;
     case GLUT_KEY_F1:
     case GLUT_KEY_F2:
@@ -226,11 +268,6 @@ static void special(int key, int x, int y)
     return;
 }
 
-#define SAFE_CALL(func, args...) \
-    if(func) {			 \
-	func(##args);		 \
-    }
-
 static void mouse(int button, int state, int x, int y)
 {
     switch (button) {
@@ -246,24 +283,21 @@ static void mouse(int button, int state, int x, int y)
     default:
 	psr_system_error(EINVAL, "invalid 'button' argument.");
     }
-    psr_cxt->update_mouse(x, y, button);
     if (state == GLUT_DOWN) {
-	SAFE_CALL(psr_cxt->usr_func.mouse_pressed, );
+	post_mouse(PSR_EVENT_MOUSE_PRESSED, x, y, button);
     } else if (state == GLUT_UP) {
-	SAFE_CALL(psr_cxt->usr_func.mouse_released, );
+	post_mouse(PSR_EVENT_MOUSE_RELEASED, x, y, button);
     }
 }
 
 static void motion(int x, int y)
 {
-    psr_cxt->update_mouse(x, y, NONE);	/* don't update button */
-    SAFE_CALL(psr_cxt->usr_func.mouse_dragged, );
+    post_mouse(PSR_EVENT_MOUSE_DRAGGED, x, y, NONE);
 }
 
 static void passive_motion(int x, int y)
 {
-    psr_cxt->update_mouse(x, y, NONE);	/* don't update button */
-    SAFE_CALL(psr_cxt->usr_func.mouse_moved, );
+    post_mouse(PSR_EVENT_MOUSE_MOVED, x, y, NONE);
 }
 
 
@@ -366,13 +400,20 @@ int init(struct psr_context *lpsr_cxt,
     return 0;
 }
 
+/** GLUT has a single main loop, so a process runs one sketch with it */
 int main_loop_start(void)
 {
+    static int started = 0;
     int argc = 1;
     char *argv[] = { "Processor" };
 
     psr_debug("main_loop_start");
 
+    if (started++) {
+	psr_error("GLUT runs one sketch a process, see libpsr_egl.so.");
+	return -1;
+    }
+
     if (!psr_cxt->usr_func.setup) {
 	psr_error("we need setup() at least.");
 	return -1;
@@ -0,0 +1,176 @@
+/** Offscreen targets of create_graphics().  Each one is a framebuffer
+ * object with a texture for the color and a renderbuffer for the depth,
+ * so image() draws the texture where it is, on the GPU.  gl.c switches
+ * the rest of the state in begin_draw() and end_draw(). */
+
+#define GL_GLEXT_PROTOTYPES
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <GL/gl.h>
+#include <GL/glext.h>
+
+#include "gl_internal.h"
+
+struct graphics {
+    GLuint fbo, texture, depth_rb;
+    int width, height;
+};
+
+/* indexed by handle */
+static __thread struct graphics *targets = NULL;
+static __thread int targets_size = 0;
+/* the framebuffer of the window while a target is bound */
+static __thread GLint window_fbo = 0;
+
+static struct graphics *target(int handle)
+{
+    if (handle <= 0 || handle >= targets_size || !targets[handle].fbo) {
+	psr_error("invalid graphics %d.", handle);
+	return NULL;
+    }
+    return &targets[handle];
+}
+
+static void graphics_free(struct graphics *g)
+{
+    glDeleteFramebuffers(1, &g->fbo);
+    glDeleteTextures(1, &g->texture);
+    glDeleteRenderbuffers(1, &g->depth_rb);
+    memset(g, 0, sizeof(*g));
+}
+
+int gl_graphics_create(int handle, int width, int height)
+{
+    struct graphics *g;
+    GLfloat clear[4];
+    GLboolean scissor;
+    GLenum status;
+    GLint bound;
+    int size;
+
+    if (handle >= targets_size) {
+	size = targets_size ? targets_size * 2 : 16;
+	while (size <= handle) {
+	    size *= 2;
+	}
+	g = realloc(targets, size * sizeof(*g));
+	if (!g) {
+	    psr_system_error(errno, "No memory for graphics.");
+	}
+	memset(g + targets_size, 0, (size - targets_size) * sizeof(*g));
+	targets = g;
+	targets_size = size;
+    }
+    g = &targets[handle];
+    if (g->fbo) {
+	psr_error("graphics %d exists.", handle);
+	return -1;
+    }
+
+    glGenTextures(1, &g->texture);
+    glBindTexture(GL_TEXTURE_2D, g->texture);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, width, height, 0, GL_RGBA,
+		 GL_UNSIGNED_BYTE, NULL);
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    glGenRenderbuffers(1, &g->depth_rb);
+    glBindRenderbuffer(GL_RENDERBUFFER, g->depth_rb);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, width,
+			  height);
+    glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+    glGetIntegerv(GL_FRAMEBUFFER_BINDING, &bound);
+    glGenFramebuffers(1, &g->fbo);
+    glBindFramebuffer(GL_FRAMEBUFFER, g->fbo);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+			   GL_TEXTURE_2D, g->texture, 0);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT,
+			      GL_RENDERBUFFER, g->depth_rb);
+    status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+    if (status == GL_FRAMEBUFFER_COMPLETE) {
+	/* transparent to begin with, also in a partial redraw */
+	glGetFloatv(GL_COLOR_CLEAR_VALUE, clear);
+	scissor = glIsEnabled(GL_SCISSOR_TEST);
+	glDisable(GL_SCISSOR_TEST);
+	glClearColor(0, 0, 0, 0);
+	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+	glClearColor(clear[0], clear[1], clear[2], clear[3]);
+	if (scissor) {
+	    glEnable(GL_SCISSOR_TEST);
+	}
+    }
+    glBindFramebuffer(GL_FRAMEBUFFER, bound);
+    if (status != GL_FRAMEBUFFER_COMPLETE) {
+	psr_warn("graphics framebuffer incomplete: 0x%x", status);
+	graphics_free(g);
+	return -1;
+    }
+    g->width = width;
+    g->height = height;
+    return glGetError() == GL_NO_ERROR ? 0 : -1;
+}
+
+int gl_graphics_free(int handle)
+{
+    struct graphics *g = target(handle);
+
+    if (!g) {
+	return -1;
+    }
+    graphics_free(g);
+    return 0;
+}
+
+/** draw into the target from now on, until gl_graphics_unbind() */
+int gl_graphics_bind(int handle, int *width, int *height)
+{
+    const struct graphics *g = target(handle);
+
+    if (!g) {
+	return -1;
+    }
+    glGetIntegerv(GL_FRAMEBUFFER_BINDING, &window_fbo);
+    glBindFramebuffer(GL_FRAMEBUFFER, g->fbo);
+    *width = g->width;
+    *height = g->height;
+    return 0;
+}
+
+/** back to drawing into the window */
+void gl_graphics_unbind(void)
+{
+    glBindFramebuffer(GL_FRAMEBUFFER, window_fbo);
+    window_fbo = 0;
+}
+
+/** the texture with the picture of the target, 0 if there is none */
+GLuint gl_graphics_texture(int handle, int *width, int *height)
+{
+    const struct graphics *g = target(handle);
+
+    if (!g) {
+	return 0;
+    }
+    *width = g->width;
+    *height = g->height;
+    return g->texture;
+}
+
+void gl_graphics_end(void)
+{
+    int i;
+
+    for (i = 0; i < targets_size; ++i) {
+	if (targets[i].fbo) {
+	    graphics_free(&targets[i]);
+	}
+    }
+    free(targets);
+    targets = NULL;
+    targets_size = 0;
+}
@@ -0,0 +1,130 @@
+/** auto_detail().  The number of segments of a circle or sphere is taken
+ * from its size in the window, so the polygon is off the true outline by
+ * no more than the error given, up to the detail set with sphere_detail()
+ * or the like.
+ *
+ * The counts are rounded up to buckets of 2^k and 3 * 2^(k - 1), and the
+ * unit mesh of each bucket is compiled into a display list the first time
+ * it is needed.  The drawing then scales it, and no call tessellates
+ * again.  A display list can't be compiled while another one is, so while
+ * recording a mesh that isn't cached yet is drawn directly. */
+
+#include <math.h>
+#include <GL/gl.h>
+#include <GL/glu.h>
+
+#include "gl_internal.h"
+
+#define LOD_CACHED (257)	/* segments 0 to 256 */
+
+enum {
+    LOD_SPHERE,
+    LOD_DISK_FILL,
+    LOD_DISK_LINE,
+    LOD_KINDS
+};
+
+static __thread GLuint lists[LOD_KINDS][LOD_CACHED];
+
+/** the smallest bucket not below n */
+static int bucket(int n)
+{
+    int b = 4;
+
+    while (b < n) {
+	/* 4, 6, 8, 12, 16, 24, ... */
+	b = b & (b - 1) ? (b / 3) * 4 : (b / 2) * 3;
+    }
+    return b;
+}
+
+/** the segments of a circle radius pixels large, at most error pixels
+ * off, between min and max.  a radius of 0 is unknown and gets max. */
+int lod_segments(float radius, float error, int min, int max)
+{
+    float n;
+
+    if (error <= 0 || radius <= 0) {
+	return max;
+    }
+    if (min > max) {
+	min = max;
+    }
+    if (error >= radius) {
+	return min;
+    }
+    /* the sagitta of a segment is radius * (1 - cos(pi / n)) */
+    n = M_PI / acosf(1 - error / radius);
+    if (n >= max) {
+	return max;
+    }
+    n = bucket(ceilf(n));
+    return n < min ? min : (n > max ? max : n);
+}
+
+/** call the list of kind and n, compile it with draw if it isn't yet.
+ * returns 0 if the caller has to draw itself. */
+static int lod_call(int kind, int n, int compile)
+{
+    GLuint *list;
+
+    if (n >= LOD_CACHED) {
+	return 0;
+    }
+    list = &lists[kind][n];
+    if (*list) {
+	glCallList(*list);
+	return 1;
+    }
+    if (!compile || !(*list = glGenLists(1))) {
+	return 0;
+    }
+    glNewList(*list, GL_COMPILE_AND_EXECUTE);
+    return -1;
+}
+
+/** a sphere of radius 1 with n slices and stacks */
+void lod_sphere(GLUquadric *quad, int n, int compile)
+{
+    int r = lod_call(LOD_SPHERE, n, compile);
+
+    if (r > 0) {
+	return;
+    }
+    gluQuadricDrawStyle(quad, GLU_FILL);
+    gluSphere(quad, 1, n, n);
+    if (r) {
+	glEndList();
+    }
+}
+
+/** a full disk of radius 1 with n slices, style is GLU_FILL or
+ * GLU_SILHOUETTE */
+void lod_disk(GLUquadric *quad, int n, GLenum style, int compile)
+{
+    int r = lod_call(style == GLU_FILL ? LOD_DISK_FILL : LOD_DISK_LINE, n,
+		     compile);
+
+    if (r > 0) {
+	return;
+    }
+    gluQuadricDrawStyle(quad, style);
+    gluPartialDisk(quad, 0, 1, n, 1, 0, 360);
+    if (r) {
+	glEndList();
+    }
+}
+
+void lod_end(void)
+{
+    int i, j;
+
+    for (i = 0; i < LOD_KINDS; ++i) {
+	for (j = 0; j < LOD_CACHED; ++j) {
+	    if (lists[i][j]) {
+		glDeleteLists(lists[i][j], 1);
+		lists[i][j] = 0;
+	    }
+	}
+    }
+}
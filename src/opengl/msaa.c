@@ -0,0 +1,175 @@
+/** Multisample anti-aliasing for smooth().  While it is on everything is
+ * drawn into a multisampled framebuffer object, gl_present() resolves it
+ * into the window (or pbuffer) before the swap.  The cost is one blit per
+ * frame and samples times the memory of the color and depth buffers; it
+ * does not depend on what is drawn, unlike the legacy GL_*_SMOOTH modes.
+ *
+ * The framebuffer object stays bound between frames, so the drawing
+ * persists like it does in the window without it. */
+
+#define GL_GLEXT_PROTOTYPES
+#include <GL/gl.h>
+#include <GL/glext.h>
+
+#include "gl_internal.h"
+
+static __thread GLuint fbo = 0;
+static __thread GLuint color_rb = 0, depth_rb = 0;
+static __thread int fbo_samples = 0, fbo_width = 0, fbo_height = 0;
+
+static void msaa_free(void)
+{
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glDeleteFramebuffers(1, &fbo);
+    glDeleteRenderbuffers(1, &color_rb);
+    glDeleteRenderbuffers(1, &depth_rb);
+    fbo = color_rb = depth_rb = 0;
+    fbo_samples = 0;
+}
+
+/** the number of samples the implementation can do, 0 without
+ * framebuffer objects */
+static int max_samples(void)
+{
+    GLint n = 0;
+
+    glGetIntegerv(GL_MAX_SAMPLES, &n);
+    if (glGetError() != GL_NO_ERROR) {
+	return 0;
+    }
+    return n;
+}
+
+static int msaa_storage(int width, int height)
+{
+    GLboolean scissor;
+    GLenum status;
+
+    glBindRenderbuffer(GL_RENDERBUFFER, color_rb);
+    glRenderbufferStorageMultisample(GL_RENDERBUFFER, fbo_samples,
+				     GL_RGBA8, width, height);
+    glBindRenderbuffer(GL_RENDERBUFFER, depth_rb);
+    glRenderbufferStorageMultisample(GL_RENDERBUFFER, fbo_samples,
+				     GL_DEPTH_COMPONENT24, width, height);
+    glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+    glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+			      GL_RENDERBUFFER, color_rb);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT,
+			      GL_RENDERBUFFER, depth_rb);
+    status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+    if (status != GL_FRAMEBUFFER_COMPLETE) {
+	psr_warn("multisample framebuffer incomplete: 0x%x", status);
+	msaa_free();
+	return -1;
+    }
+    /* only the color is carried over, the depth starts out cleared */
+    scissor = glIsEnabled(GL_SCISSOR_TEST);
+    glDisable(GL_SCISSOR_TEST);
+    glClear(GL_DEPTH_BUFFER_BIT);
+    if (scissor) {
+	glEnable(GL_SCISSOR_TEST);
+    }
+    fbo_width = width;
+    fbo_height = height;
+    return 0;
+}
+
+/** start drawing with samples per pixel, 0 goes back to the window.
+ * samples is cut to what the implementation supports. */
+int gl_msaa_set(int samples)
+{
+    GLint viewport[4];
+    int max;
+
+    if (samples <= 0) {
+	if (fbo) {
+	    /* keep the picture, it is all there is */
+	    gl_present();
+	    msaa_free();
+	}
+	return 0;
+    }
+
+    max = max_samples();
+    if (max < 2) {
+	psr_warn("no multisampling here, smooth() is ignored.");
+	return -1;
+    }
+    if (samples > max) {
+	samples = max;
+    }
+    if (fbo && samples == fbo_samples) {
+	return 0;
+    }
+    if (fbo) {
+	gl_present();
+    } else {
+	glGenFramebuffers(1, &fbo);
+	glGenRenderbuffers(1, &color_rb);
+	glGenRenderbuffers(1, &depth_rb);
+    }
+    fbo_samples = samples;
+    psr_debug("%d samples per pixel", samples);
+
+    glGetIntegerv(GL_VIEWPORT, viewport);
+    if (msaa_storage(viewport[2], viewport[3])) {
+	return -1;
+    }
+    /* carry the current picture over so smooth() in the middle of a
+     * sketch does not lose it */
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+    glBlitFramebuffer(0, 0, fbo_width, fbo_height, 0, 0, fbo_width,
+		      fbo_height, GL_COLOR_BUFFER_BIT, GL_NEAREST);
+    glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+    return 0;
+}
+
+/** follow a window size change */
+int gl_msaa_resize(int width, int height)
+{
+    if (!fbo || (width == fbo_width && height == fbo_height)) {
+	return 0;
+    }
+    return msaa_storage(width, height);
+}
+
+/** finish the frame: draw what depthsort.c holds back and resolve the
+ * samples into the window.  backends call this before they show or read
+ * a frame. */
+int gl_present(void)
+{
+    depth_sort_flush();
+    if (!fbo) {
+	return 0;
+    }
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, fbo);
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+    glBlitFramebuffer(0, 0, fbo_width, fbo_height, 0, 0, fbo_width,
+		      fbo_height, GL_COLOR_BUFFER_BIT, GL_NEAREST);
+    glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+    return glGetError() == GL_NO_ERROR ? 0 : -1;
+}
+
+/** bind the resolved picture for glReadPixels(), the framebuffer object
+ * is bound again by gl_msaa_read_end() */
+void gl_msaa_read_begin(void)
+{
+    if (fbo) {
+	gl_present();
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+    }
+}
+
+void gl_msaa_read_end(void)
+{
+    if (fbo) {
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, fbo);
+    }
+}
+
+void gl_msaa_end(void)
+{
+    gl_msaa_set(0);
+}
@@ -0,0 +1,106 @@
+/** PSR_RING.  The frames are read back from GL straight into a shared
+ * memory ring (see psr_ring.h), so a viewer on the same machine can
+ * show them as they come, without files in between.
+ *
+ * The ring is made at the first frame, for the window size of then.  A
+ * later frame too large for a slot is not published. */
+
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "gl_internal.h"
+#include "psr_ring.h"
+
+static __thread struct psr_ring *ring = NULL;
+static __thread char *ring_name = NULL;
+static __thread size_t slot_size = 0;
+
+static int ring_open(const char *name)
+{
+    struct psr_ring *r;
+    size_t size;
+    int width, height, fd, i;
+
+    /* just for the size */
+    gl_read_window(NULL, 0, &width, &height);
+    slot_size = (size_t) 3 * width * height;
+    size = sizeof(*r) + PSR_RING_SLOTS * slot_size;
+
+    fd = shm_open(name, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+	psr_system_warn(errno, "can't open %s", name);
+	return -1;
+    }
+    if (ftruncate(fd, size)) {
+	psr_system_warn(errno, "can't size %s", name);
+	close(fd);
+	shm_unlink(name);
+	return -1;
+    }
+    r = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (r == MAP_FAILED) {
+	psr_system_warn(errno, "can't map %s", name);
+	shm_unlink(name);
+	return -1;
+    }
+
+    r->format = PSR_RING_RGB;
+    r->width = width;
+    r->height = height;
+    r->size = size;
+    r->sequence = 0;
+    for (i = 0; i < PSR_RING_SLOTS; ++i) {
+	r->slot[i].sequence = 0;
+	r->slot[i].offset = sizeof(*r) + i * slot_size;
+    }
+    /* the magic last, a viewer may be waiting for it */
+    __atomic_store_n(&r->magic, PSR_RING_MAGIC, __ATOMIC_RELEASE);
+    ring = r;
+    ring_name = strdup(name);
+    return 0;
+}
+
+/** put the frame on the screen into the ring of that name */
+int gl_ring_publish(const char *name)
+{
+    struct psr_ring_slot *s;
+    uint64_t sequence;
+    int width, height;
+
+    if (!ring && ring_open(name)) {
+	return -1;
+    }
+    sequence = ring->sequence + 1;
+    s = &ring->slot[PSR_RING_SLOT(sequence)];
+    __atomic_store_n(&s->sequence, 0, __ATOMIC_RELEASE);
+    /* the 0 before any pixel, a release store alone lets them pass it */
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    if (gl_read_window((char *) ring + s->offset, slot_size, &width,
+		       &height)) {
+	psr_warn("frame %dx%d not published, the ring is for %dx%d",
+		 width, height, ring->width, ring->height);
+	return 0;
+    }
+    s->width = width;
+    s->height = height;
+    __atomic_store_n(&s->sequence, sequence, __ATOMIC_RELEASE);
+    __atomic_store_n(&ring->sequence, sequence, __ATOMIC_RELEASE);
+    return 0;
+}
+
+/** the viewers keep what they have mapped */
+void gl_ring_close(void)
+{
+    if (!ring) {
+	return;
+    }
+    munmap(ring, ring->size);
+    shm_unlink(ring_name);
+    free(ring_name);
+    ring = NULL;
+    ring_name = NULL;
+}
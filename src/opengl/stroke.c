@@ -0,0 +1,284 @@
+/** Stroke tessellation.  Thick lines are turned into triangles on the
+ * CPU, with the joins of stroke_join() and the caps of stroke_cap(), so
+ * they look the same whatever glLineWidth() the driver supports.  All
+ * polylines up to stroke_flush() share one vertex buffer and are drawn
+ * with one glDrawArrays().
+ *
+ * The outline is built in the x-y plane, z is carried along. */
+
+#include <stdlib.h>
+#include <errno.h>
+#include <math.h>
+#include <GL/gl.h>
+
+#include "gl_internal.h"
+
+/* the miter is cut to a bevel beyond this many half widths, like the
+ * default stroke-miterlimit of svg */
+#define MITER_LIMIT (4.0f)
+#define MAX_ARC_STEPS (64)
+
+static __thread struct stroke_point *buf = NULL;
+static __thread int buf_len = 0, buf_size = 0;
+
+static __thread float half_width = 0.5f;
+static __thread int join_mode = MITER;
+static __thread int cap_mode = ROUND;
+
+void stroke_set(float weight, int join, int cap)
+{
+    half_width = weight / 2;
+    join_mode = join;
+    cap_mode = cap;
+}
+
+static struct stroke_point *reserve(int n)
+{
+    struct stroke_point *p;
+
+    if (buf_len + n > buf_size) {
+	buf_size = buf_size ? buf_size * 2 : 1024;
+	while (buf_size < buf_len + n) {
+	    buf_size *= 2;
+	}
+	p = realloc(buf, buf_size * sizeof(*buf));
+	if (!p) {
+	    psr_system_error(errno, "No memory for strokes.");
+	}
+	buf = p;
+    }
+    p = buf + buf_len;
+    buf_len += n;
+    return p;
+}
+
+/* c is p moved by (dx, dy) */
+static inline void offset(struct stroke_point *c,
+			  const struct stroke_point *p, float dx, float dy)
+{
+    *c = *p;
+    c->x += dx;
+    c->y += dy;
+}
+
+static inline void triangle(const struct stroke_point *a,
+			    const struct stroke_point *b,
+			    const struct stroke_point *c)
+{
+    struct stroke_point *t = reserve(3);
+    t[0] = *a;
+    t[1] = *b;
+    t[2] = *c;
+}
+
+/** enough steps to keep the chords within a quarter pixel */
+static int arc_steps(float angle)
+{
+    float step;
+    int n;
+
+    if (half_width <= 0.25f) {
+	return 1;
+    }
+    step = 2 * acosf(1 - 0.25f / half_width);
+    n = ceilf(fabsf(angle) / step);
+    return n < 1 ? 1 : (n > MAX_ARC_STEPS ? MAX_ARC_STEPS : n);
+}
+
+/** a fan around p from angle a0 over angle */
+static void fan(const struct stroke_point *p, float a0, float angle)
+{
+    struct stroke_point c0, c1;
+    const int n = arc_steps(angle);
+    int i;
+
+    offset(&c0, p, half_width * cosf(a0), half_width * sinf(a0));
+    for (i = 1; i <= n; ++i) {
+	float a = a0 + angle * i / n;
+	offset(&c1, p, half_width * cosf(a), half_width * sinf(a));
+	triangle(p, &c0, &c1);
+	c0 = c1;
+    }
+}
+
+/** the join at p between a segment of direction d0 and one of d1 */
+static void join(const struct stroke_point *p, float d0x, float d0y,
+		 float d1x, float d1y)
+{
+    const float cross = d0x * d1y - d0y * d1x;
+    const float dot = d0x * d1x + d0y * d1y;
+    struct stroke_point a, b, tip;
+    float s, mx, my, len;
+
+    if (fabsf(cross) < 1e-6f && dot > 0) {
+	return;			/* straight on */
+    }
+    /* the outer side is the one away from the turn */
+    s = cross > 0 ? 1 : -1;
+    offset(&a, p, s * d0y * half_width, -s * d0x * half_width);
+    offset(&b, p, s * d1y * half_width, -s * d1x * half_width);
+
+    switch (join_mode) {
+    case ROUND:
+	fan(p, atan2f(a.y - p->y, a.x - p->x), atan2f(cross, dot));
+	return;
+    case MITER:
+	mx = s * (d0y + d1y);
+	my = -s * (d0x + d1x);
+	len = sqrtf(mx * mx + my * my);
+	/* cos of half the turn is len / 2 */
+	if (len > 2 / MITER_LIMIT) {
+	    float l = 2 * half_width / (len * len);
+	    offset(&tip, p, mx * l, my * l);
+	    triangle(p, &a, &tip);
+	    triangle(p, &tip, &b);
+	    return;
+	}
+	/* fall through */
+    case BEVEL:
+    default:
+	triangle(p, &a, &b);
+    }
+}
+
+/** the cap at p, the end of a line of direction (dx, dy) */
+static void cap(const struct stroke_point *p, float dx, float dy)
+{
+    switch (cap_mode) {
+    case ROUND:
+	fan(p, atan2f(-dx, dy), M_PI);
+	break;
+    default:
+	/* PROJECT moves the end of the segment instead, SQUARE is flat */
+	break;
+    }
+}
+
+void stroke_dot(const struct stroke_point *p)
+{
+    struct stroke_point c[4];
+
+    if (cap_mode == ROUND) {
+	fan(p, 0, 2 * M_PI);
+	return;
+    }
+    offset(&c[0], p, -half_width, -half_width);
+    offset(&c[1], p, half_width, -half_width);
+    offset(&c[2], p, half_width, half_width);
+    offset(&c[3], p, -half_width, half_width);
+    triangle(&c[0], &c[1], &c[2]);
+    triangle(&c[0], &c[2], &c[3]);
+}
+
+/** n points, repeated points are skipped.  closed joins the last point
+ * to the first and has no caps. */
+void stroke_polyline(const struct stroke_point *p, int n, int closed)
+{
+    const struct stroke_point *p0, *p1;
+    struct stroke_point c[4];
+    float dx, dy, d0x = 0, d0y = 0, first_dx = 0, first_dy = 0, len;
+    float nx, ny;
+    int i, segments = 0, count = closed ? n : n - 1;
+
+    if (n <= 0) {
+	return;
+    }
+    for (i = 0; i < count; ++i) {
+	p0 = &p[i];
+	p1 = &p[(i + 1) % n];
+	dx = p1->x - p0->x;
+	dy = p1->y - p0->y;
+	len = sqrtf(dx * dx + dy * dy);
+	if (len < 1e-6f) {
+	    continue;
+	}
+	dx /= len;
+	dy /= len;
+	nx = dy * half_width;
+	ny = -dx * half_width;
+
+	offset(&c[0], p0, nx, ny);
+	offset(&c[1], p0, -nx, -ny);
+	offset(&c[2], p1, nx, ny);
+	offset(&c[3], p1, -nx, -ny);
+	if (!closed && cap_mode == PROJECT) {
+	    if (segments == 0) {
+		c[0].x -= dx * half_width;
+		c[0].y -= dy * half_width;
+		c[1].x -= dx * half_width;
+		c[1].y -= dy * half_width;
+	    }
+	    if (i == count - 1) {
+		c[2].x += dx * half_width;
+		c[2].y += dy * half_width;
+		c[3].x += dx * half_width;
+		c[3].y += dy * half_width;
+	    }
+	}
+	triangle(&c[0], &c[1], &c[2]);
+	triangle(&c[2], &c[1], &c[3]);
+
+	if (segments == 0) {
+	    first_dx = dx;
+	    first_dy = dy;
+	    if (!closed) {
+		cap(p0, -dx, -dy);
+	    }
+	} else {
+	    join(p0, d0x, d0y, dx, dy);
+	}
+	d0x = dx;
+	d0y = dy;
+	++segments;
+    }
+
+    if (segments == 0) {
+	/* all points in one place */
+	stroke_dot(p);
+    } else if (closed) {
+	join(&p[0], d0x, d0y, first_dx, first_dy);
+    } else {
+	cap(&p[n - 1], d0x, d0y);
+    }
+}
+
+/** draw everything tessellated so far */
+int stroke_flush(void)
+{
+    if (!buf_len) {
+	return 0;
+    }
+    glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
+    /* the stroke lies in the plane of the fill, keep it in front */
+    glEnable(GL_POLYGON_OFFSET_FILL);
+    glPolygonOffset(-1, -1);
+    glEnableClientState(GL_VERTEX_ARRAY);
+    glEnableClientState(GL_COLOR_ARRAY);
+    glVertexPointer(3, GL_FLOAT, sizeof(*buf), &buf->x);
+    glColorPointer(4, GL_UNSIGNED_BYTE, sizeof(*buf), &buf->color);
+    glDrawArrays(GL_TRIANGLES, 0, buf_len);
+    glDisableClientState(GL_COLOR_ARRAY);
+    glDisableClientState(GL_VERTEX_ARRAY);
+    glDisable(GL_POLYGON_OFFSET_FILL);
+    buf_len = 0;
+    return 0;
+}
+
+/** hand everything tessellated so far to depthsort.c instead */
+void stroke_sort(void)
+{
+    int i;
+
+    depth_sort_begin();
+    for (i = 0; i + 2 < buf_len; i += 3) {
+	depth_sort_triangle(&buf[i], &buf[i + 1], &buf[i + 2]);
+    }
+    buf_len = 0;
+}
+
+void stroke_end(void)
+{
+    free(buf);
+    buf = NULL;
+    buf_len = buf_size = 0;
+}
@@ -0,0 +1,498 @@
+/** Bitmap text.  The glyphs of a font are rasterized once into an alpha
+ * texture atlas, 16 glyphs a row.  A string is laid out into an array of
+ * textured quads and drawn with a single glDrawArrays(); layouts are
+ * cached by string, so a label drawn every frame is laid out once. */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <errno.h>
+#include <string.h>
+#include <GL/gl.h>
+
+#include "gl_internal.h"
+
+#define ATLAS_COLUMNS (16)
+#define LAYOUT_CACHE_SIZE (64)	/* must be a power of two */
+
+struct font {
+    int width, height;		/**< glyph cell in pixels */
+    int ascent;			/**< rows above the baseline */
+    int first, count;		/**< the chars covered */
+    int lsb_first;		/**< bit order of the rows */
+    const unsigned char *bits;	/**< (width + 7) / 8 bytes a row */
+    unsigned char *data;	/**< bits, if we own them */
+    GLuint texture;
+    int tex_width, tex_height;
+    int uploaded;
+};
+
+/* a laid out string, x, y, s, t for each corner of each quad */
+struct layout {
+    char *str;
+    float size;
+    unsigned int generation;
+    int quads;
+    float *verts;
+};
+
+/* the public domain 8x8 font of the IBM PC BIOS, chars 32 to 126,
+ * least significant bit leftmost */
+static const unsigned char font8x8[95][8] = {
+    {0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00},	/* ' ' */
+    {0x18, 0x3C, 0x3C, 0x18, 0x18, 0x00, 0x18, 0x00},	/* ! */
+    {0x36, 0x36, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00},	/* " */
+    {0x36, 0x36, 0x7F, 0x36, 0x7F, 0x36, 0x36, 0x00},	/* # */
+    {0x0C, 0x3E, 0x03, 0x1E, 0x30, 0x1F, 0x0C, 0x00},	/* $ */
+    {0x00, 0x63, 0x33, 0x18, 0x0C, 0x66, 0x63, 0x00},	/* % */
+    {0x1C, 0x36, 0x1C, 0x6E, 0x3B, 0x33, 0x6E, 0x00},	/* & */
+    {0x06, 0x06, 0x03, 0x00, 0x00, 0x00, 0x00, 0x00},	/* ' */
+    {0x18, 0x0C, 0x06, 0x06, 0x06, 0x0C, 0x18, 0x00},	/* ( */
+    {0x06, 0x0C, 0x18, 0x18, 0x18, 0x0C, 0x06, 0x00},	/* ) */
+    {0x00, 0x66, 0x3C, 0xFF, 0x3C, 0x66, 0x00, 0x00},	/* * */
+    {0x00, 0x0C, 0x0C, 0x3F, 0x0C, 0x0C, 0x00, 0x00},	/* + */
+    {0x00, 0x00, 0x00, 0x00, 0x00, 0x0C, 0x0C, 0x06},	/* , */
+    {0x00, 0x00, 0x00, 0x3F, 0x00, 0x00, 0x00, 0x00},	/* - */
+    {0x00, 0x00, 0x00, 0x00, 0x00, 0x0C, 0x0C, 0x00},	/* . */
+    {0x60, 0x30, 0x18, 0x0C, 0x06, 0x03, 0x01, 0x00},	/* / */
+    {0x3E, 0x63, 0x73, 0x7B, 0x6F, 0x67, 0x3E, 0x00},	/* 0 */
+    {0x0C, 0x0E, 0x0C, 0x0C, 0x0C, 0x0C, 0x3F, 0x00},	/* 1 */
+    {0x1E, 0x33, 0x30, 0x1C, 0x06, 0x33, 0x3F, 0x00},	/* 2 */
+    {0x1E, 0x33, 0x30, 0x1C, 0x30, 0x33, 0x1E, 0x00},	/* 3 */
+    {0x38, 0x3C, 0x36, 0x33, 0x7F, 0x30, 0x78, 0x00},	/* 4 */
+    {0x3F, 0x03, 0x1F, 0x30, 0x30, 0x33, 0x1E, 0x00},	/* 5 */
+    {0x1C, 0x06, 0x03, 0x1F, 0x33, 0x33, 0x1E, 0x00},	/* 6 */
+    {0x3F, 0x33, 0x30, 0x18, 0x0C, 0x0C, 0x0C, 0x00},	/* 7 */
+    {0x1E, 0x33, 0x33, 0x1E, 0x33, 0x33, 0x1E, 0x00},	/* 8 */
+    {0x1E, 0x33, 0x33, 0x3E, 0x30, 0x18, 0x0E, 0x00},	/* 9 */
+    {0x00, 0x0C, 0x0C, 0x00, 0x00, 0x0C, 0x0C, 0x00},	/* : */
+    {0x00, 0x0C, 0x0C, 0x00, 0x00, 0x0C, 0x0C, 0x06},	/* ; */
+    {0x18, 0x0C, 0x06, 0x03, 0x06, 0x0C, 0x18, 0x00},	/* < */
+    {0x00, 0x00, 0x3F, 0x00, 0x00, 0x3F, 0x00, 0x00},	/* = */
+    {0x06, 0x0C, 0x18, 0x30, 0x18, 0x0C, 0x06, 0x00},	/* > */
+    {0x1E, 0x33, 0x30, 0x18, 0x0C, 0x00, 0x0C, 0x00},	/* ? */
+    {0x3E, 0x63, 0x7B, 0x7B, 0x7B, 0x03, 0x1E, 0x00},	/* @ */
+    {0x0C, 0x1E, 0x33, 0x33, 0x3F, 0x33, 0x33, 0x00},	/* A */
+    {0x3F, 0x66, 0x66, 0x3E, 0x66, 0x66, 0x3F, 0x00},	/* B */
+    {0x3C, 0x66, 0x03, 0x03, 0x03, 0x66, 0x3C, 0x00},	/* C */
+    {0x1F, 0x36, 0x66, 0x66, 0x66, 0x36, 0x1F, 0x00},	/* D */
+    {0x7F, 0x46, 0x16, 0x1E, 0x16, 0x46, 0x7F, 0x00},	/* E */
+    {0x7F, 0x46, 0x16, 0x1E, 0x16, 0x06, 0x0F, 0x00},	/* F */
+    {0x3C, 0x66, 0x03, 0x03, 0x73, 0x66, 0x7C, 0x00},	/* G */
+    {0x33, 0x33, 0x33, 0x3F, 0x33, 0x33, 0x33, 0x00},	/* H */
+    {0x1E, 0x0C, 0x0C, 0x0C, 0x0C, 0x0C, 0x1E, 0x00},	/* I */
+    {0x78, 0x30, 0x30, 0x30, 0x33, 0x33, 0x1E, 0x00},	/* J */
+    {0x67, 0x66, 0x36, 0x1E, 0x36, 0x66, 0x67, 0x00},	/* K */
+    {0x0F, 0x06, 0x06, 0x06, 0x46, 0x66, 0x7F, 0x00},	/* L */
+    {0x63, 0x77, 0x7F, 0x7F, 0x6B, 0x63, 0x63, 0x00},	/* M */
+    {0x63, 0x67, 0x6F, 0x7B, 0x73, 0x63, 0x63, 0x00},	/* N */
+    {0x1C, 0x36, 0x63, 0x63, 0x63, 0x36, 0x1C, 0x00},	/* O */
+    {0x3F, 0x66, 0x66, 0x3E, 0x06, 0x06, 0x0F, 0x00},	/* P */
+    {0x1E, 0x33, 0x33, 0x33, 0x3B, 0x1E, 0x38, 0x00},	/* Q */
+    {0x3F, 0x66, 0x66, 0x3E, 0x36, 0x66, 0x67, 0x00},	/* R */
+    {0x1E, 0x33, 0x07, 0x0E, 0x38, 0x33, 0x1E, 0x00},	/* S */
+    {0x3F, 0x2D, 0x0C, 0x0C, 0x0C, 0x0C, 0x1E, 0x00},	/* T */
+    {0x33, 0x33, 0x33, 0x33, 0x33, 0x33, 0x3F, 0x00},	/* U */
+    {0x33, 0x33, 0x33, 0x33, 0x33, 0x1E, 0x0C, 0x00},	/* V */
+    {0x63, 0x63, 0x63, 0x6B, 0x7F, 0x77, 0x63, 0x00},	/* W */
+    {0x63, 0x63, 0x36, 0x1C, 0x1C, 0x36, 0x63, 0x00},	/* X */
+    {0x33, 0x33, 0x33, 0x1E, 0x0C, 0x0C, 0x1E, 0x00},	/* Y */
+    {0x7F, 0x63, 0x31, 0x18, 0x4C, 0x66, 0x7F, 0x00},	/* Z */
+    {0x1E, 0x06, 0x06, 0x06, 0x06, 0x06, 0x1E, 0x00},	/* [ */
+    {0x03, 0x06, 0x0C, 0x18, 0x30, 0x60, 0x40, 0x00},	/* \ */
+    {0x1E, 0x18, 0x18, 0x18, 0x18, 0x18, 0x1E, 0x00},	/* ] */
+    {0x08, 0x1C, 0x36, 0x63, 0x00, 0x00, 0x00, 0x00},	/* ^ */
+    {0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0xFF},	/* _ */
+    {0x0C, 0x0C, 0x18, 0x00, 0x00, 0x00, 0x00, 0x00},	/* ` */
+    {0x00, 0x00, 0x1E, 0x30, 0x3E, 0x33, 0x6E, 0x00},	/* a */
+    {0x07, 0x06, 0x06, 0x3E, 0x66, 0x66, 0x3B, 0x00},	/* b */
+    {0x00, 0x00, 0x1E, 0x33, 0x03, 0x33, 0x1E, 0x00},	/* c */
+    {0x38, 0x30, 0x30, 0x3E, 0x33, 0x33, 0x6E, 0x00},	/* d */
+    {0x00, 0x00, 0x1E, 0x33, 0x3F, 0x03, 0x1E, 0x00},	/* e */
+    {0x1C, 0x36, 0x06, 0x0F, 0x06, 0x06, 0x0F, 0x00},	/* f */
+    {0x00, 0x00, 0x6E, 0x33, 0x33, 0x3E, 0x30, 0x1F},	/* g */
+    {0x07, 0x06, 0x36, 0x6E, 0x66, 0x66, 0x67, 0x00},	/* h */
+    {0x0C, 0x00, 0x0E, 0x0C, 0x0C, 0x0C, 0x1E, 0x00},	/* i */
+    {0x30, 0x00, 0x30, 0x30, 0x30, 0x33, 0x33, 0x1E},	/* j */
+    {0x07, 0x06, 0x66, 0x36, 0x1E, 0x36, 0x67, 0x00},	/* k */
+    {0x0E, 0x0C, 0x0C, 0x0C, 0x0C, 0x0C, 0x1E, 0x00},	/* l */
+    {0x00, 0x00, 0x33, 0x7F, 0x7F, 0x6B, 0x63, 0x00},	/* m */
+    {0x00, 0x00, 0x1F, 0x33, 0x33, 0x33, 0x33, 0x00},	/* n */
+    {0x00, 0x00, 0x1E, 0x33, 0x33, 0x33, 0x1E, 0x00},	/* o */
+    {0x00, 0x00, 0x3B, 0x66, 0x66, 0x3E, 0x06, 0x0F},	/* p */
+    {0x00, 0x00, 0x6E, 0x33, 0x33, 0x3E, 0x30, 0x78},	/* q */
+    {0x00, 0x00, 0x3B, 0x6E, 0x66, 0x06, 0x0F, 0x00},	/* r */
+    {0x00, 0x00, 0x3E, 0x03, 0x1E, 0x30, 0x1F, 0x00},	/* s */
+    {0x08, 0x0C, 0x3E, 0x0C, 0x0C, 0x2C, 0x18, 0x00},	/* t */
+    {0x00, 0x00, 0x33, 0x33, 0x33, 0x33, 0x6E, 0x00},	/* u */
+    {0x00, 0x00, 0x33, 0x33, 0x33, 0x1E, 0x0C, 0x00},	/* v */
+    {0x00, 0x00, 0x63, 0x6B, 0x7F, 0x7F, 0x36, 0x00},	/* w */
+    {0x00, 0x00, 0x63, 0x36, 0x1C, 0x36, 0x63, 0x00},	/* x */
+    {0x00, 0x00, 0x33, 0x33, 0x33, 0x3E, 0x30, 0x1F},	/* y */
+    {0x00, 0x00, 0x3F, 0x19, 0x0C, 0x26, 0x3F, 0x00},	/* z */
+    {0x38, 0x0C, 0x0C, 0x07, 0x0C, 0x0C, 0x38, 0x00},	/* { */
+    {0x18, 0x18, 0x18, 0x00, 0x18, 0x18, 0x18, 0x00},	/* | */
+    {0x07, 0x0C, 0x0C, 0x38, 0x0C, 0x0C, 0x07, 0x00},	/* } */
+    {0x6E, 0x3B, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00},	/* ~ */
+};
+
+static __thread struct font builtin_font = {
+    .width = 8,
+    .height = 8,
+    .ascent = 7,
+    .first = 32,
+    .count = 95,
+    .lsb_first = 1,
+    .bits = &font8x8[0][0],
+};
+
+static __thread struct font *cur_font = NULL;	/* the built-in font */
+static __thread unsigned int font_generation = 1;
+static __thread float cur_size = 0;	/* 0 is the height of the font */
+static __thread struct layout layout_cache[LAYOUT_CACHE_SIZE];
+
+
+/********************************************************************
+ * Fonts
+ ********************************************************************/
+
+static inline int next_pow2(int n)
+{
+    int p = 1;
+    while (p < n) {
+	p <<= 1;
+    }
+    return p;
+}
+
+static inline int glyph_bit(const struct font *f, int glyph, int x, int y)
+{
+    const int pitch = (f->width + 7) / 8;
+    const unsigned char *row = f->bits + (glyph * f->height + y) * pitch;
+
+    if (f->lsb_first) {
+	return row[x / 8] >> (x % 8) & 1;
+    }
+    return row[x / 8] >> (7 - x % 8) & 1;
+}
+
+/** rasterize the glyphs into the atlas texture.  a shape recorded with
+ * GL_COMPILE doesn't execute the upload, then it is done again. */
+static int font_upload(struct font *f)
+{
+    const int rows = (f->count + ATLAS_COLUMNS - 1) / ATLAS_COLUMNS;
+    unsigned char *pixels;
+    GLint list_index, list_mode;
+    int g, x, y, px, py;
+
+    f->tex_width = next_pow2(ATLAS_COLUMNS * f->width);
+    f->tex_height = next_pow2(rows * f->height);
+    pixels = calloc(f->tex_width, f->tex_height);
+    if (!pixels) {
+	psr_system_error(errno, "No memory for the glyph atlas.");
+    }
+    for (g = 0; g < f->count; ++g) {
+	px = g % ATLAS_COLUMNS * f->width;
+	py = g / ATLAS_COLUMNS * f->height;
+	for (y = 0; y < f->height; ++y) {
+	    for (x = 0; x < f->width; ++x) {
+		if (glyph_bit(f, g, x, y)) {
+		    pixels[(py + y) * f->tex_width + px + x] = 0xff;
+		}
+	    }
+	}
+    }
+
+    if (!f->texture) {
+	glGenTextures(1, &f->texture);
+    }
+    glBindTexture(GL_TEXTURE_2D, f->texture);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_ALPHA, f->tex_width, f->tex_height,
+		 0, GL_ALPHA, GL_UNSIGNED_BYTE, pixels);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    /* bitmap fonts stay sharp when scaled */
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP);
+    free(pixels);
+
+    glGetIntegerv(GL_LIST_INDEX, &list_index);
+    glGetIntegerv(GL_LIST_MODE, &list_mode);
+    f->uploaded = !list_index || list_mode == GL_COMPILE_AND_EXECUTE;
+    return 0;
+}
+
+static void font_free(struct font *f)
+{
+    if (f->texture) {
+	glDeleteTextures(1, &f->texture);
+	f->texture = 0;
+    }
+    f->uploaded = 0;
+    if (f != &builtin_font) {
+	free(f->data);
+	free(f);
+    }
+}
+
+static inline uint32_t le32(const unsigned char *p)
+{
+    return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t) p[3] << 24;
+}
+
+/** PSF 1 and 2, the console fonts of linux.  not gzipped. */
+static struct font *font_load(const char *path)
+{
+    unsigned char header[32];
+    struct font *f;
+    size_t offset, bytes;
+    FILE *fp;
+
+    fp = fopen(path, "r");
+    if (!fp) {
+	psr_warn("can't open font %s", path);
+	return NULL;
+    }
+    f = calloc(1, sizeof(*f));
+    if (!f) {
+	psr_system_error(errno, "No memory for font.");
+    }
+    if (fread(header, 1, 4, fp) == 4 && header[0] == 0x36
+	&& header[1] == 0x04) {
+	f->width = 8;
+	f->height = header[3];
+	f->count = header[2] & 0x01 ? 512 : 256;
+	offset = 4;
+    } else if (le32(header) == 0x864ab572
+	       && fread(header + 4, 1, 28, fp) == 28) {
+	offset = le32(header + 8);
+	f->count = le32(header + 16);
+	f->height = le32(header + 24);
+	f->width = le32(header + 28);
+    } else {
+	psr_warn("%s is not a PSF font", path);
+	goto error_exit;
+    }
+    if (f->width <= 0 || f->height <= 0 || f->width > 64
+	|| f->height > 64 || f->count <= 0 || f->count > 65536) {
+	psr_warn("%s: bad glyph size", path);
+	goto error_exit;
+    }
+    bytes = (size_t) f->count * f->height * ((f->width + 7) / 8);
+    f->data = malloc(bytes);
+    if (!f->data) {
+	psr_system_error(errno, "No memory for font.");
+    }
+    if (fseek(fp, offset, SEEK_SET) || fread(f->data, 1, bytes, fp) != bytes) {
+	psr_warn("%s is truncated", path);
+	goto error_exit;
+    }
+    fclose(fp);
+    f->bits = f->data;
+    f->ascent = f->height - f->height / 4;
+    f->first = 0;
+    return f;
+
+error_exit:
+    fclose(fp);
+    free(f->data);
+    free(f);
+    return NULL;
+}
+
+
+/********************************************************************
+ * Layout
+ ********************************************************************/
+
+static inline uint32_t hash_str(const char *s)
+{
+    uint32_t h = 2166136261u;	/* FNV-1a */
+    while (*s) {
+	h = (h ^ (unsigned char) *s++) * 16777619u;
+    }
+    return h;
+}
+
+static void layout_free(struct layout *l)
+{
+    free(l->str);
+    free(l->verts);
+    memset(l, 0, sizeof(*l));
+}
+
+/** quads relative to the start of the baseline of the first line */
+static int layout_build(struct layout *l, const char *str, float size)
+{
+    const struct font *f = cur_font;
+    const float scale = size / f->height;
+    const float w = f->width * scale, h = f->height * scale;
+    const float top = -f->ascent * scale;
+    float x = 0, y = 0, s, t, *v;
+    int glyph;
+
+    l->str = strdup(str);
+    l->verts = malloc(strlen(str) * 16 * sizeof(*l->verts));
+    if (!l->str || (!l->verts && *str)) {
+	psr_system_error(errno, "No memory for text layout.");
+    }
+    l->size = size;
+    l->generation = font_generation;
+    l->quads = 0;
+
+    for (v = l->verts; *str; ++str) {
+	if (*str == '\n') {
+	    x = 0;
+	    y += h;
+	    continue;
+	}
+	glyph = (unsigned char) *str - f->first;
+	if (glyph < 0 || glyph >= f->count) {
+	    glyph = '?' - f->first;
+	}
+	if (*str != ' ' && glyph >= 0 && glyph < f->count) {
+	    s = (float) (glyph % ATLAS_COLUMNS * f->width) / f->tex_width;
+	    t = (float) (glyph / ATLAS_COLUMNS * f->height) / f->tex_height;
+	    v[0] = x;
+	    v[1] = y + top;
+	    v[2] = s;
+	    v[3] = t;
+	    v[4] = x;
+	    v[5] = y + top + h;
+	    v[6] = s;
+	    v[7] = t + (float) f->height / f->tex_height;
+	    v[8] = x + w;
+	    v[9] = y + top + h;
+	    v[10] = s + (float) f->width / f->tex_width;
+	    v[11] = v[7];
+	    v[12] = x + w;
+	    v[13] = y + top;
+	    v[14] = v[10];
+	    v[15] = t;
+	    v += 16;
+	    ++l->quads;
+	}
+	x += w;
+    }
+    return 0;
+}
+
+/** the cache is direct mapped, a collision replaces the older string */
+static struct layout *layout_get(const char *str, float size)
+{
+    struct layout *l = &layout_cache[hash_str(str) & (LAYOUT_CACHE_SIZE - 1)];
+
+    if (l->str && l->size == size && l->generation == font_generation
+	&& strcmp(l->str, str) == 0) {
+	return l;
+    }
+    layout_free(l);
+    layout_build(l, str, size);
+    return l;
+}
+
+
+/********************************************************************
+ * Text functions
+ ********************************************************************/
+
+/** NULL goes back to the built-in font */
+static int text_font(const char *path)
+{
+    struct font *f = &builtin_font;
+
+    if (path) {
+	f = font_load(path);
+	if (!f) {
+	    return -1;
+	}
+    }
+    if (cur_font != &builtin_font) {
+	font_free(cur_font);
+    }
+    cur_font = f;
+    ++font_generation;
+    return 0;
+}
+
+static int text_size(float size)
+{
+    if (size <= 0) {
+	psr_error("invalid 'size' argument.");
+	return -1;
+    }
+    cur_size = size;
+    return 0;
+}
+
+static int text(const char *str, float x, float y)
+{
+    struct rgba8 color;
+    struct layout *l;
+
+    if (!str) {
+	psr_error("invalid 'str' argument.");
+	return -1;
+    }
+    if (!gl_fill_color(&color)) {
+	return 0;
+    }
+    if (!cur_font->uploaded) {
+	font_upload(cur_font);
+    }
+    l = layout_get(str, cur_size ? cur_size : cur_font->height);
+    if (!l->quads) {
+	return 0;
+    }
+
+    gl_flat_load();
+    glPushMatrix();
+    glTranslatef(x, y, 0);
+    glEnable(GL_TEXTURE_2D);
+    glBindTexture(GL_TEXTURE_2D, cur_font->texture);
+    glTexEnvi(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_MODULATE);
+    glColor4ubv(&color.r);
+    glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
+
+    glEnableClientState(GL_VERTEX_ARRAY);
+    glEnableClientState(GL_TEXTURE_COORD_ARRAY);
+    glVertexPointer(2, GL_FLOAT, 4 * sizeof(float), l->verts);
+    glTexCoordPointer(2, GL_FLOAT, 4 * sizeof(float), l->verts + 2);
+    glDrawArrays(GL_QUADS, 0, l->quads * 4);
+    glDisableClientState(GL_TEXTURE_COORD_ARRAY);
+    glDisableClientState(GL_VERTEX_ARRAY);
+
+    glDisable(GL_TEXTURE_2D);
+    glPopMatrix();
+    return 0;
+}
+
+
+/********************************************************************
+ * Other functions
+ ********************************************************************/
+
+int gl_text_init(struct psr_renderer_context *renderer_cxt)
+{
+    cur_font = &builtin_font;
+    renderer_cxt->text_font = text_font;
+    renderer_cxt->text_size = text_size;
+    renderer_cxt->text = text;
+    return 0;
+}
+
+int gl_text_end(void)
+{
+    int i;
+
+    for (i = 0; i < LAYOUT_CACHE_SIZE; ++i) {
+	layout_free(&layout_cache[i]);
+    }
+    font_free(cur_font);
+    if (cur_font != &builtin_font) {
+	font_free(&builtin_font);
+    }
+    cur_font = &builtin_font;
+    return 0;
+}
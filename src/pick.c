@@ -0,0 +1,280 @@
+/** Picking.  While pick_id() is set the renderer reports the window
+ * bounds of every primitive it draws here.  At the end of the frame the
+ * bounds are put into a uniform grid and published; pick() and
+ * pick_rect() answer from the last published frame, which is the one on
+ * the screen.
+ *
+ * The renderer may run on another thread than the sketch (see
+ * cmdbuf.c), so there are two frames: the renderer fills one without a
+ * lock, the queries read the other under the lock. */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+
+#include "psr_internal.h"
+
+#define PICK_CELL (32)		/* pixels */
+
+struct pick_box {
+    int id;
+    float x0, y0, x1, y1;
+};
+
+struct pick_frame {
+    struct pick_box *boxes;
+    int count, size;
+    int cols, rows;
+    /* the boxes of cell c are items[cells[c]] up to items[cells[c + 1]] */
+    int *cells, *items;
+    int cells_size, items_size;
+};
+
+struct psr_pick {
+    struct pick_frame frames[2];
+    struct pick_frame *back, *front;
+    pthread_mutex_t front_lock;
+};
+
+static void *grow(void *p, int *size, int need, size_t elem)
+{
+    if (need <= *size) {
+	return p;
+    }
+    while (*size < need) {
+	*size = *size ? *size * 2 : 256;
+    }
+    p = realloc(p, *size * elem);
+    if (!p) {
+	psr_system_error(errno, "No memory for picking.");
+    }
+    return p;
+}
+
+int psr_pick_start(struct psr_ctx *ctx)
+{
+    struct psr_pick *p;
+
+    p = calloc(1, sizeof(*p));
+    if (!p) {
+	psr_system_error(errno, "No memory for picking.");
+	return -1;
+    }
+    p->back = &p->frames[0];
+    p->front = &p->frames[1];
+    pthread_mutex_init(&p->front_lock, NULL);
+    ctx->pick = p;
+    return 0;
+}
+
+void psr_pick_end(struct psr_ctx *ctx)
+{
+    struct psr_pick *p = ctx->pick;
+    int i;
+
+    if (!p) {
+	return;
+    }
+    for (i = 0; i < 2; ++i) {
+	free(p->frames[i].boxes);
+	free(p->frames[i].cells);
+	free(p->frames[i].items);
+    }
+    pthread_mutex_destroy(&p->front_lock);
+    free(p);
+    ctx->pick = NULL;
+}
+
+/** the renderer drew primitive id within these window coordinates */
+void psr_pick_add(int id, float x0, float y0, float x1, float y1)
+{
+    struct pick_frame *back = psr_current->pick->back;
+    struct pick_box *b;
+
+    back->boxes = grow(back->boxes, &back->size, back->count + 1,
+		       sizeof(*back->boxes));
+    b = &back->boxes[back->count++];
+    b->id = id;
+    b->x0 = x0;
+    b->y0 = y0;
+    b->x1 = x1;
+    b->y1 = y1;
+}
+
+/** the cell of coordinate v, clipped to n cells */
+static inline int cell_of(float v, int n)
+{
+    return v < 0 ? 0 : (v >= n * PICK_CELL ? n - 1 : (int) v / PICK_CELL);
+}
+
+/** the cells a box covers, clipped to the grid */
+static inline void cell_range(const struct pick_frame *f, float x0, float y0,
+			      float x1, float y1, int *c0, int *r0, int *c1,
+			      int *r1)
+{
+    *c0 = cell_of(x0, f->cols);
+    *r0 = cell_of(y0, f->rows);
+    *c1 = cell_of(x1, f->cols);
+    *r1 = cell_of(y1, f->rows);
+}
+
+/** bucket the boxes into cells, a counting sort */
+static void build_grid(struct pick_frame *f, int width, int height)
+{
+    int i, r, c, c0, r0, c1, r1, total;
+
+    f->cols = (width + PICK_CELL - 1) / PICK_CELL;
+    f->rows = (height + PICK_CELL - 1) / PICK_CELL;
+    if (f->cols < 1) {
+	f->cols = 1;
+    }
+    if (f->rows < 1) {
+	f->rows = 1;
+    }
+    f->cells = grow(f->cells, &f->cells_size, f->cols * f->rows + 1,
+		    sizeof(*f->cells));
+    memset(f->cells, 0, (f->cols * f->rows + 1) * sizeof(*f->cells));
+
+    for (i = 0; i < f->count; ++i) {
+	const struct pick_box *b = &f->boxes[i];
+
+	cell_range(f, b->x0, b->y0, b->x1, b->y1, &c0, &r0, &c1, &r1);
+	for (r = r0; r <= r1; ++r) {
+	    for (c = c0; c <= c1; ++c) {
+		++f->cells[r * f->cols + c + 1];
+	    }
+	}
+    }
+    for (i = 1; i <= f->cols * f->rows; ++i) {
+	f->cells[i] += f->cells[i - 1];
+    }
+    total = f->cells[f->cols * f->rows];
+    f->items = grow(f->items, &f->items_size, total, sizeof(*f->items));
+    /* fill with cells[c] as the cursor, then shift it back */
+    for (i = 0; i < f->count; ++i) {
+	const struct pick_box *b = &f->boxes[i];
+
+	cell_range(f, b->x0, b->y0, b->x1, b->y1, &c0, &r0, &c1, &r1);
+	for (r = r0; r <= r1; ++r) {
+	    for (c = c0; c <= c1; ++c) {
+		f->items[f->cells[r * f->cols + c]++] = i;
+	    }
+	}
+    }
+    for (i = f->cols * f->rows; i > 0; --i) {
+	f->cells[i] = f->cells[i - 1];
+    }
+    f->cells[0] = 0;
+}
+
+/** the frame is complete, make it the one pick() answers from */
+void psr_pick_frame(int width, int height)
+{
+    struct psr_pick *p = psr_current->pick;
+    struct pick_frame *f = p->back;
+
+    build_grid(f, width, height);
+    pthread_mutex_lock(&p->front_lock);
+    p->back = p->front;
+    p->front = f;
+    pthread_mutex_unlock(&p->front_lock);
+    p->back->count = 0;
+}
+
+static inline int inside(const struct pick_box *b, float x, float y)
+{
+    return x >= b->x0 && x <= b->x1 && y >= b->y0 && y <= b->y1;
+}
+
+/** the id of the primitive drawn last at x, y, 0 for none */
+int pick(float x, float y)
+{
+    struct psr_pick *p = psr_current->pick;
+    const struct pick_frame *f;
+    int i, c, r, best = -1;
+
+    if (!p) {
+	psr_error("no picking before the sketch runs.");
+	return -1;
+    }
+    pthread_mutex_lock(&p->front_lock);
+    f = p->front;
+    if (f->count && x >= 0 && y >= 0) {
+	c = x / PICK_CELL;
+	r = y / PICK_CELL;
+	if (c < f->cols && r < f->rows) {
+	    const int cell = r * f->cols + c;
+
+	    for (i = f->cells[cell]; i < f->cells[cell + 1]; ++i) {
+		const int k = f->items[i];
+
+		/* later is on top */
+		if (k > best && inside(&f->boxes[k], x, y)) {
+		    best = k;
+		}
+	    }
+	}
+    }
+    r = best < 0 ? 0 : f->boxes[best].id;
+    pthread_mutex_unlock(&p->front_lock);
+    return r;
+}
+
+/** up to max ids of the primitives that overlap the rectangle, in no
+ * particular order.  returns how many there are, which may be more
+ * than max. */
+int pick_rect(float x0, float y0, float x1, float y1, int *ids, int max)
+{
+    struct psr_pick *p = psr_current->pick;
+    const struct pick_frame *f;
+    int i, r, c, c0, r0, c1, r1, n = 0;
+
+    if (!p) {
+	psr_error("no picking before the sketch runs.");
+	return -1;
+    }
+    if (x1 < x0 || y1 < y0) {
+	psr_error("invalid rectangle.");
+	return -1;
+    }
+    if (!ids && max > 0) {
+	psr_error("invalid 'ids' argument.");
+	return -1;
+    }
+    pthread_mutex_lock(&p->front_lock);
+    f = p->front;
+    if (!f->count) {
+	pthread_mutex_unlock(&p->front_lock);
+	return 0;
+    }
+    cell_range(f, x0, y0, x1, y1, &c0, &r0, &c1, &r1);
+    for (r = r0; r <= r1; ++r) {
+	for (c = c0; c <= c1; ++c) {
+	    const int cell = r * f->cols + c;
+
+	    for (i = f->cells[cell]; i < f->cells[cell + 1]; ++i) {
+		const struct pick_box *b = &f->boxes[f->items[i]];
+		int bc, br, unused;
+
+		if (b->x1 < x0 || b->x0 > x1 || b->y1 < y0 || b->y0 > y1) {
+		    continue;
+		}
+		/* a box in several cells is reported by the cell of the
+		 * top left corner of the overlap only */
+		cell_range(f, b->x0 > x0 ? b->x0 : x0,
+			   b->y0 > y0 ? b->y0 : y0, 0, 0, &bc, &br, &unused,
+			   &unused);
+		if (bc != c || br != r) {
+		    continue;
+		}
+		if (n < max) {
+		    ids[n] = b->id;
+		}
+		++n;
+	    }
+	}
+    }
+    pthread_mutex_unlock(&p->front_lock);
+    return n;
+}
@@ -3,21 +3,25 @@
 
 #include <psr_common.h>
 
-extern volatile char key;
-extern volatile int key_code;
-extern volatile int mouse_x;
-extern volatile int mouse_y;
-extern volatile int mouse_button;
-extern volatile int p_mouse_x;
-extern volatile int p_mouse_y;
-extern volatile int width;
-extern volatile int height;
+/* of the current sketch of the thread */
+extern __thread volatile char key;
+extern __thread volatile int key_code;
+extern __thread volatile int mouse_x;
+extern __thread volatile int mouse_y;
+extern __thread volatile int mouse_button;
+extern __thread volatile int p_mouse_x;
+extern __thread volatile int p_mouse_y;
+extern __thread volatile int width;
+extern __thread volatile int height;
 
 extern int size(int width, int height);
 extern int no_loop(void);
 extern int loop(void);
 extern int redraw(void);
+extern int dirty_rect(float x, float y, float width, float height);
 extern int delay(int milliseconds);
+extern unsigned long frame_count(void);
+extern long millis(void);
 extern int frame_rate(float framerate);
 extern int cursor(int type);
 extern int no_cursor();
@@ -25,6 +29,7 @@ extern const char *binary(int i);
 extern int unbinary(const char *s);
 extern const char *hex(int i);
 extern int unhex(const char *s);
+extern int color_mode(int mode);
 extern int stroke(float r, float g, float b, float a);
 extern int no_stroke(void);
 extern int background(float r, float g, float b, float a);
@@ -66,12 +71,34 @@ extern int bezier(float x1, float y1, float z1,
 		  float cx1, float cy1, float cz1,
 		  float cx2, float cy2, float cz2,
 		  float x2, float y2, float z2);
+extern float bezier_point(float a, float b, float c, float d, float t);
+extern float bezier_tangent(float a, float b, float c, float d, float t);
+extern int bezier_points(float a, float b, float c, float d,
+			 const float *t, int n, float *points,
+			 float *tangents);
+extern int bezier_points_multi(const float *a, const float *b,
+			       const float *c, const float *d,
+			       const float *t, int n, float *points,
+			       float *tangents);
+extern int curve_detail(int level);
+extern int curve_tightness(float tightness);
+extern int curve_vertex(float x, float y, float z);
+extern int curve(float x1, float y1, float z1,
+		 float x2, float y2, float z2,
+		 float x3, float y3, float z3,
+		 float x4, float y4, float z4);
+extern float curve_point(float a, float b, float c, float d, float t);
+extern float curve_tangent(float a, float b, float c, float d, float t);
 extern int box(float width, float height, float depth);
 extern int sphere(float radius);
 extern int sphere_detail(int n);
+extern int auto_detail(float max_error);
 extern int stroke_weight(float width);
+extern int stroke_join(int join);
+extern int stroke_cap(int cap);
 extern int smooth(void);
 extern int no_smooth(void);
+extern int hint(int which);
 extern int fill(float r, float g, float b, float a);
 extern int no_fill(void);
 extern int save(struct psr_image *img);
@@ -84,7 +111,51 @@ extern int begin_camera(void);
 extern int end_camera(void);
 extern int ortho(float left, float right, float bottom, float top,
 		 float near, float far);
+extern int create_shape(void);
+extern int end_shape_record(void);
+extern int shape(int handle);
+extern int free_shape(int handle);
+extern int create_graphics(int width, int height);
+extern int free_graphics(int target);
+extern int begin_draw(int target);
+extern int end_draw(void);
+extern int image_graphics(int target, float x, float y, float width,
+			  float height);
+extern int create_layer(int depth, void (*draw) (void));
+extern int free_layer(int layer);
+extern int layer_dirty(int layer);
+extern int layer_blend(int layer, int mode);
+extern int layer_opacity(int layer, float opacity);
+extern int text_font(const char *path);
+extern int text_size(float size);
+extern int text(const char *str, float x, float y);
+extern int input_events(const struct psr_event **events);
+extern unsigned long culled_primitives(void);
+extern int pick_id(int id);
+extern int pick(float x, float y);
+extern int pick_rect(float x0, float y0, float x1, float y1, int *ids,
+		     int max);
+extern float noise(float x, float y, float z);
+extern int noise_grid(float *out, int cols, int rows, float x, float y,
+		      float z, float x_step, float y_step);
+extern int noise_detail(int octaves, float falloff);
+extern int noise_seed(unsigned long seed);
+extern float random_range(float low, float high);
+extern int random_array(float *out, int n, float low, float high);
+extern int random_seed(unsigned long seed);
 extern int processor_init(void);
 extern int processor_run(struct psr_usr_func *usr_func);
 
+/* several sketches in one process, each run on a thread of its own.
+ * the calls above go to the current sketch of the calling thread;
+ * processor_init() and processor_run() are the same for a single one. */
+struct psr_ctx;
+extern struct psr_ctx *psr_ctx_new(const char *renderer);
+extern int psr_ctx_setenv(struct psr_ctx *ctx, const char *name,
+			  const char *value);
+extern void psr_ctx_make_current(struct psr_ctx *ctx);
+extern struct psr_ctx *psr_ctx_get_current(void);
+extern int psr_ctx_run(struct psr_ctx *ctx, struct psr_usr_func *usr_func);
+extern void psr_ctx_free(struct psr_ctx *ctx);
+
 #endif				/* PROCESSING_H */
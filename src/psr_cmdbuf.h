@@ -0,0 +1,133 @@
+#ifndef PSR_CMDBUF_H
+#define PSR_CMDBUF_H
+
+#include <stdint.h>
+#include "psr_internal.h"
+
+/** Compact binary encoding of the renderer_context calls.  Every command
+ * is a 32-bit header word, the opcode in the low 8 bits and the number
+ * of argument words in the upper 24 bits, followed by the arguments,
+ * one 32-bit word each.  image() carries its pixels after the
+ * arguments, strings are a length word and the bytes with their NUL.
+ * New commands go at the end, so old traces stay readable. */
+
+enum psr_cmd_op {
+    PSR_CMD_SIZE = 1,
+    PSR_CMD_NO_LOOP,
+    PSR_CMD_LOOP,
+    PSR_CMD_REDRAW,
+    PSR_CMD_FRAME_RATE,
+    PSR_CMD_CURSOR,
+    PSR_CMD_STROKE,
+    PSR_CMD_NO_STROKE,
+    PSR_CMD_BACKGROUND,
+    PSR_CMD_PUSH_MATRIX,
+    PSR_CMD_POP_MATRIX,
+    PSR_CMD_APPLY_MATRIX,
+    PSR_CMD_RESET_MATRIX,
+    PSR_CMD_PRINT_MATRIX,
+    PSR_CMD_TRANSLATE,
+    PSR_CMD_ROTATE,
+    PSR_CMD_SCALE,
+    PSR_CMD_BEGIN_SHAPE,
+    PSR_CMD_VERTEX,
+    PSR_CMD_END_SHAPE,
+    PSR_CMD_ARC,
+    PSR_CMD_BEZIER_DETAIL,
+    PSR_CMD_BEZIER_VERTEX,
+    PSR_CMD_BOX,
+    PSR_CMD_SPHERE,
+    PSR_CMD_SPHERE_DETAIL,
+    PSR_CMD_STROKE_WEIGHT,
+    PSR_CMD_SMOOTH,
+    PSR_CMD_NO_SMOOTH,
+    PSR_CMD_FILL,
+    PSR_CMD_NO_FILL,
+    PSR_CMD_SAVE,
+    PSR_CMD_IMAGE,
+    PSR_CMD_CAMERA_DEFAULT,
+    PSR_CMD_CAMERA,
+    PSR_CMD_BEGIN_CAMERA,
+    PSR_CMD_END_CAMERA,
+    PSR_CMD_ORTHO,
+    PSR_CMD_CREATE_SHAPE,
+    PSR_CMD_END_SHAPE_RECORD,
+    PSR_CMD_SHAPE,
+    PSR_CMD_FREE_SHAPE,
+    PSR_CMD_FRAME,		/* start of a frame, only in traces */
+    PSR_CMD_TEXT_FONT,
+    PSR_CMD_TEXT_SIZE,
+    PSR_CMD_TEXT,
+    PSR_CMD_STROKE_JOIN,
+    PSR_CMD_STROKE_CAP,
+    PSR_CMD_CURVE_DETAIL,
+    PSR_CMD_CURVE_TIGHTNESS,
+    PSR_CMD_CURVE_VERTEX,
+    PSR_CMD_HINT,
+    PSR_CMD_PICK_ID,
+    PSR_CMD_AUTO_DETAIL,
+    PSR_CMD_DIRTY_RECT,
+    PSR_CMD_CREATE_GRAPHICS,
+    PSR_CMD_FREE_GRAPHICS,
+    PSR_CMD_BEGIN_DRAW,
+    PSR_CMD_END_DRAW,
+    PSR_CMD_IMAGE_GRAPHICS,
+    PSR_CMD_COMPOSITE,
+    PSR_CMD_COUNT
+};
+
+#define PSR_CMD_OP(header) ((header) & 0xff)
+#define PSR_CMD_WORDS(header) ((header) >> 8)
+/* the 24 bits of the header left for the word count */
+#define PSR_CMD_WORDS_MAX ((1 << 24) - 1)
+
+union psr_cmd_arg {
+    float f;
+    int32_t i;
+    uint32_t u;
+};
+
+struct psr_cmdbuf {
+    union psr_cmd_arg *data;
+    size_t len;			/**< words in use */
+    size_t size;		/**< words allocated */
+    int flags;
+};
+
+/** the last chunk of a frame */
+#define PSR_CMDBUF_END_OF_FRAME (1 << 0)
+
+/** the buffer the recorder appends to, per thread */
+extern __thread struct psr_cmdbuf *psr_cmdbuf_target;
+
+/** renderer_context whose calls are appended to psr_cmdbuf_target */
+extern struct psr_renderer_context psr_cmdbuf_recorder;
+
+extern int psr_cmdbuf_replay(const struct psr_cmdbuf *buf,
+			     struct psr_renderer_context *renderer);
+extern int psr_cmd_replay(const union psr_cmd_arg *cmd,
+			  struct psr_renderer_context *renderer);
+extern int psr_cmdbuf_replay_state(const struct psr_cmdbuf *buf,
+				   struct psr_renderer_context *renderer,
+				   int *recording);
+extern union psr_cmd_arg *psr_cmdbuf_alloc(struct psr_cmdbuf *buf, int op,
+					   size_t words);
+extern const char *psr_cmd_name(int op);
+extern void psr_cmdbuf_free(struct psr_cmdbuf *buf);
+
+/** run draw() on its own thread, replaying its commands on the
+ * renderer's thread one frame behind. */
+extern int psr_cmdbuf_threaded(struct psr_ctx *ctx);
+/** stop the draw thread of ctx */
+extern void psr_cmdbuf_threaded_end(struct psr_ctx *ctx);
+
+/** trace files are PSR_TRACE_MAGIC, PSR_TRACE_VERSION and then the
+ * commands, all in host byte order */
+#define PSR_TRACE_MAGIC (0x54525350)	/* "PSRT" */
+#define PSR_TRACE_VERSION (1)
+
+/** write every renderer_context call to path, see trace.c */
+extern int psr_trace_start(const char *path, struct psr_ctx *ctx);
+extern void psr_trace_end(struct psr_ctx *ctx);
+
+#endif				/* PSR_CMDBUF_H */
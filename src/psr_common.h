@@ -19,6 +19,22 @@ struct psr_image {
     void *data;         /**< data block */
 };
 
+/** an input event as the window saw it */
+struct psr_event {
+    int type;           /**< one of PSR_EVENT_* */
+    long long usec;     /**< CLOCK_MONOTONIC time, in microseconds */
+    int x, y;           /**< mouse position */
+    int button;         /**< LEFT, CENTER or RIGHT */
+    int key;            /**< key and keycode like the globals */
+    int keycode;
+};
+
+#define PSR_EVENT_MOUSE_PRESSED (1)
+#define PSR_EVENT_MOUSE_RELEASED (2)
+#define PSR_EVENT_MOUSE_MOVED (3)
+#define PSR_EVENT_MOUSE_DRAGGED (4)
+#define PSR_EVENT_KEY_PRESSED (5)
+
 /* constants */
 
 #include <math.h>
@@ -36,10 +52,10 @@ struct psr_image {
 
 // for colors and/or images
 
-#define RGB (1);		// image & color
-#define ARGB (2);		// image
-#define HSB (3);		// color
-#define ALPHA (4);		// image
+#define RGB (1)			// image & color
+#define ARGB (2)		// image
+#define HSB (3)			// color
+#define ALPHA (4)		// image
 
 // image file types
 
@@ -193,7 +209,7 @@ struct psr_image {
 
 #define SQUARE (1 << 0)		// called 'butt' in the svg spec
 #define ROUND (1 << 1)
-#define PROJECT 1 << 2		// called 'square' in the svg spec
+#define PROJECT (1 << 2)	// called 'square' in the svg spec
 #define MITER (1 << 3)
 #define BEVEL (1 << 5)
 
@@ -249,11 +265,11 @@ struct psr_image {
 #define WAIT (5)
 
 
-// hints
+// hints, hint(-x) turns hint x off again, so none of them is 0
 
-#define ENABLE_OPENGL_2X_SMOOTH (0)
 #define ENABLE_OPENGL_4X_SMOOTH (1)
 #define ENABLE_NATIVE_FONTS (2)
+#define ENABLE_OPENGL_2X_SMOOTH (3)
 #define DISABLE_DEPTH_TEST (5)
 #define DISABLE_FLYING_POO (6)
 #define ENABLE_DEPTH_SORT (7)
@@ -263,4 +279,9 @@ struct psr_image {
 
 #define HINT_COUNT (11)
 
+#define DISABLE_OPENGL_2X_SMOOTH (-ENABLE_OPENGL_2X_SMOOTH)
+#define DISABLE_OPENGL_4X_SMOOTH (-ENABLE_OPENGL_4X_SMOOTH)
+#define ENABLE_DEPTH_TEST (-DISABLE_DEPTH_TEST)
+#define DISABLE_DEPTH_SORT (-ENABLE_DEPTH_SORT)
+
 #endif /* PSR_CONSTANTS_H */
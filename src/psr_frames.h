@@ -0,0 +1,22 @@
+#ifndef PSR_FRAMES_H
+#define PSR_FRAMES_H
+
+#include <stdint.h>
+#include "psr_ring.h"
+
+/** The frame file of a PSR_DUMP without a printf() conversion: this
+ * header, then the frames one after the other, each in the format of
+ * save().  frames is kept up to date while the file is written, so a
+ * viewer can play it before the renderer is done. */
+
+#define PSR_FRAMES_MAGIC (0x66727370)	/* "psrf" */
+
+struct psr_frames {
+    uint32_t magic;
+    uint32_t format;		/* PSR_RING_RGB */
+    uint32_t width, height;
+    uint32_t frames;
+    uint32_t offset;		/* of the first frame, from the start */
+};
+
+#endif				/* PSR_FRAMES_H */
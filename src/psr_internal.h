@@ -50,11 +50,17 @@ extern volatile int debug_level;
 
 
 struct psr_context {
-    void (*update_key) (int key, int keycode);
-    void (*update_mouse) (int x, int y, int button);
+    void (*post_event) (const struct psr_event *ev);
     void (*update_size) (int width, int height);
     void (*default_setup) (void);
+    /** getenv() with the overrides of psr_ctx_setenv() */
+    const char *(*getenv) (const char *name);
     struct psr_usr_func usr_func;
+    /** set by a renderer that doesn't draw in real time, millis() then
+     * counts frames */
+    int virtual_clock;
+    /** primitives the renderer dropped as off screen */
+    volatile unsigned long culled;
 };
 
 struct psr_renderer_context {
@@ -106,8 +112,141 @@ struct psr_renderer_context {
     int (*end_camera) (void);
     int (*ortho) (float left, float right, float bottom, float top,
 		  float near, float far);
+    int (*create_shape) (int handle);
+    int (*end_shape_record) (void);
+    int (*shape) (int handle);
+    int (*free_shape) (int handle);
+    int (*text_font) (const char *path);
+    int (*text_size) (float size);
+    int (*text) (const char *str, float x, float y);
+    int (*stroke_join) (int join);
+    int (*stroke_cap) (int cap);
+    int (*curve_detail) (int level);
+    int (*curve_tightness) (float tightness);
+    int (*curve_vertex) (float x, float y, float z);
+    int (*hint) (int which);
+    int (*pick_id) (int id);
+    int (*auto_detail) (float max_error);
+    int (*dirty_rect) (float x, float y, float width, float height);
+    int (*create_graphics) (int handle, int width, int height);
+    int (*free_graphics) (int handle);
+    int (*begin_draw) (int handle);
+    int (*end_draw) (void);
+    int (*image_graphics) (int handle, float x, float y, float width,
+			   float height);
+    int (*composite) (int handle, int mode, float opacity);
 };
 
+struct psr_handles {
+    int next;
+    int *free;
+    int free_count, free_size;
+};
+
+struct psr_env {
+    char *name;
+    char *value;		/**< NULL hides the variable */
+};
+
+/** a sketch, see psr_ctx_new().  the state of the modules hangs off it,
+ * so each sketch of the process has its own. */
+struct psr_ctx {
+    struct psr_context context;
+    struct psr_renderer_context renderer;
+    void *handle;
+    int (*renderer_init) (struct psr_context *psr_cxt,
+			  struct psr_renderer_context *renderer_cxt);
+    int (*main_loop_start) (void);
+    /** 0 after no_loop(), 1 after loop() */
+    volatile int looping;
+    /** the window size, copied to width and height of each thread */
+    volatile int width, height;
+    /** draw() calls started, and what the clock is based on */
+    volatile unsigned long frames;
+    float frame_rate;
+    long long start_usec;
+    void (*usr_draw) (void);
+
+    int rect_mode;
+    int ellipse_mode;
+    int color_mode;
+    float curve_basis[16];
+    /* retained shape and graphics handles are handed out here, so they
+     * are known before the renderer has seen the call */
+    int recording_shape;
+    struct psr_handles shapes;
+    struct psr_handles graphics;
+    /** nonzero for each shape handle not freed */
+    char *shape_live;
+    int shape_live_len;
+    /** width and height of each graphics handle */
+    int *graphics_size;
+    int graphics_size_len;
+    /** the target of begin_draw(), 0 for the window */
+    int drawing;
+
+    struct psr_env *env;
+    int env_count;
+
+    struct psr_input *input;	/**< see input.c */
+    struct psr_pick *pick;	/**< see pick.c */
+    struct psr_threaded *threaded;	/**< see cmdbuf.c */
+    struct psr_trace *trace;	/**< see trace.c */
+    struct psr_layers *layers;	/**< see layer.c */
+    struct psr_noise *noise;	/**< see noise.c */
+};
+
+/** the sketch the API calls of this thread are for */
+extern __thread struct psr_ctx *psr_current;
+
+/** the table the API calls of this thread go through, normally
+ * &psr_current->renderer */
+extern __thread struct psr_renderer_context *psr_renderer;
+
+/* the state of processing.h, per thread.  input.c copies it from the
+ * sketch at the start of each frame. */
+extern __thread volatile char key;
+extern __thread volatile int key_code;
+extern __thread volatile int mouse_x;
+extern __thread volatile int mouse_y;
+extern __thread volatile int mouse_button;
+extern __thread volatile int p_mouse_x;
+extern __thread volatile int p_mouse_y;
+extern __thread volatile int width;
+extern __thread volatile int height;
+
+/** see spline.c */
+extern void psr_curve_basis(float s, float m[16]);
+extern void psr_spline_draw_matrix(const float basis[16], int detail,
+				   float out[16]);
+extern float psr_spline_point(const float basis[16], float a, float b,
+			      float c, float d, float t);
+extern float psr_spline_tangent(const float basis[16], float a, float b,
+				float c, float d, float t);
+extern void psr_spline_plot(const float draw[16], int detail,
+			    const float p[12], float *out);
+extern void psr_bezier_eval(const float *a, const float *b, const float *c,
+			    const float *d, int stride, const float *t, int n,
+			    float *points, float *tangents);
+
+/** see pick.c */
+extern int psr_pick_start(struct psr_ctx *ctx);
+extern void psr_pick_end(struct psr_ctx *ctx);
+extern void psr_pick_add(int id, float x0, float y0, float x1, float y1);
+extern void psr_pick_frame(int width, int height);
+
+/** see input.c */
+extern int psr_input_start(struct psr_ctx *ctx);
+extern void psr_input_end(struct psr_ctx *ctx);
+extern void psr_input_drain(void);
+
+/** see layer.c */
+extern int psr_layer_start(struct psr_ctx *ctx);
+extern void psr_layer_end(struct psr_ctx *ctx);
+
+/** see noise.c */
+extern void psr_noise_end(struct psr_ctx *ctx);
+
 #define DEFAULT_WIDTH (100)
 #define DEFAULT_HEIGHT (100)
 
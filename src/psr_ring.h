@@ -0,0 +1,40 @@
+#ifndef PSR_RING_H
+#define PSR_RING_H
+
+#include <stdint.h>
+
+/** The frame ring of PSR_RING: a POSIX shared memory object the headless
+ * renderer publishes its frames in, for showpix -s and the like.
+ *
+ * The header is followed by the pixels of the slots.  A frame goes into
+ * the slot after the last one: its sequence is set to 0, the pixels are
+ * written, then the sequence of the slot and of the ring are set to the
+ * number of the frame.  A reader takes the slot of the ring's sequence
+ * and uses it in place; if the slot's sequence changed meanwhile the
+ * frame was overwritten under it and it should take the next one. */
+
+#define PSR_RING_MAGIC (0x31727370)	/* "psr1" */
+#define PSR_RING_SLOTS (3)
+
+/* pixel formats */
+#define PSR_RING_RGB (1)	/* 3 bytes a pixel, rows packed, bottom up */
+
+struct psr_ring_slot {
+    uint64_t sequence;		/* 0 while it is written */
+    uint32_t width, height;
+    uint64_t offset;		/* of the pixels, from the header */
+};
+
+struct psr_ring {
+    uint32_t magic;
+    uint32_t format;
+    uint32_t width, height;	/* the largest frame a slot takes */
+    uint64_t size;		/* of the whole object */
+    uint64_t sequence;		/* of the last frame, 0 before the first */
+    struct psr_ring_slot slot[PSR_RING_SLOTS];
+};
+
+/** the slot frame sequence is in */
+#define PSR_RING_SLOT(sequence) (((sequence) - 1) % PSR_RING_SLOTS)
+
+#endif				/* PSR_RING_H */
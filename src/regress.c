@@ -0,0 +1,344 @@
+/** Golden-image regression runner.
+ *
+ * Renders every sketch in a list headlessly (opengl/libpsr_egl.so) for
+ * a fixed number of frames, compares each frame with a stored reference
+ * frame and checks the run time against a budget.  Frames use the raw
+ * RGB format of save() and showpix.
+ *
+ * usage: regress [-u] [-t tolerance] [-p bad_pixels] [-r refdir]
+ *                [-o outdir] [-R renderer] listfile
+ *
+ *   -u   update the reference frames instead of comparing
+ *   -t   per-channel tolerance, 0-255 (default 2)
+ *   -p   number of pixels allowed to exceed the tolerance (default 0)
+ *
+ * every line of the list file is
+ *
+ *   name  frames  budget_ms  command...
+ *
+ * the command is run with /bin/sh from the current directory.  the
+ * frames go to outdir/name-NNNN.rgb, its output to outdir/name.log and,
+ * on a pixel failure, a diff image to outdir/name-NNNN.diff.rgb with the
+ * failing pixels in red over a darkened copy of the reference.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+struct sketch {
+    char name[64];
+    int frames;
+    double budget_ms;
+    char command[1024];
+};
+
+static const char *ref_dir = "regress_ref";
+static const char *out_dir = "regress_out";
+static const char *renderer = "./opengl/libpsr_egl.so";
+static int tolerance = 2;
+static long max_bad_pixels = 0;
+static int update = 0;
+
+static void *load_file(const char *path, size_t *len)
+{
+    FILE *fp;
+    void *data;
+    long n;
+
+    fp = fopen(path, "r");
+    if (!fp) {
+	return NULL;
+    }
+    fseek(fp, 0, SEEK_END);
+    n = ftell(fp);
+    rewind(fp);
+    data = malloc(n > 0 ? n : 1);
+    if (data && fread(data, 1, n, fp) != (size_t) n) {
+	free(data);
+	data = NULL;
+    }
+    fclose(fp);
+    *len = n;
+    return data;
+}
+
+static int save_file(const char *path, const void *data, size_t len)
+{
+    FILE *fp;
+    size_t n;
+
+    fp = fopen(path, "w");
+    if (!fp) {
+	fprintf(stderr, "can't open %s: %s\n", path, strerror(errno));
+	return -1;
+    }
+    n = fwrite(data, 1, len, fp);
+    fclose(fp);
+    return n == len ? 0 : -1;
+}
+
+/** mask[i] = max(|a[i] - b[i]| - tolerance, 0) for every byte.  returns
+ * non-zero if any byte is over the tolerance. */
+static int diff_bytes(const unsigned char *a, const unsigned char *b,
+		      unsigned char *mask, size_t len)
+{
+    size_t i = 0;
+    int any = 0;
+#ifdef __SSE2__
+    const __m128i tol = _mm_set1_epi8((char) tolerance);
+    __m128i acc = _mm_setzero_si128();
+
+    for (; i + 16 <= len; i += 16) {
+	__m128i va = _mm_loadu_si128((const __m128i *) (a + i));
+	__m128i vb = _mm_loadu_si128((const __m128i *) (b + i));
+	__m128i d = _mm_or_si128(_mm_subs_epu8(va, vb),
+				 _mm_subs_epu8(vb, va));
+	d = _mm_subs_epu8(d, tol);
+	_mm_storeu_si128((__m128i *) (mask + i), d);
+	acc = _mm_or_si128(acc, d);
+    }
+    any = _mm_movemask_epi8(_mm_cmpeq_epi8(acc, _mm_setzero_si128()))
+	!= 0xffff;
+#endif
+    for (; i < len; ++i) {
+	int d = abs(a[i] - b[i]) - tolerance;
+	mask[i] = d > 0 ? d : 0;
+	any |= mask[i];
+    }
+    return any;
+}
+
+/** count the pixels with any channel over the tolerance and turn mask
+ * into the diff image. */
+static long diff_image(const unsigned char *ref, unsigned char *mask,
+		       size_t len)
+{
+    long bad = 0;
+    size_t i;
+
+    for (i = 0; i + 2 < len; i += 3) {
+	if (mask[i] | mask[i + 1] | mask[i + 2]) {
+	    mask[i] = 255;
+	    mask[i + 1] = 0;
+	    mask[i + 2] = 0;
+	    ++bad;
+	} else {
+	    unsigned char grey = (ref[i] + ref[i + 1] + ref[i + 2]) / 12;
+	    mask[i] = mask[i + 1] = mask[i + 2] = grey;
+	}
+    }
+    return bad;
+}
+
+/** run the sketch, returns the wall clock time in ms or -1. */
+static double run_sketch(const struct sketch *s)
+{
+    struct timespec start, end;
+    char path[PATH_MAX];
+    char frames[16];
+    int status, fd;
+    pid_t pid;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    pid = fork();
+    if (pid < 0) {
+	perror("fork");
+	return -1;
+    }
+    if (pid == 0) {
+	snprintf(frames, sizeof(frames), "%d", s->frames);
+	setenv("PSR_FRAMES", frames, 1);
+	setenv("PSR_RENDERER", renderer, 1);
+	snprintf(path, sizeof(path), "%s/%s-%%04d.rgb", out_dir, s->name);
+	setenv("PSR_DUMP", path, 1);
+	snprintf(path, sizeof(path), "%s/%s.log", out_dir, s->name);
+	fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd >= 0) {
+	    dup2(fd, STDOUT_FILENO);
+	    dup2(fd, STDERR_FILENO);
+	    close(fd);
+	}
+	execl("/bin/sh", "sh", "-c", s->command, (char *) NULL);
+	_exit(127);
+    }
+    if (waitpid(pid, &status, 0) < 0) {
+	perror("waitpid");
+	return -1;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    if (!WIFEXITED(status) || WEXITSTATUS(status)) {
+	return -1;
+    }
+    return (end.tv_sec - start.tv_sec) * 1e3
+	+ (end.tv_nsec - start.tv_nsec) / 1e6;
+}
+
+/** returns the number of failed frames. */
+static int check_frames(const struct sketch *s)
+{
+    char out_path[PATH_MAX], ref_path[PATH_MAX], diff_path[PATH_MAX];
+    unsigned char *out, *ref, *mask;
+    size_t out_len, ref_len;
+    int frame, failed = 0;
+    long bad;
+
+    for (frame = 0; frame < s->frames; ++frame) {
+	snprintf(out_path, sizeof(out_path), "%s/%s-%04d.rgb",
+		 out_dir, s->name, frame);
+	snprintf(ref_path, sizeof(ref_path), "%s/%s-%04d.rgb",
+		 ref_dir, s->name, frame);
+	out = load_file(out_path, &out_len);
+	if (!out) {
+	    printf("  %s: missing\n", out_path);
+	    ++failed;
+	    continue;
+	}
+	if (update) {
+	    failed += save_file(ref_path, out, out_len) ? 1 : 0;
+	    free(out);
+	    continue;
+	}
+	ref = load_file(ref_path, &ref_len);
+	if (!ref || ref_len != out_len) {
+	    printf("  %s: %s\n", ref_path, ref ? "size differs" : "missing");
+	    ++failed;
+	    free(ref);
+	    free(out);
+	    continue;
+	}
+	mask = malloc(out_len);
+	if (!mask) {
+	    fprintf(stderr, "no memory for the diff of %s\n", out_path);
+	    ++failed;
+	    free(ref);
+	    free(out);
+	    continue;
+	}
+	if (diff_bytes(out, ref, mask, out_len)) {
+	    bad = diff_image(ref, mask, out_len);
+	    if (bad > max_bad_pixels) {
+		snprintf(diff_path, sizeof(diff_path), "%s/%s-%04d.diff.rgb",
+			 out_dir, s->name, frame);
+		save_file(diff_path, mask, out_len);
+		printf("  frame %d: %ld pixels differ, see %s\n",
+		       frame, bad, diff_path);
+		++failed;
+	    }
+	}
+	free(mask);
+	free(ref);
+	free(out);
+    }
+    return failed;
+}
+
+static int parse_line(char *line, struct sketch *s)
+{
+    int n;
+
+    while (*line == ' ' || *line == '\t') {
+	++line;
+    }
+    if (*line == '#' || *line == '\n' || *line == 0) {
+	return 0;
+    }
+    if (sscanf(line, "%63s %d %lf %n", s->name, &s->frames, &s->budget_ms,
+	       &n) < 3 || !line[n]) {
+	return -1;
+    }
+    snprintf(s->command, sizeof(s->command), "%s", line + n);
+    s->command[strcspn(s->command, "\n")] = 0;
+    return 1;
+}
+
+int main(int argc, char *argv[])
+{
+    struct sketch s;
+    char line[1200];
+    int opt, lineno = 0, failures = 0, r;
+    double ms;
+    FILE *fp;
+
+    while ((opt = getopt(argc, argv, "ut:p:r:o:R:")) != -1) {
+	switch (opt) {
+	case 'u':
+	    update = 1;
+	    break;
+	case 't':
+	    tolerance = atoi(optarg);
+	    break;
+	case 'p':
+	    max_bad_pixels = atol(optarg);
+	    break;
+	case 'r':
+	    ref_dir = optarg;
+	    break;
+	case 'o':
+	    out_dir = optarg;
+	    break;
+	case 'R':
+	    renderer = optarg;
+	    break;
+	default:
+	    goto usage;
+	}
+    }
+    if (optind != argc - 1 || tolerance < 0 || tolerance > 255) {
+	goto usage;
+    }
+    mkdir(out_dir, 0755);
+    if (update) {
+	mkdir(ref_dir, 0755);
+    }
+    fp = fopen(argv[optind], "r");
+    if (!fp) {
+	perror(argv[optind]);
+	return 2;
+    }
+
+    while (fgets(line, sizeof(line), fp)) {
+	++lineno;
+	r = parse_line(line, &s);
+	if (r < 0) {
+	    fprintf(stderr, "%s:%d: bad line\n", argv[optind], lineno);
+	    ++failures;
+	}
+	if (r <= 0) {
+	    continue;
+	}
+	ms = run_sketch(&s);
+	if (ms < 0) {
+	    printf("FAIL %-16s did not run, see %s/%s.log\n",
+		   s.name, out_dir, s.name);
+	    ++failures;
+	    continue;
+	}
+	r = check_frames(&s);
+	if (!update && ms > s.budget_ms) {
+	    printf("  over budget: %.1f ms > %.1f ms\n", ms, s.budget_ms);
+	    ++r;
+	}
+	printf("%s %-16s %d frames %8.1f ms %8.2f ms/frame\n",
+	       r ? "FAIL" : (update ? "SAVE" : "PASS"), s.name, s.frames,
+	       ms, s.frames ? ms / s.frames : 0);
+	failures += r ? 1 : 0;
+    }
+    fclose(fp);
+    return failures ? 1 : 0;
+
+usage:
+    fprintf(stderr, "usage: %s [-u] [-t tolerance] [-p bad_pixels] "
+	    "[-r refdir] [-o outdir] [-R renderer] listfile\n", argv[0]);
+    return 2;
+}
@@ -0,0 +1,191 @@
+/** psr-replay: play back a trace written with PSR_TRACE.
+ *
+ * usage: psr-replay tracefile
+ *
+ * The trace is replayed into whatever renderer PSR_RENDERER selects, as
+ * fast as the renderer allows; frame_rate(), loop(), no_loop() and
+ * redraw() in the trace are counted but not replayed.  At the end the
+ * time of every frame and the time spent per call type are printed.
+ * A frame's time runs from its start to the start of the next one, so
+ * it includes the buffer swap; call times are the time spent in the
+ * renderer's function.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "processing.h"
+#include "psr_cmdbuf.h"
+
+struct call_stats {
+    unsigned long count;
+    double ms;
+};
+
+static struct psr_cmdbuf trace;
+static const union psr_cmd_arg *pos, *end;
+static struct call_stats calls[PSR_CMD_COUNT];
+static double *frame_ms;
+static int frames, frame = -1;
+static struct timespec frame_start;
+
+static double ms_since(const struct timespec *start)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) * 1e3
+	+ (now.tv_nsec - start->tv_nsec) / 1e6;
+}
+
+static int load_trace(const char *path)
+{
+    uint32_t header[2];
+    union psr_cmd_arg *cmd;
+    FILE *fp;
+    long n;
+
+    fp = fopen(path, "r");
+    if (!fp) {
+	perror(path);
+	return -1;
+    }
+    if (fread(header, sizeof(header), 1, fp) != 1
+	|| header[0] != PSR_TRACE_MAGIC || header[1] != PSR_TRACE_VERSION) {
+	fprintf(stderr, "%s: not a version %d trace\n", path,
+		PSR_TRACE_VERSION);
+	fclose(fp);
+	return -1;
+    }
+    fseek(fp, 0, SEEK_END);
+    n = (ftell(fp) - sizeof(header)) / sizeof(*trace.data);
+    fseek(fp, sizeof(header), SEEK_SET);
+    trace.data = malloc(n * sizeof(*trace.data) + 1);
+    trace.len = trace.size = fread(trace.data, sizeof(*trace.data), n, fp);
+    fclose(fp);
+
+    /* check the framing once, so the replay can trust it */
+    for (cmd = trace.data; cmd < trace.data + trace.len;
+	 cmd += 1 + PSR_CMD_WORDS(cmd->u)) {
+	if (PSR_CMD_OP(cmd->u) <= 0 || PSR_CMD_OP(cmd->u) >= PSR_CMD_COUNT
+	    || cmd + 1 + PSR_CMD_WORDS(cmd->u) > trace.data + trace.len) {
+	    fprintf(stderr, "%s: corrupt at word %ld\n", path,
+		    (long) (cmd - trace.data));
+	    trace.len = cmd - trace.data;
+	    break;
+	}
+	if (PSR_CMD_OP(cmd->u) == PSR_CMD_FRAME) {
+	    ++frames;
+	}
+    }
+    pos = trace.data;
+    end = trace.data + trace.len;
+    frame_ms = calloc(frames + 1, sizeof(*frame_ms));
+    return 0;
+}
+
+/** replay up to the next frame marker.  returns 0 at the end of the
+ * trace. */
+static int replay_frame(void)
+{
+    struct timespec start;
+    int op;
+
+    while (pos < end) {
+	op = PSR_CMD_OP(pos->u);
+	switch (op) {
+	case PSR_CMD_FRAME:
+	    ++pos;
+	    return 1;
+	case PSR_CMD_FRAME_RATE:
+	case PSR_CMD_LOOP:
+	case PSR_CMD_NO_LOOP:
+	case PSR_CMD_REDRAW:
+	    break;
+	default:
+	    clock_gettime(CLOCK_MONOTONIC, &start);
+	    psr_cmd_replay(pos, psr_renderer);
+	    calls[op].ms += ms_since(&start);
+	}
+	++calls[op].count;
+	pos += 1 + PSR_CMD_WORDS(pos->u);
+    }
+    return 0;
+}
+
+static void report(void)
+{
+    double total = 0, min = 1e30, max = 0;
+    int i;
+
+    for (i = 0; i < frames; ++i) {
+	printf("frame %5d %10.3f ms\n", i, frame_ms[i]);
+	total += frame_ms[i];
+	min = frame_ms[i] < min ? frame_ms[i] : min;
+	max = frame_ms[i] > max ? frame_ms[i] : max;
+    }
+    if (frames) {
+	printf("%d frames, min %.3f ms, avg %.3f ms, max %.3f ms\n",
+	       frames, min, total / frames, max);
+    }
+    printf("\n%-16s %10s %12s %10s\n", "call", "count", "total ms",
+	   "avg us");
+    for (i = 1; i < PSR_CMD_COUNT; ++i) {
+	if (calls[i].count && i != PSR_CMD_FRAME) {
+	    printf("%-16s %10lu %12.3f %10.3f\n", psr_cmd_name(i),
+		   calls[i].count, calls[i].ms,
+		   calls[i].ms * 1e3 / calls[i].count);
+	}
+    }
+}
+
+/* everything before the first frame marker */
+static void setup(void)
+{
+    replay_frame();
+    psr_renderer->frame_rate(1e6);
+}
+
+static void draw(void)
+{
+    if (frame >= 0) {
+	frame_ms[frame] = ms_since(&frame_start);
+    }
+    if (++frame >= frames) {
+	report();
+	exit(0);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &frame_start);
+    replay_frame();
+}
+
+int main(int argc, char *argv[])
+{
+    struct psr_usr_func replay_func = {
+	.setup = setup,
+	.draw = draw,
+    };
+    char n[16];
+
+    if (argc != 2) {
+	fprintf(stderr, "usage: %s tracefile\n", argv[0]);
+	return 2;
+    }
+    if (load_trace(argv[1])) {
+	return 1;
+    }
+    /* the headless renderer stops after PSR_FRAMES, one more than the
+     * trace so the last frame gets timed */
+    snprintf(n, sizeof(n), "%d", frames + 1);
+    setenv("PSR_FRAMES", n, 0);
+    unsetenv("PSR_TRACE");
+    unsetenv("PSR_THREADED");
+    /* debug output would dominate the timing */
+    debug_level = 1 << 3 | 1 << 2;
+
+    processor_init();
+    processor_run(&replay_func);
+    report();
+    return 0;
+}
@@ -1,98 +1,514 @@
+/** Frame viewer.
+ *
+ * usage: showpix [-g WxH] [-r fps] FILE | PATTERN
+ *        showpix -s NAME
+ *
+ * FILE is a frame file of psr_frames.h, or raw RGB in the format of
+ * save() of the size given with -g (default 100x100).  PATTERN is a
+ * printf() pattern of numbered files like PSR_DUMP makes, e.g.
+ * "out/sketch-%04d.rgb", counted from 0 or 1.  more than one frame is
+ * played at fps (default 30) over and over; the files are mapped, and
+ * a thread gets the next frames into memory ahead of the playback.
+ *
+ * -s shows the frames of the shared memory ring NAME (see psr_ring.h)
+ * as the renderer publishes them.
+ *
+ * q or escape quits, space pauses. */
+
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <math.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <GL/glut.h>
 
+#include "psr_frames.h"
+
 #define glCheckError()					\
     do {						\
 	GLenum e;					\
-	int r = 0;					\
 	while ((e = glGetError()) != GL_NO_ERROR) {	\
-	    r = -1;					\
 	    fprintf(stderr, "%s", gluErrorString(e));	\
 	}						\
     } while(0)
 
+/* the size of the frames */
 static int width = 100, height = 100;
-void *image_data;
+static GLuint texture;
+static int texture_width = 0, texture_height = 0;
+/* with -s */
+static const struct psr_ring *ring = NULL;
+static uint64_t shown = 0;
+
 
-static void draw(void)
+/********************************************************************
+ * Drawing functions
+ ********************************************************************/
+
+/** put the frame into the texture and the texture into the window.
+ * rows are bottom up, like the texture */
+static void show(const void *pixels, int w, int h)
 {
-    /* display pic here */
-    fprintf(stderr, "draw\n");
-    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-    glRasterPos2i(0, 0);
-    glDrawPixels(width, height, GL_RGB, GL_UNSIGNED_BYTE, image_data);
+    glClear(GL_COLOR_BUFFER_BIT);
+    if (pixels) {
+	glBindTexture(GL_TEXTURE_2D, texture);
+	if (w != texture_width || h != texture_height) {
+	    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB8, w, h, 0, GL_RGB,
+			 GL_UNSIGNED_BYTE, pixels);
+	    texture_width = w;
+	    texture_height = h;
+	} else {
+	    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, w, h, GL_RGB,
+			    GL_UNSIGNED_BYTE, pixels);
+	}
+	glEnable(GL_TEXTURE_2D);
+	glBegin(GL_QUADS);
+	glTexCoord2f(0, 0);
+	glVertex2f(0, 0);
+	glTexCoord2f(1, 0);
+	glVertex2f(1, 0);
+	glTexCoord2f(1, 1);
+	glVertex2f(1, 1);
+	glTexCoord2f(0, 1);
+	glVertex2f(0, 1);
+	glEnd();
+	glDisable(GL_TEXTURE_2D);
+    }
     glutSwapBuffers();
     glCheckError();
-    return;
 }
 
 static void reshape(int lwidth, int lheight)
 {
-    fprintf(stderr, "reshape(%d, %d)\n", width, height);
-    width = lwidth;
-    height = lheight;
-    glViewport(0, 0, width, height);
+    fprintf(stderr, "reshape(%d, %d)\n", lwidth, lheight);
+    glViewport(0, 0, lwidth, lheight);
     glMatrixMode(GL_PROJECTION);
     glLoadIdentity();
-    gluOrtho2D(0, width, 0, height);
+    /* the frame fills the window */
+    gluOrtho2D(0, 1, 0, 1);
     glMatrixMode(GL_MODELVIEW);
     glLoadIdentity();
 }
 
-static void idle(void)
+
+/********************************************************************
+ * Ring functions
+ ********************************************************************/
+
+/** the last frame of the ring, right from the shared memory */
+static void draw_ring(void)
+{
+    const uint64_t sequence = __atomic_load_n(&ring->sequence,
+					      __ATOMIC_ACQUIRE);
+    const struct psr_ring_slot *s = &ring->slot[PSR_RING_SLOT(sequence)];
+
+    if (!sequence || __atomic_load_n(&s->sequence, __ATOMIC_ACQUIRE)
+	!= sequence) {
+	show(NULL, 0, 0);
+	return;
+    }
+    show((const char *) ring + s->offset, s->width, s->height);
+    /* the pixels read before the sequence again, pairs with the fence
+     * of the publisher.  overwritten while we took them, show the next
+     * one. */
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    if (__atomic_load_n(&s->sequence, __ATOMIC_ACQUIRE) == sequence) {
+	shown = sequence;
+    }
+}
+
+/** look for a new frame every few milliseconds */
+static void poll_ring(int value)
 {
-    glutPostRedisplay();
+    if (__atomic_load_n(&ring->sequence, __ATOMIC_ACQUIRE) != shown) {
+	glutPostRedisplay();
+    }
+    glutTimerFunc(5, poll_ring, 0);
 }
 
-static void visible(int vis)
+/** map the ring, waiting for the renderer to make it */
+static void open_ring(const char *name)
 {
-    if (vis == GLUT_VISIBLE) {
-	glutIdleFunc(idle);
+    const struct psr_ring *r;
+    struct stat st;
+    int fd;
+
+    while ((fd = shm_open(name, O_RDONLY, 0)) < 0
+	   || fstat(fd, &st) || (size_t) st.st_size < sizeof(*r)) {
+	if (fd < 0 && errno != ENOENT) {
+	    perror(name);
+	    exit(1);
+	}
+	if (fd >= 0) {
+	    close(fd);
+	}
+	usleep(100000);
+    }
+    r = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (r == MAP_FAILED) {
+	perror(name);
+	exit(1);
+    }
+    while (__atomic_load_n(&r->magic, __ATOMIC_ACQUIRE) != PSR_RING_MAGIC) {
+	usleep(10000);
+    }
+    if (r->format != PSR_RING_RGB || r->size > (uint64_t) st.st_size) {
+	fprintf(stderr, "%s: not a frame ring I know\n", name);
+	exit(1);
+    }
+    ring = r;
+    width = r->width;
+    height = r->height;
+}
+
+
+/********************************************************************
+ * File functions
+ ********************************************************************/
+
+struct mapping {
+    void *data;
+    size_t len;
+};
+
+/* a FILE, or the first file of a PATTERN */
+static const char *pattern;
+static int sequence = 0, first = 0, frame_count = 0;
+static struct mapping file;
+static size_t frame_offset, frame_size;
+
+/** NULL if it isn't there */
+static void *map_file(const char *path, size_t *len)
+{
+    struct stat st;
+    void *data;
+    int fd;
+
+    fd = open(path, O_RDONLY);
+    if (fd < 0) {
+	return NULL;
+    }
+    if (fstat(fd, &st) || st.st_size == 0) {
+	close(fd);
+	return NULL;
+    }
+    data = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+	perror(path);
+	return NULL;
+    }
+    *len = st.st_size;
+    return data;
+}
+
+/** the size of the frames and where they are in m, from the header of
+ * psr_frames.h or -g.  the number of frames in m. */
+static int layout(const struct mapping *m, const char *path)
+{
+    const struct psr_frames *h = m->data;
+
+    frame_offset = 0;
+    if (m->len >= sizeof(*h) && h->magic == PSR_FRAMES_MAGIC) {
+	if (h->format != PSR_RING_RGB) {
+	    fprintf(stderr, "%s: format %u unknown\n", path, h->format);
+	    exit(1);
+	}
+	width = h->width;
+	height = h->height;
+	frame_offset = h->offset;
+    }
+    frame_size = (size_t) 3 * width * height;
+    if (m->len < frame_offset + frame_size) {
+	fprintf(stderr, "%s: too short for %dx%d\n", path, width, height);
+	exit(1);
+    }
+    /* a file still being written has frames in it the header doesn't
+     * count yet, and maybe half of one */
+    return (m->len - frame_offset) / frame_size;
+}
+
+static void open_frames(const char *path)
+{
+    char name[4096];
+    struct stat st;
+
+    pattern = path;
+    sequence = strchr(path, '%') != NULL;
+    if (!sequence) {
+	file.data = map_file(path, &file.len);
+	if (!file.data) {
+	    perror(path);
+	    exit(1);
+	}
+	frame_count = layout(&file, path);
+	return;
+    }
+
+    /* count the files, from 0 or 1 on */
+    snprintf(name, sizeof(name), pattern, 0);
+    first = stat(name, &st) ? 1 : 0;
+    for (;;) {
+	snprintf(name, sizeof(name), pattern, first + frame_count);
+	if (stat(name, &st)) {
+	    break;
+	}
+	++frame_count;
+    }
+    if (!frame_count) {
+	fprintf(stderr, "%s: no files\n", path);
+	exit(1);
+    }
+    snprintf(name, sizeof(name), pattern, first);
+    file.data = map_file(name, &file.len);
+    if (!file.data) {
+	perror(name);
+	exit(1);
+    }
+    layout(&file, name);
+    munmap(file.data, file.len);
+    file.data = NULL;
+}
+
+
+/********************************************************************
+ * Prefetch functions
+ ********************************************************************/
+
+/* frame n of the playback (counting on when it starts over) is loaded
+ * into loaded[n % AHEAD] by the thread, as long as n is less than AHEAD
+ * after the one shown.  the one shown is left alone. */
+#define AHEAD (8)
+
+struct loaded {
+    long n;			/* -1 for none */
+    const void *pixels;
+    struct mapping map;		/* of a PATTERN file */
+};
+
+static struct loaded loaded[AHEAD];
+static long playing = 0;
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t cond = PTHREAD_COND_INITIALIZER;
+
+/** get the pages of frame n into memory */
+static void load(struct loaded *l, long n)
+{
+    const int frame = n % frame_count;
+    const char *p;
+    volatile char sum = 0;
+    size_t i;
+
+    l->pixels = NULL;
+    if (sequence) {
+	char name[4096];
+
+	snprintf(name, sizeof(name), pattern, first + frame);
+	l->map.data = map_file(name, &l->map.len);
+	if (!l->map.data) {
+	    return;
+	}
+	if (l->map.len < frame_offset + frame_size) {
+	    fprintf(stderr, "%s: too short\n", name);
+	    return;
+	}
+	p = (const char *) l->map.data + frame_offset;
     } else {
-	glutIdleFunc(NULL);
+	p = (const char *) file.data + frame_offset + frame * frame_size;
+    }
+    madvise((void *) ((uintptr_t) p & ~(uintptr_t) 4095),
+	    frame_size + ((uintptr_t) p & 4095), MADV_WILLNEED);
+    for (i = 0; i < frame_size; i += 4096) {
+	sum += p[i];
+    }
+    l->pixels = p;
+}
+
+static void unload(struct loaded *l)
+{
+    if (l->map.data) {
+	munmap(l->map.data, l->map.len);
+	l->map.data = NULL;
+    }
+    l->pixels = NULL;
+    l->n = -1;
+}
+
+static void *prefetch(void *arg)
+{
+    struct loaded next;
+    long n;
+
+    memset(&next, 0, sizeof(next));
+    pthread_mutex_lock(&lock);
+    for (;;) {
+	for (n = playing; n < playing + AHEAD; ++n) {
+	    if (loaded[n % AHEAD].n != n) {
+		break;
+	    }
+	}
+	if (n == playing + AHEAD) {
+	    pthread_cond_wait(&cond, &lock);
+	    continue;
+	}
+	pthread_mutex_unlock(&lock);
+	load(&next, n);
+	pthread_mutex_lock(&lock);
+	if (n < playing) {
+	    /* too late, it went by */
+	    unload(&next);
+	    continue;
+	}
+	unload(&loaded[n % AHEAD]);
+	loaded[n % AHEAD] = next;
+	loaded[n % AHEAD].n = n;
+	next.map.data = NULL;
+	pthread_cond_broadcast(&cond);
+    }
+    return arg;
+}
+
+
+/********************************************************************
+ * Playback functions
+ ********************************************************************/
+
+static int interval = 33;	/* milliseconds */
+static int paused = 0;
+
+/** the frame being played, waiting for the thread if need be */
+static void draw_frames(void)
+{
+    struct loaded *l = &loaded[playing % AHEAD];
+
+    pthread_mutex_lock(&lock);
+    while (l->n != playing) {
+	pthread_cond_wait(&cond, &lock);
     }
+    pthread_mutex_unlock(&lock);
+    /* the thread doesn't touch it while it is playing */
+    show(l->pixels, width, height);
 }
 
-/* static void passive_motion(int x, int y) */
-/* { */
-/*     mouse_x = x; */
-/*     mouse_y = y; */
-/* } */
+static void tick(int value)
+{
+    if (!paused) {
+	pthread_mutex_lock(&lock);
+	++playing;
+	pthread_cond_broadcast(&cond);
+	pthread_mutex_unlock(&lock);
+	glutPostRedisplay();
+    }
+    glutTimerFunc(interval, tick, 0);
+}
 
-static void init(const char *filename)
+static void keyboard(unsigned char key, int x, int y)
 {
-    FILE *fp;
-    const size_t s = sizeof(GLubyte) * 3;
+    switch (key) {
+    case 'q':
+    case 27:
+	exit(0);
+    case ' ':
+	paused = !paused;
+	break;
+    }
+}
+
 
-    glClearDepth(1.0f);
-    glDepthFunc(GL_LESS);
-    glEnable(GL_DEPTH_TEST);
-    glFlush();
+/********************************************************************
+ * Other functions
+ ********************************************************************/
 
-    image_data = calloc(s, width * height);
-    fp = fopen(filename, "r");
-    fread(image_data, s, width * height, fp);
-    fclose(fp);
+static void init(void)
+{
+    pthread_t thread;
+    int i;
+
+    /* the rows of save() are packed */
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glGenTextures(1, &texture);
+    glBindTexture(GL_TEXTURE_2D, texture);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexEnvi(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_REPLACE);
+    glCheckError();
+
+    if (ring) {
+	glutDisplayFunc(draw_ring);
+	glutTimerFunc(5, poll_ring, 0);
+	return;
+    }
+    for (i = 0; i < AHEAD; ++i) {
+	loaded[i].n = -1;
+    }
+    if (pthread_create(&thread, NULL, prefetch, NULL)) {
+	perror("pthread_create");
+	exit(1);
+    }
+    glutDisplayFunc(draw_frames);
+    if (frame_count > 1) {
+	glutTimerFunc(interval, tick, 0);
+    }
+}
+
+static void usage(void)
+{
+    fprintf(stderr, "usage: showpix [-g WxH] [-r fps] FILE | PATTERN\n"
+	    "       showpix -s NAME\n");
+    exit(1);
 }
 
 int main(int argc, char *argv[])
 {
+    float fps;
+    int c;
+
     glutInit(&argc, argv);
+    while ((c = getopt(argc, argv, "g:r:s:")) != -1) {
+	switch (c) {
+	case 'g':
+	    if (sscanf(optarg, "%dx%d", &width, &height) != 2
+		|| width < 1 || height < 1) {
+		usage();
+	    }
+	    break;
+	case 'r':
+	    fps = atof(optarg);
+	    if (fps <= 0) {
+		usage();
+	    }
+	    interval = lrintf(1000 / fps);
+	    break;
+	case 's':
+	    open_ring(optarg);
+	    break;
+	default:
+	    usage();
+	}
+    }
+    if (!ring) {
+	if (optind != argc - 1) {
+	    usage();
+	}
+	open_frames(argv[optind]);
+    }
     glutInitDisplayMode(GLUT_RGB | GLUT_DOUBLE);
 
     glutInitWindowPosition(0, 0);
     glutInitWindowSize(width, height);
     glutCreateWindow("showpix");
-    init(argv[1]);
+    init();
 
-    glutDisplayFunc(draw);
     glutReshapeFunc(reshape);
-    //glutKeyboardFunc(key);
-    //glutSpecialFunc(special);
-    //glutPassiveMotionFunc(passive_motion);
-    //glutVisibilityFunc(visible);
+    glutKeyboardFunc(keyboard);
 
     glutMainLoop();
     return 0;			/* ANSI C requires main to return int. */
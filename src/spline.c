@@ -0,0 +1,189 @@
+/** Spline math shared by the API and the renderers.  Matrices are 4x4,
+ * row major, and map the control points of a segment to the coefficients
+ * of t^3, t^2, t and 1. */
+
+#ifdef __SSE__
+#include <xmmintrin.h>
+#endif
+
+#include "psr_internal.h"
+
+/** the Catmull-Rom basis, tightness 0 is Catmull-Rom proper and 1
+ * straight lines between the points. */
+void psr_curve_basis(float s, float m[16])
+{
+    m[0] = (s - 1) / 2;
+    m[1] = (s + 3) / 2;
+    m[2] = (-3 - s) / 2;
+    m[3] = (1 - s) / 2;
+
+    m[4] = 1 - s;
+    m[5] = (-5 - s) / 2;
+    m[6] = s + 2;
+    m[7] = (s - 1) / 2;
+
+    m[8] = (s - 1) / 2;
+    m[9] = 0;
+    m[10] = (1 - s) / 2;
+    m[11] = 0;
+
+    m[12] = 0;
+    m[13] = 1;
+    m[14] = 0;
+    m[15] = 0;
+}
+
+/** the forward difference matrix for detail steps times basis.  applied
+ * to the control points it gives the start point and its first, second
+ * and third difference, the segment is then plotted with additions
+ * only. */
+void psr_spline_draw_matrix(const float basis[16], int detail, float out[16])
+{
+    const float f = 1.0f / detail, ff = f * f, fff = ff * f;
+    const float d[16] = {
+	0, 0, 0, 1,
+	fff, ff, f, 0,
+	6 * fff, 2 * ff, 0, 0,
+	6 * fff, 0, 0, 0,
+    };
+    int r, c, k;
+
+    for (r = 0; r < 4; ++r) {
+	for (c = 0; c < 4; ++c) {
+	    out[r * 4 + c] = 0;
+	    for (k = 0; k < 4; ++k) {
+		out[r * 4 + c] += d[r * 4 + k] * basis[k * 4 + c];
+	    }
+	}
+    }
+}
+
+/** the coefficients of one axis, m times (a, b, c, d) */
+static inline void coefficients(const float m[16], float a, float b,
+				float c, float d, float out[4])
+{
+    int r;
+
+    for (r = 0; r < 4; ++r) {
+	out[r] = m[r * 4] * a + m[r * 4 + 1] * b + m[r * 4 + 2] * c
+	    + m[r * 4 + 3] * d;
+    }
+}
+
+float psr_spline_point(const float basis[16], float a, float b, float c,
+		       float d, float t)
+{
+    float k[4];
+
+    coefficients(basis, a, b, c, d, k);
+    return ((k[0] * t + k[1]) * t + k[2]) * t + k[3];
+}
+
+float psr_spline_tangent(const float basis[16], float a, float b, float c,
+			 float d, float t)
+{
+    float k[4];
+
+    coefficients(basis, a, b, c, d, k);
+    return (3 * k[0] * t + 2 * k[1]) * t + k[2];
+}
+
+/** plot a segment with a draw matrix of psr_spline_draw_matrix().  p
+ * holds the four control points as x, y, z; the detail points after the
+ * first one go to out. */
+void psr_spline_plot(const float draw[16], int detail, const float p[12],
+		     float *out)
+{
+    float x[4], y[4], z[4];
+    int i;
+
+    coefficients(draw, p[0], p[3], p[6], p[9], x);
+    coefficients(draw, p[1], p[4], p[7], p[10], y);
+    coefficients(draw, p[2], p[5], p[8], p[11], z);
+    for (i = 0; i < detail; ++i) {
+	x[0] += x[1];
+	x[1] += x[2];
+	x[2] += x[3];
+	y[0] += y[1];
+	y[1] += y[2];
+	y[2] += y[3];
+	z[0] += z[1];
+	z[1] += z[2];
+	z[2] += z[3];
+	*out++ = x[0];
+	*out++ = y[0];
+	*out++ = z[0];
+    }
+}
+
+/** the cubic bezier (a, b, c, d) and its derivative at n values of t.
+ * with stride 1 every lane has its own control values, with stride 0
+ * a, b, c and d point to single values shared by all lanes.  points or
+ * tangents may be NULL.  four lanes at a time with SSE. */
+void psr_bezier_eval(const float *a, const float *b, const float *c,
+		     const float *d, int stride, const float *t, int n,
+		     float *points, float *tangents)
+{
+    int i = 0;
+#ifdef __SSE__
+    __m128 va, vb, vc, vd;
+    const __m128 one = _mm_set1_ps(1), three = _mm_set1_ps(3);
+    const __m128 two = _mm_set1_ps(2);
+#endif
+
+    if (n <= 0) {
+	return;
+    }
+#ifdef __SSE__
+    va = _mm_set1_ps(*a);
+    vb = _mm_set1_ps(*b);
+    vc = _mm_set1_ps(*c);
+    vd = _mm_set1_ps(*d);
+
+    for (; i + 4 <= n; i += 4) {
+	__m128 vt = _mm_loadu_ps(t + i);
+	__m128 mt = _mm_sub_ps(one, vt);
+	__m128 tt = _mm_mul_ps(vt, vt), mm = _mm_mul_ps(mt, mt);
+	__m128 mtt = _mm_mul_ps(mt, vt);
+
+	if (stride) {
+	    va = _mm_loadu_ps(a + i);
+	    vb = _mm_loadu_ps(b + i);
+	    vc = _mm_loadu_ps(c + i);
+	    vd = _mm_loadu_ps(d + i);
+	}
+	if (points) {
+	    /* mt^3 a + 3 mt^2 t b + 3 mt t^2 c + t^3 d */
+	    __m128 b1 = _mm_mul_ps(three, _mm_mul_ps(mm, vt));
+	    __m128 b2 = _mm_mul_ps(three, _mm_mul_ps(mtt, vt));
+	    __m128 p = _mm_mul_ps(_mm_mul_ps(mm, mt), va);
+	    p = _mm_add_ps(p, _mm_mul_ps(b1, vb));
+	    p = _mm_add_ps(p, _mm_mul_ps(b2, vc));
+	    p = _mm_add_ps(p, _mm_mul_ps(_mm_mul_ps(tt, vt), vd));
+	    _mm_storeu_ps(points + i, p);
+	}
+	if (tangents) {
+	    /* 3 (mt^2 (b - a) + 2 mt t (c - b) + t^2 (d - c)) */
+	    __m128 g = _mm_mul_ps(mm, _mm_sub_ps(vb, va));
+	    g = _mm_add_ps(g, _mm_mul_ps(_mm_mul_ps(two, mtt),
+					 _mm_sub_ps(vc, vb)));
+	    g = _mm_add_ps(g, _mm_mul_ps(tt, _mm_sub_ps(vd, vc)));
+	    _mm_storeu_ps(tangents + i, _mm_mul_ps(three, g));
+	}
+    }
+#endif
+    for (; i < n; ++i) {
+	const int k = i * stride;
+	const float u = t[i], mt = 1 - u;
+
+	if (points) {
+	    points[i] = mt * mt * mt * a[k] + 3 * mt * mt * u * b[k]
+		+ 3 * mt * u * u * c[k] + u * u * u * d[k];
+	}
+	if (tangents) {
+	    tangents[i] = 3 * (mt * mt * (b[k] - a[k])
+			       + 2 * mt * u * (c[k] - b[k])
+			       + u * u * (d[k] - c[k]));
+	}
+    }
+}
@@ -0,0 +1,310 @@
+/** Trace capture.  Every renderer_context call is encoded like in
+ * cmdbuf.c, appended to a trace file and then passed on to the real
+ * renderer.  Frames are separated by PSR_CMD_FRAME.  psr-replay plays
+ * a trace back. */
+
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+
+#include "psr_cmdbuf.h"
+
+/* flush the buffer to the file once it is this big, in words */
+#define TRACE_FLUSH_WORDS (1 << 18)
+
+struct psr_trace {
+    FILE *fp;
+    struct psr_cmdbuf buf;
+    struct psr_renderer_context real;
+    void (*usr_draw) (void);
+    void (*default_setup) (void);
+    struct psr_trace *next;	/* of the open ones */
+};
+
+/* the traces still open at exit() */
+static struct psr_trace *open_traces = NULL;
+static int exit_hooked = 0;
+static pthread_mutex_t traces_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void trace_flush(struct psr_trace *t)
+{
+    if (t->buf.len &&
+	fwrite(t->buf.data, sizeof(*t->buf.data), t->buf.len,
+	       t->fp) != t->buf.len) {
+	psr_system_warn(errno, "can't write the trace.");
+    }
+    t->buf.len = 0;
+}
+
+static void trace_close(struct psr_trace *t)
+{
+    trace_flush(t);
+    fclose(t->fp);
+    psr_cmdbuf_free(&t->buf);
+    free(t);
+}
+
+static void trace_close_all(void)
+{
+    struct psr_trace *t;
+
+    pthread_mutex_lock(&traces_lock);
+    while (open_traces) {
+	t = open_traces;
+	open_traces = t->next;
+	trace_close(t);
+    }
+    pthread_mutex_unlock(&traces_lock);
+}
+
+/* encode the call with the recorder, then replay it into the real
+ * renderer.  a call the recorder refused left nothing to replay. */
+#define TRACE(name, params, args)					\
+    static int trace_##name params					\
+    {									\
+	struct psr_trace *t = psr_current->trace;			\
+	struct psr_cmdbuf *target = psr_cmdbuf_target;			\
+	size_t offset = t->buf.len;					\
+	int ret;							\
+	psr_cmdbuf_target = &t->buf;					\
+	ret = psr_cmdbuf_recorder.name args;				\
+	psr_cmdbuf_target = target;					\
+	if (ret < 0 && t->buf.len == offset) {				\
+	    return ret;							\
+	}								\
+	return psr_cmd_replay(t->buf.data + offset, &t->real);		\
+    }
+
+TRACE(size, (int width, int height), (width, height))
+TRACE(no_loop, (void), ())
+TRACE(loop, (void), ())
+TRACE(redraw, (void), ())
+TRACE(frame_rate, (float framerate), (framerate))
+TRACE(cursor, (int type), (type))
+TRACE(stroke, (float r, float g, float b, float a), (r, g, b, a))
+TRACE(no_stroke, (void), ())
+TRACE(background, (float r, float g, float b, float a), (r, g, b, a))
+TRACE(push_matrix, (void), ())
+TRACE(pop_matrix, (void), ())
+TRACE(apply_matrix,
+      (float n11, float n12, float n13, float n14,
+       float n21, float n22, float n23, float n24,
+       float n31, float n32, float n33, float n34,
+       float n41, float n42, float n43, float n44),
+      (n11, n12, n13, n14, n21, n22, n23, n24,
+       n31, n32, n33, n34, n41, n42, n43, n44))
+TRACE(reset_matrix, (void), ())
+TRACE(print_matrix, (void), ())
+TRACE(translate, (float x, float y, float z), (x, y, z))
+TRACE(rotate, (float angle, float x, float y, float z), (angle, x, y, z))
+TRACE(scale, (float x, float y, float z), (x, y, z))
+TRACE(begin_shape, (int mode), (mode))
+TRACE(vertex, (float x, float y, float z, float u, float v),
+      (x, y, z, u, v))
+TRACE(end_shape, (int end_mode), (end_mode))
+TRACE(arc, (float x, float y, float width, float height, float start,
+	    float stop), (x, y, width, height, start, stop))
+TRACE(bezier_detail, (int level), (level))
+TRACE(bezier_vertex,
+      (float cx1, float cy1, float cz1, float cx2, float cy2, float cz2,
+       float x, float y, float z),
+      (cx1, cy1, cz1, cx2, cy2, cz2, x, y, z))
+TRACE(box, (float width, float height, float depth),
+      (width, height, depth))
+TRACE(sphere, (float radius), (radius))
+TRACE(sphere_detail, (int n), (n))
+TRACE(stroke_weight, (float width), (width))
+TRACE(smooth, (void), ())
+TRACE(no_smooth, (void), ())
+TRACE(fill, (float r, float g, float b, float a), (r, g, b, a))
+TRACE(no_fill, (void), ())
+TRACE(image, (struct psr_image *img, float x, float y, float width,
+	      float height), (img, x, y, width, height))
+TRACE(camera_default, (void), ())
+TRACE(camera, (float eye_x, float eye_y, float eye_z,
+	       float center_x, float center_y, float center_z,
+	       float up_x, float up_y, float up_z),
+      (eye_x, eye_y, eye_z, center_x, center_y, center_z,
+       up_x, up_y, up_z))
+TRACE(begin_camera, (void), ())
+TRACE(end_camera, (void), ())
+TRACE(ortho, (float left, float right, float bottom, float top,
+	      float near, float far), (left, right, bottom, top, near, far))
+TRACE(create_shape, (int handle), (handle))
+TRACE(end_shape_record, (void), ())
+TRACE(shape, (int handle), (handle))
+TRACE(free_shape, (int handle), (handle))
+TRACE(text_font, (const char *path), (path))
+TRACE(text_size, (float size), (size))
+TRACE(text, (const char *str, float x, float y), (str, x, y))
+TRACE(stroke_join, (int join), (join))
+TRACE(stroke_cap, (int cap), (cap))
+TRACE(curve_detail, (int level), (level))
+TRACE(curve_tightness, (float tightness), (tightness))
+TRACE(curve_vertex, (float x, float y, float z), (x, y, z))
+TRACE(hint, (int which), (which))
+TRACE(pick_id, (int id), (id))
+TRACE(auto_detail, (float max_error), (max_error))
+TRACE(dirty_rect, (float x, float y, float width, float height),
+      (x, y, width, height))
+TRACE(create_graphics, (int handle, int width, int height),
+      (handle, width, height))
+TRACE(free_graphics, (int handle), (handle))
+TRACE(begin_draw, (int handle), (handle))
+TRACE(end_draw, (void), ())
+TRACE(image_graphics, (int handle, float x, float y, float width,
+		       float height), (handle, x, y, width, height))
+TRACE(composite, (int handle, int mode, float opacity),
+      (handle, mode, opacity))
+
+/** the caller's image pointer means nothing in a trace, the save is
+ * recorded without arguments. */
+static int trace_save(struct psr_image *img)
+{
+    struct psr_trace *t = psr_current->trace;
+
+    psr_cmdbuf_alloc(&t->buf, PSR_CMD_SAVE, 0);
+    return t->real.save(img);
+}
+
+static void trace_draw(void)
+{
+    struct psr_trace *t = psr_current->trace;
+
+    if (t->buf.len >= TRACE_FLUSH_WORDS) {
+	trace_flush(t);
+    }
+    psr_cmdbuf_alloc(&t->buf, PSR_CMD_FRAME, 0);
+    t->usr_draw();
+}
+
+/** the renderer fills the renderer_context in main_loop_start(), so the
+ * calls are only hooked right before default_setup(). */
+static void trace_default_setup(void)
+{
+    const uint32_t header[] = {PSR_TRACE_MAGIC, PSR_TRACE_VERSION};
+    struct psr_renderer_context *renderer = &psr_current->renderer;
+    struct psr_trace *t = psr_current->trace;
+
+    fwrite(header, sizeof(header), 1, t->fp);
+
+    t->real = *renderer;
+    renderer->size = trace_size;
+    renderer->no_loop = trace_no_loop;
+    renderer->loop = trace_loop;
+    renderer->redraw = trace_redraw;
+    renderer->frame_rate = trace_frame_rate;
+    renderer->cursor = trace_cursor;
+    renderer->stroke = trace_stroke;
+    renderer->no_stroke = trace_no_stroke;
+    renderer->background = trace_background;
+    renderer->push_matrix = trace_push_matrix;
+    renderer->pop_matrix = trace_pop_matrix;
+    renderer->apply_matrix = trace_apply_matrix;
+    renderer->reset_matrix = trace_reset_matrix;
+    renderer->print_matrix = trace_print_matrix;
+    renderer->translate = trace_translate;
+    renderer->rotate = trace_rotate;
+    renderer->scale = trace_scale;
+    renderer->begin_shape = trace_begin_shape;
+    renderer->vertex = trace_vertex;
+    renderer->end_shape = trace_end_shape;
+    renderer->arc = trace_arc;
+    renderer->bezier_detail = trace_bezier_detail;
+    renderer->bezier_vertex = trace_bezier_vertex;
+    renderer->box = trace_box;
+    renderer->sphere = trace_sphere;
+    renderer->sphere_detail = trace_sphere_detail;
+    renderer->stroke_weight = trace_stroke_weight;
+    renderer->smooth = trace_smooth;
+    renderer->no_smooth = trace_no_smooth;
+    renderer->fill = trace_fill;
+    renderer->no_fill = trace_no_fill;
+    renderer->save = trace_save;
+    renderer->image = trace_image;
+    renderer->camera_default = trace_camera_default;
+    renderer->camera = trace_camera;
+    renderer->begin_camera = trace_begin_camera;
+    renderer->end_camera = trace_end_camera;
+    renderer->ortho = trace_ortho;
+    renderer->create_shape = trace_create_shape;
+    renderer->end_shape_record = trace_end_shape_record;
+    renderer->shape = trace_shape;
+    renderer->free_shape = trace_free_shape;
+    renderer->text_font = trace_text_font;
+    renderer->text_size = trace_text_size;
+    renderer->text = trace_text;
+    renderer->stroke_join = trace_stroke_join;
+    renderer->stroke_cap = trace_stroke_cap;
+    renderer->curve_detail = trace_curve_detail;
+    renderer->curve_tightness = trace_curve_tightness;
+    renderer->curve_vertex = trace_curve_vertex;
+    renderer->hint = trace_hint;
+    renderer->pick_id = trace_pick_id;
+    renderer->auto_detail = trace_auto_detail;
+    renderer->dirty_rect = trace_dirty_rect;
+    renderer->create_graphics = trace_create_graphics;
+    renderer->free_graphics = trace_free_graphics;
+    renderer->begin_draw = trace_begin_draw;
+    renderer->end_draw = trace_end_draw;
+    renderer->image_graphics = trace_image_graphics;
+    renderer->composite = trace_composite;
+
+
+    t->default_setup();
+}
+
+int psr_trace_start(const char *path, struct psr_ctx *ctx)
+{
+    struct psr_context *cxt = &ctx->context;
+    struct psr_trace *t;
+
+    t = calloc(1, sizeof(*t));
+    if (!t) {
+	psr_system_error(errno, "No memory for the trace.");
+	return -1;
+    }
+    t->fp = fopen(path, "w");
+    if (!t->fp) {
+	psr_system_warn(errno, "can't open trace %s", path);
+	free(t);
+	return -1;
+    }
+    pthread_mutex_lock(&traces_lock);
+    t->next = open_traces;
+    open_traces = t;
+    /* GLUT leaves through exit() */
+    if (!exit_hooked) {
+	atexit(trace_close_all);
+	exit_hooked = 1;
+    }
+    pthread_mutex_unlock(&traces_lock);
+    ctx->trace = t;
+
+    t->default_setup = cxt->default_setup;
+    cxt->default_setup = trace_default_setup;
+    if (cxt->usr_func.draw) {
+	t->usr_draw = cxt->usr_func.draw;
+	cxt->usr_func.draw = trace_draw;
+    }
+    return 0;
+}
+
+void psr_trace_end(struct psr_ctx *ctx)
+{
+    struct psr_trace **p;
+
+    if (!ctx->trace) {
+	return;
+    }
+    pthread_mutex_lock(&traces_lock);
+    for (p = &open_traces; *p; p = &(*p)->next) {
+	if (*p == ctx->trace) {
+	    *p = ctx->trace->next;
+	    trace_close(ctx->trace);
+	    break;
+	}
+    }
+    pthread_mutex_unlock(&traces_lock);
+    ctx->trace = NULL;
+}